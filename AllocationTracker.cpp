@@ -0,0 +1,202 @@
+//
+// Created by Lenovo on 19/06/2023.
+//
+
+#include "AllocationTracker.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <mutex>
+#include <new>
+#include <sys/resource.h>
+
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+#include "Eigen/Core"
+#endif
+
+const char* trainingPhaseName(TrainingPhase phase)
+{
+    switch (phase)
+    {
+        case TrainingPhase::FORWARD: return "forward";
+        case TrainingPhase::BACKWARD: return "backward";
+        case TrainingPhase::OPTIMIZER: return "optimizer";
+        case TrainingPhase::EVALUATION: return "evaluation";
+        case TrainingPhase::DATA_LOAD: return "data load";
+    }
+    return "unknown";
+}
+
+long peakResidentMemoryKb()
+{
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss; // kilobytes on linux
+}
+
+std::ostream& printAllocationReport(std::ostream& out, const AllocationReport& report)
+{
+    const std::streamsize prevPrecision = out.precision();
+    out << " -> Allocations (malloc):\n";
+    for(size_t phase = 0; phase < NUM_TRAINING_PHASES; ++phase)
+    {
+        const PhaseAllocationStats& stats = report[phase];
+        const double perScope = stats.scopes > 0 ? static_cast<double> (stats.allocations) / static_cast<double> (stats.scopes) : 0;
+        out << "   --> " << std::left << std::setw(11) << trainingPhaseName(static_cast<TrainingPhase> (phase)) << std::right
+            << stats.allocations << " allocs (" << std::setprecision(2) << perScope << " per step), "
+            << stats.bytes << " bytes, peak RSS " << stats.peakRssKb << " KB" << std::endl;
+    }
+    out.precision(prevPrecision);
+    return out;
+}
+
+#ifdef NNETWORK_TRACK_ALLOCATIONS
+
+// counters for the calling thread, updated by the malloc wrappers below
+static thread_local size_t threadAllocations = 0;
+static thread_local size_t threadBytes = 0;
+
+static void countAllocation(size_t size)
+{
+    threadAllocations++;
+    threadBytes += size;
+}
+
+static std::mutex reportMutex;
+static AllocationReport report;
+
+AllocationReport allocationReport()
+{
+    std::lock_guard<std::mutex> lock(reportMutex);
+    return report;
+}
+
+void resetAllocationReport()
+{
+    std::lock_guard<std::mutex> lock(reportMutex);
+    report = AllocationReport();
+}
+
+AllocationScope::AllocationScope(TrainingPhase phase, bool forbidEigenMalloc) :
+    mPhase(phase),
+    mStartAllocations(threadAllocations),
+    mStartBytes(threadBytes),
+    mForbidEigenMalloc(forbidEigenMalloc),
+    mEigenMallocWasAllowed(true)
+{
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+    if(mForbidEigenMalloc)
+    {
+        mEigenMallocWasAllowed = Eigen::internal::is_malloc_allowed();
+        Eigen::internal::set_is_malloc_allowed(false);
+    }
+#endif
+}
+
+AllocationScope::~AllocationScope()
+{
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+    if(mForbidEigenMalloc)
+    {
+        Eigen::internal::set_is_malloc_allowed(mEigenMallocWasAllowed);
+    }
+#endif
+    const size_t allocations = threadAllocations - mStartAllocations, bytes = threadBytes - mStartBytes;
+    const long peakRss = peakResidentMemoryKb();
+    std::lock_guard<std::mutex> lock(reportMutex);
+    PhaseAllocationStats& stats = report[static_cast<size_t> (mPhase)];
+    stats.scopes++;
+    stats.allocations += allocations;
+    stats.bytes += bytes;
+    stats.peakRssKb = peakRss;
+}
+
+// the build links with --wrap for these so every call to them from this program's objects (Eigen's aligned_malloc,
+// the operator new replacements below...) comes here first
+extern "C"
+{
+    void* __real_malloc(size_t size);
+    void* __real_calloc(size_t count, size_t size);
+    void* __real_realloc(void* ptr, size_t size);
+    void* __real_aligned_alloc(size_t alignment, size_t size);
+    int __real_posix_memalign(void** ptr, size_t alignment, size_t size);
+
+    void* __wrap_malloc(size_t size)
+    {
+        countAllocation(size);
+        return __real_malloc(size);
+    }
+
+    void* __wrap_calloc(size_t count, size_t size)
+    {
+        countAllocation(count * size);
+        return __real_calloc(count, size);
+    }
+
+    void* __wrap_realloc(void* ptr, size_t size)
+    {
+        countAllocation(size);
+        return __real_realloc(ptr, size);
+    }
+
+    void* __wrap_aligned_alloc(size_t alignment, size_t size)
+    {
+        countAllocation(size);
+        return __real_aligned_alloc(alignment, size);
+    }
+
+    int __wrap_posix_memalign(void** ptr, size_t alignment, size_t size)
+    {
+        countAllocation(size);
+        return __real_posix_memalign(ptr, alignment, size);
+    }
+}
+
+// the library's operator new lives in the shared C++ runtime, out of reach of --wrap, so it is replaced with one that
+// calls malloc from here
+static void* checkedAllocation(size_t size)
+{
+    void* ptr = std::malloc(size > 0 ? size : 1);
+    if(ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+static void* checkedAlignedAllocation(size_t size, std::align_val_t alignment)
+{
+    const auto align = static_cast<size_t> (alignment);
+    void* ptr = std::aligned_alloc(align, (size + align - 1) / align * align);
+    if(ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new(size_t size) { return checkedAllocation(size); }
+void* operator new[](size_t size) { return checkedAllocation(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return checkedAlignedAllocation(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return checkedAlignedAllocation(size, alignment); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { std::free(ptr); }
+
+#else
+
+AllocationReport allocationReport()
+{
+    return {};
+}
+
+void resetAllocationReport()
+{
+}
+
+#endif
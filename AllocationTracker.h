@@ -0,0 +1,78 @@
+//
+// Created by Lenovo on 19/06/2023.
+//
+
+#ifndef NNETWORK2_ALLOCATIONTRACKER_H
+#define NNETWORK2_ALLOCATIONTRACKER_H
+
+#include <array>
+#include <cstddef>
+#include <ostream>
+
+// Heap allocation instrumentation - enabled by configuring with -DNNETWORK_TRACK_ALLOCATIONS=ON.
+// Calls to malloc and friends (Eigen's allocations as well as operator new) are counted per training phase, by linking
+// with --wrap for them. Configuring with -DNNETWORK_CHECK_EIGEN_MALLOC=ON as well makes Eigen assert if it heap allocates
+// in a phase that must be allocation free (EIGEN_RUNTIME_NO_MALLOC): the batched forward and backward passes and the
+// optimizer step. That flag is process wide, so don't combine the check with StreamingBatchSource, whose producer
+// thread allocates while training runs, and a SweepRunner then runs one trial at a time. Eigen's check is an assert,
+// so the check needs a build without NDEBUG. In normal builds scopes compile to nothing.
+
+enum class TrainingPhase
+{
+        FORWARD = 0,
+        BACKWARD = 1,
+        OPTIMIZER = 2,
+        EVALUATION = 3,
+        DATA_LOAD = 4
+};
+constexpr size_t NUM_TRAINING_PHASES = 5;
+
+const char* trainingPhaseName(TrainingPhase phase);
+
+struct PhaseAllocationStats
+{
+    size_t scopes = 0; // times the phase ran
+    size_t allocations = 0;
+    size_t bytes = 0;
+    long peakRssKb = 0; // peak resident memory of the process when the phase last finished
+};
+using AllocationReport = std::array<PhaseAllocationStats, NUM_TRAINING_PHASES>;
+
+constexpr bool allocationTrackingEnabled()
+{
+#ifdef NNETWORK_TRACK_ALLOCATIONS
+    return true;
+#else
+    return false;
+#endif
+}
+
+AllocationReport allocationReport();
+void resetAllocationReport();
+long peakResidentMemoryKb();
+std::ostream& printAllocationReport(std::ostream& out, const AllocationReport& report);
+
+// attributes the allocations made by this thread while in scope to a phase
+class AllocationScope
+{
+#ifdef NNETWORK_TRACK_ALLOCATIONS
+    private:
+        TrainingPhase mPhase;
+        size_t mStartAllocations;
+        size_t mStartBytes;
+        bool mForbidEigenMalloc;
+        bool mEigenMallocWasAllowed;
+
+    public:
+        // with forbidEigenMalloc Eigen asserts if it heap allocates inside the scope
+        explicit AllocationScope(TrainingPhase phase, bool forbidEigenMalloc = false);
+        ~AllocationScope();
+#else
+    public:
+        explicit AllocationScope(TrainingPhase, bool = false) {}
+#endif
+        AllocationScope(const AllocationScope&) = delete;
+        AllocationScope& operator=(const AllocationScope&) = delete;
+};
+
+#endif //NNETWORK2_ALLOCATIONTRACKER_H
@@ -0,0 +1,360 @@
+//
+// Created by Lenovo on 02/08/2023.
+//
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+#include "BatchSource.h"
+#include "ThreadConfig.h"
+#include "Trace.h"
+
+ExampleDataSource::ExampleDataSource(const ExampleData& data, Sampler sampler) : mData(data), mSampler(sampler)
+{
+    mSampler.order(mData.size(), 0, mOrder);
+}
+
+ExampleDataSource::ExampleDataSource(const ExampleData& data, bool shuffle) :
+    ExampleDataSource(data, Sampler(shuffle ? SamplingMethod::SHUFFLE : SamplingMethod::SEQUENTIAL))
+{
+}
+
+void ExampleDataSource::startEpoch(size_t epoch)
+{
+    mSampler.order(mData.size(), epoch, mOrder);
+    mNextItem = 0;
+}
+
+void ExampleDataSource::rewind()
+{
+    mNextItem = 0;
+}
+
+bool ExampleDataSource::nextBatch(size_t batchSz, ExampleBatchIterator& batchStart, ExampleBatchIterator& batchEnd)
+{
+    if(mNextItem >= mData.size())
+    {
+        return false;
+    }
+    const size_t lastItem = std::min(mNextItem + batchSz, mData.size());
+    // batches are read in place, through the epoch's order
+    batchStart = ExampleBatchIterator(mData.cbegin(), mOrder.data(), static_cast<std::ptrdiff_t>(mNextItem));
+    batchEnd = ExampleBatchIterator(mData.cbegin(), mOrder.data(), static_cast<std::ptrdiff_t>(lastItem));
+    mNextItem = lastItem;
+    return true;
+}
+
+size_t ExampleDataSource::size() const
+{
+    return mData.size();
+}
+
+//***********//
+
+template<typename RawT>
+RawExampleDataSource<RawT>::RawExampleDataSource(const RawExampleData<RawT>& data, DataNormaliser normaliser, Sampler sampler) :
+    mData(data), mNormaliser(std::move(normaliser)), mSampler(sampler)
+{
+    mSampler.order(mData.size(), 0, mOrder);
+}
+
+template<typename RawT>
+RawExampleDataSource<RawT>::RawExampleDataSource(const RawExampleData<RawT>& data, DataNormaliser normaliser, bool shuffle) :
+    RawExampleDataSource(data, std::move(normaliser), Sampler(shuffle ? SamplingMethod::SHUFFLE : SamplingMethod::SEQUENTIAL))
+{
+}
+
+template<typename RawT>
+void RawExampleDataSource<RawT>::startEpoch(size_t epoch)
+{
+    mSampler.order(mData.size(), epoch, mOrder);
+    mNextItem = 0;
+}
+
+template<typename RawT>
+void RawExampleDataSource<RawT>::rewind()
+{
+    mNextItem = 0;
+}
+
+template<typename RawT>
+bool RawExampleDataSource<RawT>::nextBatch(size_t batchSz, ExampleBatchIterator& batchStart, ExampleBatchIterator& batchEnd)
+{
+    if(mNextItem >= mData.size())
+    {
+        return false;
+    }
+    const size_t lastItem = std::min(mNextItem + batchSz, mData.size());
+    gatherBatch(mData, mNormaliser, mOrder, mNextItem, lastItem, mBatch);
+    batchStart = mBatch.cbegin();
+    batchEnd = mBatch.cend();
+    mNextItem = lastItem;
+    return true;
+}
+
+template<typename RawT>
+size_t RawExampleDataSource<RawT>::size() const
+{
+    return mData.size();
+}
+
+template class RawExampleDataSource<uint8_t>;
+template class RawExampleDataSource<uint16_t>;
+
+//***********//
+
+MappedExampleDataSource::MappedExampleDataSource(const MappedExampleData& data, DataNormaliser normaliser, Sampler sampler) :
+    mData(data), mNormaliser(std::move(normaliser)), mSampler(sampler)
+{
+    mSampler.order(mData.size(), 0, mOrder);
+}
+
+MappedExampleDataSource::MappedExampleDataSource(const MappedExampleData& data, DataNormaliser normaliser, bool shuffle) :
+    MappedExampleDataSource(data, std::move(normaliser), Sampler(shuffle ? SamplingMethod::SHUFFLE : SamplingMethod::SEQUENTIAL))
+{
+}
+
+void MappedExampleDataSource::startEpoch(size_t epoch)
+{
+    mSampler.order(mData.size(), epoch, mOrder);
+    mNextItem = 0;
+}
+
+void MappedExampleDataSource::rewind()
+{
+    mNextItem = 0;
+}
+
+bool MappedExampleDataSource::nextBatch(size_t batchSz, ExampleBatchIterator& batchStart, ExampleBatchIterator& batchEnd)
+{
+    if(mNextItem >= mData.size())
+    {
+        return false;
+    }
+    const size_t lastItem = std::min(mNextItem + batchSz, mData.size());
+    gatherBatch(mData, mNormaliser, mOrder, mNextItem, lastItem, mBatch);
+    batchStart = mBatch.cbegin();
+    batchEnd = mBatch.cend();
+    mNextItem = lastItem;
+    return true;
+}
+
+size_t MappedExampleDataSource::size() const
+{
+    return mData.size();
+}
+
+//***********//
+
+StreamingBatchSource::StreamingBatchSource(std::vector<std::string> shardFiles, Sampler sampler, size_t shuffleBufferSz, size_t blockSz) :
+    mShardFiles(std::move(shardFiles)), mNormalise(false), mSampler(sampler), mShuffleBufferSz(shuffleBufferSz), mBlockSz(std::max<size_t>(blockSz, 1))
+{
+}
+
+StreamingBatchSource::StreamingBatchSource(std::vector<std::string> shardFiles, DataNormaliser normaliser, Sampler sampler, size_t shuffleBufferSz, size_t blockSz) :
+    mShardFiles(std::move(shardFiles)), mNormaliser(std::move(normaliser)), mNormalise(true), mSampler(sampler), mShuffleBufferSz(shuffleBufferSz), mBlockSz(std::max<size_t>(blockSz, 1))
+{
+}
+
+StreamingBatchSource::StreamingBatchSource(std::vector<std::string> shardFiles, DataNormaliser normaliser, bool shuffle, size_t shuffleBufferSz, size_t blockSz) :
+    StreamingBatchSource(std::move(shardFiles), std::move(normaliser), Sampler(shuffle ? SamplingMethod::SHUFFLE : SamplingMethod::SEQUENTIAL), shuffleBufferSz, blockSz)
+{
+}
+
+StreamingBatchSource::~StreamingBatchSource()
+{
+    stopProducer();
+}
+
+void StreamingBatchSource::startEpoch(size_t epoch)
+{
+    mEpoch = epoch;
+    startPass(mSampler.method() != SamplingMethod::SEQUENTIAL);
+}
+
+void StreamingBatchSource::rewind()
+{
+    startPass(false);
+}
+
+size_t StreamingBatchSource::size() const
+{
+    return mItemsLastPass;
+}
+
+void StreamingBatchSource::stopProducer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopProducer = true;
+    }
+    mBlockTaken.notify_all();
+    if(mProducer.joinable())
+    {
+        mProducer.join();
+    }
+}
+
+void StreamingBatchSource::startPass(bool shuffle)
+{
+    stopProducer();
+    mReadyBlocks.clear();
+    mCurrentBlock.clear();
+    mCurrentPos = 0;
+    mItemsThisPass = 0;
+    mProducerFinished = false;
+    mStopProducer = false;
+    mProducerError = nullptr;
+
+    std::vector<size_t> shardOrder(mShardFiles.size());
+    std::iota(shardOrder.begin(), shardOrder.end(), 0);
+    if(shuffle)
+    {
+        mSampler.order(mShardFiles.size(), mEpoch, shardOrder);
+    }
+    mProducer = std::thread(&StreamingBatchSource::produce, this, std::move(shardOrder), shuffle, mSampler.generatorForEpoch(mEpoch));
+}
+
+void StreamingBatchSource::publishBlock(ExampleData& block)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mBlockTaken.wait(lock, [this]{ return mStopProducer || mReadyBlocks.size() < PREFETCH_BLOCKS; });
+    if(mStopProducer)
+    {
+        return;
+    }
+    mReadyBlocks.push_back(std::move(block));
+    block = ExampleData();
+    block.reserve(mBlockSz);
+    mBlockReady.notify_one();
+}
+
+void StreamingBatchSource::produce(std::vector<size_t> shardOrder, bool shuffle, std::default_random_engine generator)
+{
+    setTraceThreadName("batch producer");
+    unpinCurrentThread();
+    try
+    {
+        ExampleData shuffleBuffer, block;
+        shuffleBuffer.reserve(mShuffleBufferSz);
+        block.reserve(mBlockSz);
+
+        const auto emit = [&](ExampleItem&& item)
+        {
+            block.push_back(std::move(item));
+            if(block.size() == mBlockSz)
+            {
+                publishBlock(block);
+            }
+        };
+
+        for(size_t shardPos : shardOrder)
+        {
+            ExampleData shard;
+            {
+                TraceScope loadTrace("load_shard", "shard", static_cast<int64_t> (shardPos));
+                shard = loadShard(mShardFiles[shardPos]);
+                if(mNormalise)
+                {
+                    applyNormaliser(shard, mNormaliser);
+                }
+            }
+            for(ExampleItem& item : shard)
+            {
+                if(mStopProducer)
+                {
+                    return;
+                }
+                if(!shuffle)
+                {
+                    emit(std::move(item));
+                }
+                else if(shuffleBuffer.size() < mShuffleBufferSz)
+                {
+                    shuffleBuffer.push_back(std::move(item));
+                }
+                else
+                {
+                    // emit a random item from the buffer and replace it with the item just read
+                    std::uniform_int_distribution<size_t> distribution(0, shuffleBuffer.size() - 1);
+                    ExampleItem& replaced = shuffleBuffer[distribution(generator)];
+                    emit(std::move(replaced));
+                    replaced = std::move(item);
+                }
+            }
+        }
+        // drain the shuffle buffer then any partially filled block
+        std::shuffle(shuffleBuffer.begin(), shuffleBuffer.end(), generator);
+        for(ExampleItem& item : shuffleBuffer)
+        {
+            emit(std::move(item));
+        }
+        if(!block.empty())
+        {
+            publishBlock(block);
+        }
+    }
+    catch(...)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mProducerError = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    mProducerFinished = true;
+    mBlockReady.notify_one();
+}
+
+bool StreamingBatchSource::takeNextBlock()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mBlockReady.wait(lock, [this]{ return !mReadyBlocks.empty() || mProducerFinished; });
+    if(mProducerError)
+    {
+        std::rethrow_exception(mProducerError);
+    }
+    if(mReadyBlocks.empty())
+    {
+        return false;
+    }
+    mCurrentBlock = std::move(mReadyBlocks.front());
+    mReadyBlocks.pop_front();
+    mCurrentPos = 0;
+    mBlockTaken.notify_one();
+    return true;
+}
+
+bool StreamingBatchSource::nextBatch(size_t batchSz, ExampleBatchIterator& batchStart, ExampleBatchIterator& batchEnd)
+{
+    if(mCurrentPos == mCurrentBlock.size() && !takeNextBlock())
+    {
+        mItemsLastPass = mItemsThisPass;
+        return false;
+    }
+    const auto toIterator = [this](size_t pos){ return mCurrentBlock.cbegin() + static_cast<ExampleData::difference_type>(pos); };
+    if(mCurrentBlock.size() - mCurrentPos >= batchSz)
+    {
+        // whole batch is inside the current block so no copy is needed
+        batchStart = toIterator(mCurrentPos);
+        batchEnd = toIterator(mCurrentPos + batchSz);
+        mCurrentPos += batchSz;
+        mItemsThisPass += batchSz;
+        return true;
+    }
+    // batch spans blocks - gather into the batch buffer
+    mBatch.clear();
+    while(mBatch.size() < batchSz)
+    {
+        if(mCurrentPos == mCurrentBlock.size() && !takeNextBlock())
+        {
+            break;
+        }
+        const size_t numToCopy = std::min(batchSz - mBatch.size(), mCurrentBlock.size() - mCurrentPos);
+        mBatch.insert(mBatch.end(), toIterator(mCurrentPos), toIterator(mCurrentPos + numToCopy));
+        mCurrentPos += numToCopy;
+    }
+    mItemsThisPass += mBatch.size();
+    batchStart = mBatch.cbegin();
+    batchEnd = mBatch.cend();
+    return true;
+}
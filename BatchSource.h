@@ -0,0 +1,145 @@
+//
+// Created by Lenovo on 02/08/2023.
+//
+
+#ifndef NNETWORK2_BATCHSOURCE_H
+#define NNETWORK2_BATCHSOURCE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "Training.h"
+#include "Data.h"
+#include "DataCache.h"
+#include "Sampler.h"
+
+// supplies training items one (mini) batch at a time so that train() does not depend on how the data is stored
+class BatchSource
+{
+    public:
+        virtual ~BatchSource() = default;
+
+        // rewinds to the first batch of the given epoch (in the order chosen by the source's sampler for that epoch)
+        virtual void startEpoch(size_t epoch) = 0;
+        // rewinds to the first batch keeping the current order (used for evaluation passes)
+        virtual void rewind() = 0;
+        // sets batchStart/batchEnd to the next batch of up to batchSz items, returns false once the epoch is exhausted
+        virtual bool nextBatch(size_t batchSz, ExampleBatchIterator& batchStart, ExampleBatchIterator& batchEnd) = 0;
+        [[nodiscard]] virtual size_t size() const = 0;
+};
+
+// items already held in memory as ExampleData
+class ExampleDataSource : public BatchSource
+{
+    private:
+        const ExampleData& mData;
+        Sampler mSampler;
+        std::vector<size_t> mOrder;
+        size_t mNextItem = 0;
+
+    public:
+        ExampleDataSource(const ExampleData& data, Sampler sampler);
+        ExampleDataSource(const ExampleData& data, bool shuffle);
+
+        void startEpoch(size_t epoch) override;
+        void rewind() override;
+        bool nextBatch(size_t batchSz, ExampleBatchIterator& batchStart, ExampleBatchIterator& batchEnd) override;
+        [[nodiscard]] size_t size() const override;
+};
+
+// integer inputs kept in compact storage and converted/normalised as each batch is gathered
+template<typename RawT>
+class RawExampleDataSource : public BatchSource
+{
+    private:
+        const RawExampleData<RawT>& mData;
+        DataNormaliser mNormaliser;
+        Sampler mSampler;
+        std::vector<size_t> mOrder;
+        ExampleData mBatch;
+        size_t mNextItem = 0;
+
+    public:
+        RawExampleDataSource(const RawExampleData<RawT>& data, DataNormaliser normaliser, Sampler sampler);
+        RawExampleDataSource(const RawExampleData<RawT>& data, DataNormaliser normaliser, bool shuffle);
+
+        void startEpoch(size_t epoch) override;
+        void rewind() override;
+        bool nextBatch(size_t batchSz, ExampleBatchIterator& batchStart, ExampleBatchIterator& batchEnd) override;
+        [[nodiscard]] size_t size() const override;
+};
+
+// cached items read from the cache file's mapping, gathered (and optionally normalised) a batch at a time
+class MappedExampleDataSource : public BatchSource
+{
+    private:
+        const MappedExampleData& mData;
+        DataNormaliser mNormaliser;
+        Sampler mSampler;
+        std::vector<size_t> mOrder;
+        ExampleData mBatch;
+        size_t mNextItem = 0;
+
+    public:
+        MappedExampleDataSource(const MappedExampleData& data, DataNormaliser normaliser, Sampler sampler);
+        MappedExampleDataSource(const MappedExampleData& data, DataNormaliser normaliser, bool shuffle);
+
+        void startEpoch(size_t epoch) override;
+        void rewind() override;
+        bool nextBatch(size_t batchSz, ExampleBatchIterator& batchStart, ExampleBatchIterator& batchEnd) override;
+        [[nodiscard]] size_t size() const override;
+};
+
+// reads shards (csv or binary) sequentially on a background thread so that data larger than memory can be trained on.
+// unless the sampler is SEQUENTIAL, shuffling is over the shard order (chosen by the sampler) plus a fixed size in-memory shuffle buffer.
+// size() is only known after a full pass (0 before the first pass completes)
+class StreamingBatchSource : public BatchSource
+{
+    private:
+        std::vector<std::string> mShardFiles;
+        DataNormaliser mNormaliser;
+        bool mNormalise;
+        Sampler mSampler;
+        size_t mShuffleBufferSz;
+        size_t mBlockSz;
+        size_t mEpoch = 0;
+
+        // filled blocks handed from the prefetch thread to the training thread (at most PREFETCH_BLOCKS pending)
+        static constexpr size_t PREFETCH_BLOCKS = 2;
+        std::deque<ExampleData> mReadyBlocks;
+        bool mProducerFinished = true;
+        std::atomic<bool> mStopProducer = false;
+        std::exception_ptr mProducerError;
+        std::mutex mMutex;
+        std::condition_variable mBlockReady;
+        std::condition_variable mBlockTaken;
+        std::thread mProducer;
+
+        ExampleData mCurrentBlock;
+        size_t mCurrentPos = 0;
+        ExampleData mBatch; // used when a batch spans two blocks
+        size_t mItemsThisPass = 0;
+        size_t mItemsLastPass = 0;
+
+        void startPass(bool shuffle);
+        void stopProducer();
+        void produce(std::vector<size_t> shardOrder, bool shuffle, std::default_random_engine generator);
+        void publishBlock(ExampleData& block);
+        bool takeNextBlock();
+
+    public:
+        StreamingBatchSource(std::vector<std::string> shardFiles, Sampler sampler, size_t shuffleBufferSz = 8192, size_t blockSz = 1024);
+        StreamingBatchSource(std::vector<std::string> shardFiles, DataNormaliser normaliser, Sampler sampler, size_t shuffleBufferSz = 8192, size_t blockSz = 1024);
+        StreamingBatchSource(std::vector<std::string> shardFiles, DataNormaliser normaliser, bool shuffle, size_t shuffleBufferSz = 8192, size_t blockSz = 1024);
+        ~StreamingBatchSource() override;
+
+        void startEpoch(size_t epoch) override;
+        void rewind() override;
+        bool nextBatch(size_t batchSz, ExampleBatchIterator& batchStart, ExampleBatchIterator& batchEnd) override;
+        [[nodiscard]] size_t size() const override;
+};
+
+#endif //NNETWORK2_BATCHSOURCE_H
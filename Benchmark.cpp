@@ -0,0 +1,248 @@
+//
+// Created by Lenovo on 22/06/2023.
+//
+
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+#include "Data.h"
+
+BenchmarkOptions BenchmarkOptions::fromArgs(int argc, char** argv)
+{
+    BenchmarkOptions options;
+    for(int argPos = 1; argPos < argc; ++argPos)
+    {
+        const std::string arg = argv[argPos];
+        if(argPos + 1 >= argc)
+        {
+            throw std::invalid_argument("Missing value for " + arg);
+        }
+        const std::string value = argv[++argPos];
+        if(arg == "--warmup") options.warmupRuns = std::stoul(value);
+        else if(arg == "--reps") options.repetitions = std::stoul(value);
+        else if(arg == "--min-sample-ms") options.minSampleMs = std::stod(value);
+        else if(arg == "--filter") options.filter = value;
+        else if(arg == "--json") options.jsonFile = value;
+        else if(arg == "--csv") options.csvFile = value;
+        else throw std::invalid_argument("Unknown argument " + arg);
+    }
+    if(options.repetitions == 0)
+    {
+        throw std::invalid_argument("Repetitions must be greater than 0");
+    }
+    return options;
+}
+
+BenchmarkSuite::BenchmarkSuite(BenchmarkOptions options) : mOptions(std::move(options))
+{
+}
+
+void BenchmarkSuite::run(const std::string& name, size_t itemsPerCall, const std::function<void()>& benchmark)
+{
+    if(!mOptions.filter.empty() && name.find(mOptions.filter) == std::string::npos)
+    {
+        return;
+    }
+    using Clock = std::chrono::steady_clock;
+    auto timeCalls = [&](size_t calls)
+    {
+        const auto start = Clock::now();
+        for(size_t call = 0; call < calls; ++call)
+        {
+            benchmark();
+        }
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    };
+
+    for(size_t run = 0; run < mOptions.warmupRuns; ++run)
+    {
+        benchmark();
+    }
+    // repeat fast kernels within a sample so the clock resolution does not dominate
+    const double singleCallMs = timeCalls(1);
+    const size_t callsPerSample = singleCallMs >= mOptions.minSampleMs ? 1 :
+                                  static_cast<size_t> (std::ceil(mOptions.minSampleMs / std::max(singleCallMs, 1e-6)));
+
+    std::vector<double> samples;
+    for(size_t rep = 0; rep < mOptions.repetitions; ++rep)
+    {
+        samples.push_back(timeCalls(callsPerSample) / static_cast<double> (callsPerSample));
+    }
+    std::sort(samples.begin(), samples.end());
+
+    BenchmarkResult result;
+    result.name = name;
+    result.repetitions = samples.size();
+    result.callsPerSample = callsPerSample;
+    result.itemsPerCall = itemsPerCall;
+    double sum = 0, sumSq = 0;
+    for(const double sample : samples)
+    {
+        sum += sample;
+        sumSq += sample * sample;
+    }
+    const auto numSamples = static_cast<double> (samples.size());
+    result.meanMs = sum / numSamples;
+    result.stdDevMs = std::sqrt(std::max(0.0, sumSq / numSamples - result.meanMs * result.meanMs));
+    result.minMs = samples.front();
+    result.maxMs = samples.back();
+    result.medianMs = samples[samples.size() / 2];
+    result.p90Ms = samples[std::min(samples.size() - 1, static_cast<size_t> (0.9 * numSamples))];
+    result.itemsPerSecond = static_cast<double> (itemsPerCall) / (result.medianMs / 1000);
+    mResults.push_back(result);
+
+    // microseconds so the small kernels are readable
+    std::cout << std::left << std::setw(44) << name << std::right << std::fixed << std::setprecision(3)
+              << " median " << std::setw(12) << result.medianMs * 1000 << " us"
+              << "  mean " << std::setw(12) << result.meanMs * 1000 << " us"
+              << "  sd " << std::setw(10) << result.stdDevMs * 1000
+              << "  " << std::setprecision(0) << result.itemsPerSecond << " items/s" << std::endl;
+}
+
+const std::vector<BenchmarkResult>& BenchmarkSuite::results() const
+{
+    return mResults;
+}
+
+std::string jsonEscape(const std::string& str)
+{
+    std::string escaped;
+    for(const char c : str)
+    {
+        if(c == '"' || c == '\\')
+        {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+void BenchmarkSuite::writeJson(std::ostream& out) const
+{
+    out << std::setprecision(6) << std::defaultfloat;
+    out << "{\n  \"numType\": \"" << (sizeof(NetNumT) == sizeof(float) ? "float" : "double") << "\",\n";
+    out << "  \"eigenThreads\": " << Eigen::nbThreads() << ",\n";
+    out << "  \"benchmarks\": [\n";
+    for(size_t resultPos = 0; resultPos < mResults.size(); ++resultPos)
+    {
+        const BenchmarkResult& result = mResults[resultPos];
+        out << "    {\"name\": \"" << jsonEscape(result.name) << "\", \"repetitions\": " << result.repetitions
+            << ", \"callsPerSample\": " << result.callsPerSample << ", \"itemsPerCall\": " << result.itemsPerCall
+            << ", \"meanMs\": " << result.meanMs << ", \"stdDevMs\": " << result.stdDevMs << ", \"minMs\": " << result.minMs
+            << ", \"medianMs\": " << result.medianMs << ", \"p90Ms\": " << result.p90Ms << ", \"maxMs\": " << result.maxMs
+            << ", \"itemsPerSecond\": " << result.itemsPerSecond << "}" << (resultPos + 1 < mResults.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+void BenchmarkSuite::writeCsv(std::ostream& out) const
+{
+    out << std::setprecision(6) << std::defaultfloat;
+    out << "name,repetitions,callsPerSample,itemsPerCall,meanMs,stdDevMs,minMs,medianMs,p90Ms,maxMs,itemsPerSecond\n";
+    for(const BenchmarkResult& result : mResults)
+    {
+        out << result.name << "," << result.repetitions << "," << result.callsPerSample << "," << result.itemsPerCall << ","
+            << result.meanMs << "," << result.stdDevMs << "," << result.minMs << "," << result.medianMs << ","
+            << result.p90Ms << "," << result.maxMs << "," << result.itemsPerSecond << "\n";
+    }
+}
+
+void BenchmarkSuite::writeResultFiles() const
+{
+    if(!mOptions.jsonFile.empty())
+    {
+        std::ofstream jsonOut(mOptions.jsonFile);
+        if(!jsonOut)
+        {
+            throw std::runtime_error("Could not open " + mOptions.jsonFile);
+        }
+        writeJson(jsonOut);
+    }
+    if(!mOptions.csvFile.empty())
+    {
+        std::ofstream csvOut(mOptions.csvFile);
+        if(!csvOut)
+        {
+            throw std::runtime_error("Could not open " + mOptions.csvFile);
+        }
+        writeCsv(csvOut);
+    }
+}
+
+//***********//
+
+// a class label and integer pixels for each synthetic item
+static void generateSyntheticItems(size_t numItems, unsigned int seed, const std::function<void(size_t label, const std::vector<int>& pixels)>& onItem)
+{
+    const size_t numClasses = getClasses().size();
+    const auto inputSz = static_cast<size_t> (getInputSz());
+    std::default_random_engine generator(seed);
+    std::uniform_int_distribution<int> pixelDistribution(0, 255);
+    std::normal_distribution<double> noiseDistribution(0, 48);
+    std::uniform_int_distribution<size_t> classDistribution(0, numClasses - 1);
+
+    std::vector<std::vector<int>> prototypes(numClasses, std::vector<int>(inputSz));
+    for(auto& prototype : prototypes)
+    {
+        std::generate(prototype.begin(), prototype.end(), [&](){ return pixelDistribution(generator); });
+    }
+    std::vector<int> pixels(inputSz);
+    for(size_t item = 0; item < numItems; ++item)
+    {
+        const size_t label = classDistribution(generator);
+        for(size_t pixel = 0; pixel < inputSz; ++pixel)
+        {
+            pixels[pixel] = std::clamp(static_cast<int> (std::lround(prototypes[label][pixel] + noiseDistribution(generator))), 0, 255);
+        }
+        onItem(label, pixels);
+    }
+}
+
+ExampleData makeSyntheticExampleData(size_t numItems, unsigned int seed)
+{
+    const size_t numClasses = getClasses().size();
+    ExampleData data;
+    data.reserve(numItems);
+    generateSyntheticItems(numItems, seed, [&](size_t label, const std::vector<int>& pixels)
+    {
+        ExampleItem item;
+        item.inputs.resize(1, static_cast<Eigen::Index> (pixels.size()));
+        for(size_t pixel = 0; pixel < pixels.size(); ++pixel)
+        {
+            item.inputs(0, static_cast<Eigen::Index> (pixel)) = static_cast<NetNumT> (pixels[pixel]);
+        }
+        // classes are ordered the same way as the network's outputs
+        item.labels = Labels::Zero(1, static_cast<Eigen::Index> (numClasses));
+        item.labels(0, static_cast<Eigen::Index> (label)) = 1;
+        data.push_back(std::move(item));
+    });
+    return data;
+}
+
+void writeSyntheticCsv(const std::string& fName, size_t numItems, unsigned int seed)
+{
+    std::ofstream fileOut(fName);
+    if(!fileOut)
+    {
+        throw std::runtime_error("Could not open " + fName);
+    }
+    const ClassList classes = getClasses();
+    generateSyntheticItems(numItems, seed, [&](size_t label, const std::vector<int>& pixels)
+    {
+        fileOut << *std::next(classes.begin(), static_cast<std::ptrdiff_t> (label));
+        for(const int pixel : pixels)
+        {
+            fileOut << ',' << pixel;
+        }
+        fileOut << '\n';
+    });
+}
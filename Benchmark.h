@@ -0,0 +1,71 @@
+//
+// Created by Lenovo on 22/06/2023.
+//
+
+#ifndef NNETWORK2_BENCHMARK_H
+#define NNETWORK2_BENCHMARK_H
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Training.h"
+
+struct BenchmarkOptions
+{
+    size_t warmupRuns = 3;
+    size_t repetitions = 20; // timed samples per benchmark
+    double minSampleMs = 1; // fast kernels are repeated inside a sample until it takes at least this long
+    std::string filter; // only run benchmarks whose name contains this
+    std::string jsonFile; // results written here if set
+    std::string csvFile;
+
+    // --warmup N --reps N --min-sample-ms X --filter S --json FILE --csv FILE
+    static BenchmarkOptions fromArgs(int argc, char** argv);
+};
+
+// summary of one benchmark (times are per call)
+struct BenchmarkResult
+{
+    std::string name;
+    size_t repetitions = 0;
+    size_t callsPerSample = 0;
+    size_t itemsPerCall = 0; // e.g. samples in a batch, used for the throughput
+    double meanMs = 0;
+    double stdDevMs = 0;
+    double minMs = 0;
+    double medianMs = 0;
+    double p90Ms = 0;
+    double maxMs = 0;
+    double itemsPerSecond = 0;
+};
+
+class BenchmarkSuite
+{
+    private:
+        BenchmarkOptions mOptions;
+        std::vector<BenchmarkResult> mResults;
+
+    public:
+        explicit BenchmarkSuite(BenchmarkOptions options);
+
+        // warms up, calibrates the calls per sample, then times the repetitions (skipped if filtered out)
+        void run(const std::string& name, size_t itemsPerCall, const std::function<void()>& benchmark);
+
+        [[nodiscard]] const std::vector<BenchmarkResult>& results() const;
+        void writeJson(std::ostream& out) const;
+        void writeCsv(std::ostream& out) const;
+        // writes to the files named in the options
+        void writeResultFiles() const;
+};
+
+// learnable MNIST shaped data: each class is a random prototype image plus noise, pixels 0-255
+ExampleData makeSyntheticExampleData(size_t numItems, unsigned int seed);
+// the same data in the training csv format (label, pixels...)
+void writeSyntheticCsv(const std::string& fName, size_t numItems, unsigned int seed);
+
+// escapes a string for a json document
+std::string jsonEscape(const std::string& str);
+
+#endif //NNETWORK2_BENCHMARK_H
@@ -0,0 +1,283 @@
+//
+// Created by Lenovo on 15/08/2023.
+//
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "Checkpoint.h"
+#include "Checksum.h"
+#include "ThreadConfig.h"
+#include "Trace.h"
+
+namespace
+{
+    // checkpoints are assembled in memory then written with a trailing checksum
+    class CheckpointBuffer
+    {
+        private:
+            std::string mBytes;
+
+        public:
+            template<typename PodT>
+            void write(const PodT& value)
+            {
+                mBytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+            }
+
+            void writeString(const std::string& str)
+            {
+                write<uint64_t>(str.size());
+                mBytes.append(str);
+            }
+
+            template<typename MatrixT>
+            void writeMatrix(const MatrixT& matrix)
+            {
+                write<uint64_t>(static_cast<uint64_t>(matrix.rows()));
+                write<uint64_t>(static_cast<uint64_t>(matrix.cols()));
+                mBytes.append(reinterpret_cast<const char*>(matrix.data()), sizeof(NetNumT) * static_cast<size_t>(matrix.size()));
+            }
+
+            [[nodiscard]] const std::string& bytes() const { return mBytes; }
+    };
+
+    class CheckpointReader
+    {
+        private:
+            const std::string& mBytes;
+            size_t mPos = 0;
+
+            const char* take(size_t size)
+            {
+                if(mPos + size > mBytes.size())
+                {
+                    throw std::logic_error("Checkpoint is truncated");
+                }
+                const char* data = mBytes.data() + mPos;
+                mPos += size;
+                return data;
+            }
+
+        public:
+            explicit CheckpointReader(const std::string& bytes) : mBytes(bytes) {}
+
+            template<typename PodT>
+            PodT read()
+            {
+                PodT value;
+                std::memcpy(&value, take(sizeof(value)), sizeof(value));
+                return value;
+            }
+
+            bool readMatches(const char* expected, size_t size)
+            {
+                return std::memcmp(take(size), expected, size) == 0;
+            }
+
+            std::string readString()
+            {
+                const auto length = read<uint64_t>();
+                return {take(length), length};
+            }
+
+            template<typename MatrixT>
+            void readMatrix(MatrixT& matrix)
+            {
+                const auto rows = static_cast<Eigen::Index>(read<uint64_t>());
+                const auto cols = static_cast<Eigen::Index>(read<uint64_t>());
+                matrix.resize(rows, cols);
+                std::memcpy(matrix.data(), take(sizeof(NetNumT) * static_cast<size_t>(rows * cols)), sizeof(NetNumT) * static_cast<size_t>(rows * cols));
+            }
+    };
+}
+
+TrainingCheckpoint snapshotTraining(NNetwork& network, const NetworkWeightGradients& prevWeightDelta, const NetworkLayerGradients& prevBiasDelta, size_t epoch, size_t batchInEpoch, const DataNormaliser* normaliser)
+{
+    TrainingCheckpoint checkpoint;
+    checkpoint.epoch = epoch;
+    checkpoint.batchInEpoch = batchInEpoch;
+    for(size_t layerPos = 0; layerPos < network.numLayers(); ++layerPos)
+    {
+        checkpoint.weights.push_back(network.layer(layerPos).getWeights());
+        checkpoint.biases.push_back(network.layer(layerPos).getBiases());
+        checkpoint.weightMomentum.push_back(prevWeightDelta.getWeightGradientsForLayer(layerPos));
+        checkpoint.biasMomentum.push_back(prevBiasDelta.getLayerGradients(layerPos));
+    }
+    checkpoint.dropOutGeneratorState = network.dropOutGeneratorState();
+    if(normaliser != nullptr)
+    {
+        checkpoint.normaliser = *normaliser;
+    }
+    return checkpoint;
+}
+
+void restoreTraining(const TrainingCheckpoint& checkpoint, NNetwork& network, NetworkWeightGradients& prevWeightDelta, NetworkLayerGradients& prevBiasDelta)
+{
+    if(checkpoint.weights.size() != network.numLayers())
+    {
+        throw std::logic_error("Checkpoint has a different number of layers to the network");
+    }
+    for(size_t layerPos = 0; layerPos < network.numLayers(); ++layerPos)
+    {
+        // setters throw if the layer dimensions differ
+        network.layer(layerPos).setWeights(checkpoint.weights[layerPos]);
+        network.layer(layerPos).setBiases(checkpoint.biases[layerPos]);
+        prevWeightDelta.setWeightGradientsForLayer(checkpoint.weightMomentum[layerPos], layerPos);
+        prevBiasDelta.setLayerGradients(checkpoint.biasMomentum[layerPos], layerPos);
+    }
+    network.setDropOutGeneratorState(checkpoint.dropOutGeneratorState);
+}
+
+void writeCheckpoint(const std::string& fName, const TrainingCheckpoint& checkpoint)
+{
+    CheckpointBuffer buffer;
+    buffer.write(CHECKPOINT_MAGIC);
+    buffer.write<uint32_t>(CHECKPOINT_VERSION);
+    buffer.write<uint32_t>(sizeof(NetNumT));
+    buffer.write<uint64_t>(checkpoint.epoch);
+    buffer.write<uint64_t>(checkpoint.batchInEpoch);
+    buffer.write<uint64_t>(checkpoint.weights.size());
+    for(size_t layerPos = 0; layerPos < checkpoint.weights.size(); ++layerPos)
+    {
+        buffer.writeMatrix(checkpoint.weights[layerPos]);
+        buffer.writeMatrix(checkpoint.biases[layerPos]);
+        buffer.writeMatrix(checkpoint.weightMomentum[layerPos]);
+        buffer.writeMatrix(checkpoint.biasMomentum[layerPos]);
+    }
+    buffer.writeString(checkpoint.dropOutGeneratorState);
+    buffer.write<uint8_t>(checkpoint.normaliser.has_value());
+    if(checkpoint.normaliser)
+    {
+        buffer.write<uint32_t>(static_cast<uint32_t>(checkpoint.normaliser->method));
+        buffer.writeMatrix(checkpoint.normaliser->shift);
+        buffer.writeMatrix(checkpoint.normaliser->scale);
+    }
+    const uint64_t checksum = fnv1aHash(buffer.bytes().data(), buffer.bytes().size());
+
+    // write to a temporary file then rename so an interrupted write never replaces the last good checkpoint
+    const std::string tempName = fName + ".tmp";
+    {
+        std::ofstream fileOut(tempName, std::ios::binary | std::ios::trunc);
+        fileOut.write(buffer.bytes().data(), static_cast<std::streamsize>(buffer.bytes().size()));
+        fileOut.write(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+        if(!fileOut)
+        {
+            throw std::runtime_error("Failed writing checkpoint");
+        }
+    }
+    std::filesystem::rename(tempName, fName);
+}
+
+TrainingCheckpoint loadCheckpoint(const std::string& fName)
+{
+    std::ifstream fileIn(fName, std::ios::binary);
+    if(!fileIn.is_open())
+    {
+        throw std::logic_error("Could not open file");
+    }
+    std::string bytes((std::istreambuf_iterator<char>(fileIn)), std::istreambuf_iterator<char>());
+    uint64_t checksum = 0;
+    if(bytes.size() < sizeof(checksum))
+    {
+        throw std::logic_error("Checkpoint is truncated");
+    }
+    std::memcpy(&checksum, bytes.data() + bytes.size() - sizeof(checksum), sizeof(checksum));
+    bytes.resize(bytes.size() - sizeof(checksum));
+    if(fnv1aHash(bytes.data(), bytes.size()) != checksum)
+    {
+        throw std::logic_error("Checkpoint checksum does not match");
+    }
+
+    CheckpointReader reader(bytes);
+    if(!reader.readMatches(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) || reader.read<uint32_t>() != CHECKPOINT_VERSION)
+    {
+        throw std::logic_error("Not a supported checkpoint file");
+    }
+    if(reader.read<uint32_t>() != sizeof(NetNumT))
+    {
+        throw std::logic_error("Checkpoint written with a different NUM_TYPE");
+    }
+    TrainingCheckpoint checkpoint;
+    checkpoint.epoch = reader.read<uint64_t>();
+    checkpoint.batchInEpoch = reader.read<uint64_t>();
+    const auto numLayers = reader.read<uint64_t>();
+    checkpoint.weights.resize(numLayers);
+    checkpoint.biases.resize(numLayers);
+    checkpoint.weightMomentum.resize(numLayers);
+    checkpoint.biasMomentum.resize(numLayers);
+    for(size_t layerPos = 0; layerPos < numLayers; ++layerPos)
+    {
+        reader.readMatrix(checkpoint.weights[layerPos]);
+        reader.readMatrix(checkpoint.biases[layerPos]);
+        reader.readMatrix(checkpoint.weightMomentum[layerPos]);
+        reader.readMatrix(checkpoint.biasMomentum[layerPos]);
+    }
+    checkpoint.dropOutGeneratorState = reader.readString();
+    if(reader.read<uint8_t>() != 0)
+    {
+        DataNormaliser normaliser;
+        normaliser.method = static_cast<DataNormalisationMethod>(reader.read<uint32_t>());
+        reader.readMatrix(normaliser.shift);
+        reader.readMatrix(normaliser.scale);
+        checkpoint.normaliser = normaliser;
+    }
+    return checkpoint;
+}
+
+//***********//
+
+CheckpointWriter::CheckpointWriter(std::string fileName) : mFileName(std::move(fileName))
+{
+    mWriter = std::thread(&CheckpointWriter::writeLoop, this);
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mPendingReady.notify_one();
+    mWriter.join();
+}
+
+void CheckpointWriter::submit(TrainingCheckpoint checkpoint)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mPending = std::move(checkpoint);
+    }
+    mPendingReady.notify_one();
+}
+
+void CheckpointWriter::writeLoop()
+{
+    setTraceThreadName("checkpoint writer");
+    unpinCurrentThread();
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(true)
+    {
+        mPendingReady.wait(lock, [this]{ return mStop || mPending.has_value(); });
+        if(!mPending)
+        {
+            return; // stopping with nothing left to write
+        }
+        TrainingCheckpoint checkpoint = std::move(*mPending);
+        mPending.reset();
+        lock.unlock();
+        try
+        {
+            TraceScope writeTrace("write_checkpoint", "epoch", static_cast<int64_t> (checkpoint.epoch));
+            writeCheckpoint(mFileName, checkpoint);
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << "Could not write checkpoint " << mFileName << ": " << e.what() << std::endl;
+        }
+        lock.lock();
+    }
+}
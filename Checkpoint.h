@@ -0,0 +1,62 @@
+//
+// Created by Lenovo on 15/08/2023.
+//
+
+#ifndef NNETWORK2_CHECKPOINT_H
+#define NNETWORK2_CHECKPOINT_H
+
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include "Training.h"
+#include "Data.h"
+
+// everything needed to continue training from a point part way through an epoch
+struct TrainingCheckpoint
+{
+    size_t epoch = 0;
+    size_t batchInEpoch = 0; // batches of the epoch already applied to the weights
+    std::vector<LayerWeightsT> weights;
+    std::vector<SingleRowT> biases;
+    std::vector<LayerWeightsT> weightMomentum; // previous weight deltas
+    std::vector<SingleRowT> biasMomentum;
+    std::string dropOutGeneratorState;
+    std::optional<DataNormaliser> normaliser;
+};
+
+TrainingCheckpoint snapshotTraining(NNetwork& network, const NetworkWeightGradients& prevWeightDelta, const NetworkLayerGradients& prevBiasDelta, size_t epoch, size_t batchInEpoch, const DataNormaliser* normaliser);
+void restoreTraining(const TrainingCheckpoint& checkpoint, NNetwork& network, NetworkWeightGradients& prevWeightDelta, NetworkLayerGradients& prevBiasDelta);
+
+void writeCheckpoint(const std::string& fName, const TrainingCheckpoint& checkpoint);
+TrainingCheckpoint loadCheckpoint(const std::string& fName);
+
+// writes checkpoints on a background thread so training never waits on the disk.
+// if a checkpoint is submitted while another is being written only the newest pending one is kept
+class CheckpointWriter
+{
+    private:
+        std::string mFileName;
+        std::optional<TrainingCheckpoint> mPending;
+        bool mStop = false;
+        std::mutex mMutex;
+        std::condition_variable mPendingReady;
+        std::thread mWriter;
+
+        void writeLoop();
+
+    public:
+        explicit CheckpointWriter(std::string fileName);
+        ~CheckpointWriter(); // writes any pending checkpoint before returning
+
+        CheckpointWriter(const CheckpointWriter&) = delete;
+        CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+        void submit(TrainingCheckpoint checkpoint);
+};
+
+#define CHECKPOINT_MAGIC "NNCKPT1"
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+#endif //NNETWORK2_CHECKPOINT_H
@@ -0,0 +1,24 @@
+//
+// Created by Lenovo on 12/08/2023.
+//
+
+#ifndef NNETWORK2_CHECKSUM_H
+#define NNETWORK2_CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+constexpr uint64_t FNV1A_OFFSET_BASIS = 14695981039346656037ULL;
+
+// 64 bit FNV-1a hash - pass the previous result as hash to continue hashing over several buffers
+inline uint64_t fnv1aHash(const char* data, size_t size, uint64_t hash = FNV1A_OFFSET_BASIS)
+{
+    for(size_t pos = 0; pos < size; ++pos)
+    {
+        hash ^= static_cast<unsigned char>(data[pos]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+#endif //NNETWORK2_CHECKSUM_H
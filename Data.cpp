@@ -4,9 +4,15 @@
 #include <fstream>
 #include <iostream>
 #include <set>
+#include <charconv>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <string_view>
 
 #include "Data.h"
 #include "DataSpecs.h"
+#include "Trace.h"
 
 bool isTrainingDataValid(const std::map<ClassT, size_t>& networkLabels, const ExampleData& trainingData, size_t networkInputSz)
 {
@@ -56,8 +62,15 @@ bool areInputElementsDifferent(const Eigen::Matrix<NUM_TYPE, Eigen::Dynamic, Eig
     return false;
 }
 
-void normaliseTrainingData(ExampleData& trData, DataNormalisationMethod method)
+DataNormaliser fitNormaliser(const ExampleData& trData, DataNormalisationMethod method)
 {
+    DataNormaliser normaliser;
+    normaliser.method = method;
+    if(method == DataNormalisationMethod::LOG)
+    {
+        // log scaling has no fitted parameters
+        return normaliser;
+    }
     // convert inputs in trData to matrix - every col is a list of an input element over every training item
     Eigen::Matrix<NUM_TYPE, Eigen::Dynamic, Eigen::Dynamic> inputsAsMatrix;
     inputsAsMatrix.resize(static_cast<Eigen::Index>(trData.size()), static_cast<Eigen::Index>(trData[0].inputs.size()));
@@ -65,13 +78,14 @@ void normaliseTrainingData(ExampleData& trData, DataNormalisationMethod method)
     {
         inputsAsMatrix.row(static_cast<Eigen::Index>(pos)) = trData[pos].inputs;
     }
-    // normalise
-    if(method == DataNormalisationMethod::Z_SCORE)
+    // features that cannot be normalised are left unchanged (shift 0, scale 1)
+    normaliser.shift = SingleRowT::Zero(inputsAsMatrix.cols());
+    normaliser.scale = SingleRowT::Ones(inputsAsMatrix.cols());
+    for(Eigen::Index inputElement = 0; inputElement < inputsAsMatrix.cols(); ++inputElement)
     {
-        // iterate over each set of inputElements in trData
-        for(size_t inputElement = 0; inputElement < static_cast<decltype(inputElement)>( trData[0].inputs.size()); ++inputElement)
+        const auto inputElementAcrossItems = inputsAsMatrix.col(inputElement);
+        if(method == DataNormalisationMethod::Z_SCORE)
         {
-            Eigen::Matrix<NUM_TYPE, 1, Eigen::Dynamic> inputElementAcrossItems = inputsAsMatrix.col(static_cast<Eigen::Index>(inputElement));
             // no valid z score if all elements same so do not amend
             if(!areInputElementsDifferent(inputElementAcrossItems))
             {
@@ -80,16 +94,11 @@ void normaliseTrainingData(ExampleData& trData, DataNormalisationMethod method)
             NetNumT mean = inputElementAcrossItems.array().mean();
             NetNumT sd = static_cast<NetNumT> (sqrt ( (inputElementAcrossItems.array() - mean).pow(2).sum() /
                                 NetNumT (inputElementAcrossItems.size())) );
-
-            inputElementAcrossItems = (inputElementAcrossItems.array() - mean) / sd;
-            inputsAsMatrix.col(static_cast<Eigen::Index>(inputElement)) = inputElementAcrossItems;
+            normaliser.shift(0, inputElement) = mean;
+            normaliser.scale(0, inputElement) = sd;
         }
-    }
-    if(method == DataNormalisationMethod::MINMAX)
-    {
-        for(size_t inputElement = 0; inputElement < static_cast<decltype(inputElement)> (trData[0].inputs.size()); ++inputElement)
+        if(method == DataNormalisationMethod::MINMAX)
         {
-            auto inputElementAcrossItems = inputsAsMatrix.col(static_cast<Eigen::Index>(inputElement));
             const NetNumT maxInputValue = inputElementAcrossItems.array().maxCoeff();
             const NetNumT minInputValue = inputElementAcrossItems.array().minCoeff();
 
@@ -98,36 +107,67 @@ void normaliseTrainingData(ExampleData& trData, DataNormalisationMethod method)
             {
                 continue;
             }
-
-            inputElementAcrossItems = (inputElementAcrossItems.array() - minInputValue) / (maxInputValue - minInputValue);
-            inputsAsMatrix.col(static_cast<Eigen::Index>(inputElement)) = inputElementAcrossItems;
+            normaliser.shift(0, inputElement) = minInputValue;
+            normaliser.scale(0, inputElement) = maxInputValue - minInputValue;
         }
     }
-    if(method == DataNormalisationMethod::LOG)
+    return normaliser;
+}
+
+void applyNormaliser(ExampleData& trData, const DataNormaliser& normaliser)
+{
+    for(ExampleItem& item : trData)
     {
-        for(Eigen::Index r = 0; r < inputsAsMatrix.rows(); ++r)
+        if(normaliser.method == DataNormalisationMethod::LOG)
         {
-            for(Eigen::Index c = 0; c < inputsAsMatrix.cols(); ++c)
+            if((item.inputs.array() < 0).any())
             {
-                if(inputsAsMatrix.coeff(r, c) < 0)
-                {
-                    throw std::out_of_range("Cannot log scale if values less than 0");
-                }
+                throw std::out_of_range("Cannot log scale if values less than 0");
             }
+            // ADD 1 TO AVOID LOG 0 (UNDEFINED)
+            item.inputs = (item.inputs.array() + 1).log();
+        }
+        else
+        {
+            if(item.inputs.size() != normaliser.shift.size())
+            {
+                throw std::logic_error("Normaliser size does not match inputs");
+            }
+            item.inputs = (item.inputs.array() - normaliser.shift.array()) / normaliser.scale.array();
+        }
+        //check no invalid errors
+        if(!item.inputs.allFinite())
+        {
+            throw std::logic_error("(4) INF or NaN in inputs");
         }
-        // ADD 1 TO AVOID LOG 0 (UNDEFINED)
-        inputsAsMatrix = (inputsAsMatrix.array() + 1).log();
     }
-    //check no invalid errors
-    if(!inputsAsMatrix.allFinite())
+}
+
+DataNormaliser normaliseTrainingData(ExampleData& trData, DataNormalisationMethod method)
+{
+    DataNormaliser normaliser = fitNormaliser(trData, method);
+    applyNormaliser(trData, normaliser);
+    return normaliser;
+}
+
+void foldNormaliserIntoNetwork(NNetwork& network, const DataNormaliser& normaliser)
+{
+    // ((x - shift) / scale) * W + b == x * (W / scale) + (b - (shift / scale) * W)
+    if(normaliser.method == DataNormalisationMethod::LOG)
     {
-        throw std::logic_error("(4) INF or NaN in inputs");
+        throw std::logic_error("LOG normalisation is not affine so cannot be folded into the network");
     }
-    // put data back in trData
-    for(Eigen::Index trItemPos = 0; static_cast<decltype(trData.size())>(trItemPos) < trData.size(); ++trItemPos)
+    NLayer& firstLayer = network.layer(0);
+    const LayerWeightsMapT& weights = firstLayer.getWeights();
+    if(weights.rows() != normaliser.scale.size())
     {
-        trData[trItemPos].inputs = inputsAsMatrix.row(trItemPos);
+        throw std::logic_error("Normaliser size does not match network inputs");
     }
+    const SingleRowT invScale = normaliser.scale.array().inverse();
+    const SingleRowT foldedBiases = firstLayer.getBiases() - (normaliser.shift.array() * invScale.array()).matrix() * weights;
+    const LayerWeightsT foldedWeights = invScale.transpose().asDiagonal() * weights;
+    firstLayer.setWeights(foldedWeights);
+    firstLayer.setBiases(foldedBiases);
 }
 
 std::set<std::string> getClasses()
@@ -142,6 +182,7 @@ Eigen::Index getInputSz()
 
 ExampleData loadTrainingDataFromFile(const std::string &fName)
 {
+    TraceScope loadTrace("load_csv");
     ExampleData trData;
     std::ifstream dataFile;
     dataFile.open(fName, std::ifstream::in);
@@ -154,6 +195,10 @@ ExampleData loadTrainingDataFromFile(const std::string &fName)
     std::string lineOfFile, delimiter = ",";
     while (std::getline(dataFile, lineOfFile))
     {
+        if(!lineOfFile.empty() && lineOfFile.back() == '\r')
+        {
+            lineOfFile.pop_back(); // CRLF line ending
+        }
         lineOfFile += delimiter; // add delimiter to end of line so as to easily parse
         ExampleItem trItem;
         trItem.inputs.resize(1, getInputSz());
@@ -192,6 +237,240 @@ ExampleData loadTrainingDataFromFile(const std::string &fName)
     return trData;
 }
 
+template<typename RawT>
+RawExampleData<RawT> loadRawTrainingDataFromFile(const std::string &fName)
+{
+    std::ifstream dataFile;
+    dataFile.open(fName, std::ifstream::in);
+    if (! dataFile.is_open())
+    {
+        throw std::logic_error("Could not open file");
+    }
+
+    const ClassList classes = getClasses();
+    RawExampleData<RawT> rawData;
+    rawData.numClasses = static_cast<Eigen::Index>(classes.size());
+    std::vector<RawT> inputValues; // row-major inputs, copied into the matrix once the number of rows is known
+
+    std::string lineOfFile;
+    while (std::getline(dataFile, lineOfFile))
+    {
+        if(!lineOfFile.empty() && lineOfFile.back() == '\r')
+        {
+            lineOfFile.pop_back(); // CRLF line ending
+        }
+        const char* cursor = lineOfFile.data();
+        const char* const lineEnd = lineOfFile.data() + lineOfFile.size();
+
+        // load expected outcome
+        const char* labelEnd = std::find(cursor, lineEnd, DELIMITER);
+        const auto classIt = classes.find(std::string(cursor, labelEnd));
+        if(classIt == classes.end())
+        {
+            throw std::logic_error("Unknown class in data file");
+        }
+        rawData.labels.push_back(std::distance(classes.begin(), classIt));
+        cursor = labelEnd;
+
+        // add inputs
+        Eigen::Index inputCount = 0;
+        while(cursor < lineEnd)
+        {
+            ++cursor; // skip delimiter
+            unsigned long inputAsNum = 0;
+            const auto [parseEnd, errCode] = std::from_chars(cursor, lineEnd, inputAsNum);
+            if(errCode != std::errc() || inputAsNum > std::numeric_limits<RawT>::max())
+            {
+                throw std::out_of_range("Input is not an integer that fits the raw storage type");
+            }
+            inputValues.push_back(static_cast<RawT>(inputAsNum));
+            cursor = parseEnd;
+            inputCount++;
+        }
+        if(inputCount != getInputSz())
+        {
+            throw std::logic_error("Number of inputs does not match input size");
+        }
+    }
+    dataFile.close();
+    rawData.inputs = Eigen::Map<const decltype(rawData.inputs)>(inputValues.data(), static_cast<Eigen::Index>(rawData.labels.size()), getInputSz());
+    return rawData;
+}
+
+template<typename RawT>
+DataNormaliser fitNormaliser(const RawExampleData<RawT>& rawData, DataNormalisationMethod method)
+{
+    DataNormaliser normaliser;
+    normaliser.method = method;
+    if(method == DataNormalisationMethod::LOG)
+    {
+        return normaliser;
+    }
+    // single pass over the rows (contiguous in memory) accumulating the statistics of every column
+    const Eigen::Index numInputs = rawData.inputs.cols();
+    Eigen::Array<double, 1, Eigen::Dynamic> sum = Eigen::Array<double, 1, Eigen::Dynamic>::Zero(numInputs);
+    Eigen::Array<double, 1, Eigen::Dynamic> sumSquares = sum;
+    Eigen::Array<double, 1, Eigen::Dynamic> minValues = Eigen::Array<double, 1, Eigen::Dynamic>::Constant(numInputs, std::numeric_limits<double>::max());
+    Eigen::Array<double, 1, Eigen::Dynamic> maxValues = Eigen::Array<double, 1, Eigen::Dynamic>::Constant(numInputs, std::numeric_limits<double>::lowest());
+    for(Eigen::Index row = 0; row < rawData.inputs.rows(); ++row)
+    {
+        const auto rowValues = rawData.inputs.row(row).template cast<double>().array();
+        sum += rowValues;
+        sumSquares += rowValues.square();
+        minValues = minValues.min(rowValues);
+        maxValues = maxValues.max(rowValues);
+    }
+    const auto numItems = static_cast<double>(rawData.inputs.rows());
+
+    // features that cannot be normalised are left unchanged (shift 0, scale 1)
+    normaliser.shift = SingleRowT::Zero(numInputs);
+    normaliser.scale = SingleRowT::Ones(numInputs);
+    for(Eigen::Index inputElement = 0; inputElement < numInputs; ++inputElement)
+    {
+        if(minValues(inputElement) == maxValues(inputElement))
+        {
+            continue;
+        }
+        if(method == DataNormalisationMethod::Z_SCORE)
+        {
+            const double mean = sum(inputElement) / numItems;
+            normaliser.shift(0, inputElement) = static_cast<NetNumT>(mean);
+            normaliser.scale(0, inputElement) = static_cast<NetNumT>(sqrt(sumSquares(inputElement) / numItems - mean * mean));
+        }
+        if(method == DataNormalisationMethod::MINMAX)
+        {
+            normaliser.shift(0, inputElement) = static_cast<NetNumT>(minValues(inputElement));
+            normaliser.scale(0, inputElement) = static_cast<NetNumT>(maxValues(inputElement) - minValues(inputElement));
+        }
+    }
+    return normaliser;
+}
+
+template<typename RawT>
+void gatherBatch(const RawExampleData<RawT>& rawData, const DataNormaliser& normaliser, const std::vector<size_t>& order, size_t first, size_t last, ExampleData& batch)
+{
+    // an empty shift means inputs are only converted
+    const bool shiftAndScale = normaliser.method != DataNormalisationMethod::LOG && normaliser.shift.size() > 0;
+    if(shiftAndScale && normaliser.shift.size() != rawData.inputs.cols())
+    {
+        throw std::logic_error("Normaliser size does not match inputs");
+    }
+    batch.resize(last - first);
+    for(size_t batchPos = 0; batchPos < batch.size(); ++batchPos)
+    {
+        const auto itemPos = static_cast<Eigen::Index>(order[first + batchPos]);
+        const auto rawInputs = rawData.inputs.row(itemPos).template cast<NetNumT>();
+        ExampleItem& item = batch[batchPos];
+        if(normaliser.method == DataNormalisationMethod::LOG)
+        {
+            item.inputs = (rawInputs.array() + 1).log();
+        }
+        else if(shiftAndScale)
+        {
+            item.inputs = (rawInputs.array() - normaliser.shift.array()) / normaliser.scale.array();
+        }
+        else
+        {
+            item.inputs = rawInputs;
+        }
+        item.labels.setZero(rawData.numClasses);
+        item.labels(0, rawData.labels[static_cast<size_t>(itemPos)]) = 1;
+    }
+}
+
+template RawExampleData<uint8_t> loadRawTrainingDataFromFile(const std::string &fName);
+template RawExampleData<uint16_t> loadRawTrainingDataFromFile(const std::string &fName);
+template DataNormaliser fitNormaliser(const RawExampleData<uint8_t>& rawData, DataNormalisationMethod method);
+template DataNormaliser fitNormaliser(const RawExampleData<uint16_t>& rawData, DataNormalisationMethod method);
+template void gatherBatch(const RawExampleData<uint8_t>& rawData, const DataNormaliser& normaliser, const std::vector<size_t>& order, size_t first, size_t last, ExampleData& batch);
+template void gatherBatch(const RawExampleData<uint16_t>& rawData, const DataNormaliser& normaliser, const std::vector<size_t>& order, size_t first, size_t last, ExampleData& batch);
+
+namespace
+{
+    struct BinaryShardHeader
+    {
+        char magic[8];
+        uint64_t numItems;
+        uint64_t inputSz;
+        uint64_t labelSz;
+        uint64_t numTypeSz;
+    };
+}
+
+void writeBinaryShard(const std::string& fName, const ExampleData& data)
+{
+    std::ofstream fileOut(fName, std::ios::binary | std::ios::trunc);
+    if(!fileOut.is_open())
+    {
+        throw std::logic_error("Could not open file");
+    }
+    BinaryShardHeader header{};
+    std::copy_n(BINARY_SHARD_MAGIC, sizeof(header.magic), header.magic);
+    header.numItems = data.size();
+    header.inputSz = data.empty() ? 0 : static_cast<uint64_t>(data[0].inputs.size());
+    header.labelSz = data.empty() ? 0 : static_cast<uint64_t>(data[0].labels.size());
+    header.numTypeSz = sizeof(NetNumT);
+    fileOut.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for(const ExampleItem& item : data)
+    {
+        if(static_cast<uint64_t>(item.inputs.size()) != header.inputSz || static_cast<uint64_t>(item.labels.size()) != header.labelSz)
+        {
+            throw std::logic_error("Items in shard have different sizes");
+        }
+        fileOut.write(reinterpret_cast<const char*>(item.inputs.data()), static_cast<std::streamsize>(sizeof(NetNumT) * header.inputSz));
+        fileOut.write(reinterpret_cast<const char*>(item.labels.data()), static_cast<std::streamsize>(sizeof(NetNumT) * header.labelSz));
+    }
+    if(!fileOut)
+    {
+        throw std::runtime_error("Failed writing shard");
+    }
+}
+
+bool isBinaryShard(const std::string& fName)
+{
+    std::ifstream fileIn(fName, std::ios::binary);
+    char magic[sizeof(BinaryShardHeader::magic)] = {};
+    fileIn.read(magic, sizeof(magic));
+    return fileIn && std::equal(magic, magic + sizeof(magic), BINARY_SHARD_MAGIC);
+}
+
+ExampleData loadBinaryShard(const std::string& fName)
+{
+    std::ifstream fileIn(fName, std::ios::binary);
+    if(!fileIn.is_open())
+    {
+        throw std::logic_error("Could not open file");
+    }
+    BinaryShardHeader header{};
+    fileIn.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if(!fileIn || !std::equal(header.magic, header.magic + sizeof(header.magic), BINARY_SHARD_MAGIC))
+    {
+        throw std::logic_error("Not a binary shard");
+    }
+    if(header.numTypeSz != sizeof(NetNumT))
+    {
+        throw std::logic_error("Binary shard written with a different NUM_TYPE");
+    }
+    ExampleData data(header.numItems);
+    for(ExampleItem& item : data)
+    {
+        item.inputs.resize(1, static_cast<Eigen::Index>(header.inputSz));
+        item.labels.resize(1, static_cast<Eigen::Index>(header.labelSz));
+        fileIn.read(reinterpret_cast<char*>(item.inputs.data()), static_cast<std::streamsize>(sizeof(NetNumT) * header.inputSz));
+        fileIn.read(reinterpret_cast<char*>(item.labels.data()), static_cast<std::streamsize>(sizeof(NetNumT) * header.labelSz));
+    }
+    if(!fileIn)
+    {
+        throw std::runtime_error("Binary shard is truncated");
+    }
+    return data;
+}
+
+ExampleData loadShard(const std::string& fName)
+{
+    return isBinaryShard(fName) ? loadBinaryShard(fName) : loadTrainingDataFromFile(fName);
+}
+
 bool serialise(std::ofstream& fileOut, NNetwork& network, const ActFuncList& actFuncList)
 {
     fileOut << PREFIX_ACTFUNCS;
@@ -226,144 +505,236 @@ bool serialise(std::ofstream& fileOut, NNetwork& network, const ActFuncList& act
     return true;
 }
 
-Eigen::Matrix<NetNumT, Eigen::Dynamic, Eigen::Dynamic> generateVectorRow(const std::string& str)
+namespace
 {
-    const Eigen::Index vecSize = std::count(str.begin(), str.end(), DELIMITER) + 1;
-    Eigen::Matrix<NetNumT, 1, Eigen::Dynamic> vecToReturn;
-    vecToReturn.resize(vecSize);
+    // a line of a text file without its line ending
+    struct TextLine
+    {
+        const char* begin;
+        const char* end;
+
+        [[nodiscard]] std::string_view view() const { return {begin, static_cast<size_t>(end - begin)}; }
+    };
 
-    std::stringstream sstream(str);
-    std::string buf;
-    Eigen::Index i =0;
-    while (std::getline(sstream, buf, DELIMITER))
+    // walks the lines of a buffer without copying them
+    class TextCursor
     {
-        const auto coeff = static_cast<NetNumT>(std::stod(buf));
-        vecToReturn(0, i) = coeff;
-        i++;
-    }
-    return vecToReturn;
-}
+        private:
+            const char* mPos;
+            const char* mEnd;
 
-Eigen::Matrix<NetNumT, Eigen::Dynamic, Eigen::Dynamic> generateMatrix(std::ifstream& fileIn, Eigen::Index weightsR, Eigen::Index weightsC)
-{
-    std::string weightAsStr, buf;
-    size_t line = 0;
-    while( line < weightsR)
+        public:
+            TextCursor(const char* begin, const char* end) : mPos(begin), mEnd(end) {}
+
+            bool nextLine(TextLine& line)
+            {
+                if(mPos >= mEnd)
+                {
+                    return false;
+                }
+                const auto* newLine = static_cast<const char*>(std::memchr(mPos, '\n', static_cast<size_t>(mEnd - mPos)));
+                const char* lineEnd = newLine == nullptr ? mEnd : newLine;
+                line.begin = mPos;
+                line.end = (lineEnd > mPos && *(lineEnd - 1) == '\r') ? lineEnd - 1 : lineEnd;
+                mPos = newLine == nullptr ? mEnd : newLine + 1;
+                return true;
+            }
+
+            TextLine expectLine(const char* prefix)
+            {
+                TextLine line{};
+                if(!nextLine(line) || line.view().find(prefix) == std::string_view::npos)
+                {
+                    throw std::logic_error(std::string("Expected ") + prefix + " in model file");
+                }
+                // return what follows the prefix
+                line.begin += line.view().find(prefix) + std::string_view(prefix).size();
+                return line;
+            }
+    };
+
+    // parses count delimited numbers starting at begin into out[0], out[stride], ... returns false on a malformed row
+    bool parseDelimitedRow(const char* begin, const char* end, NetNumT* out, Eigen::Index count, Eigen::Index stride)
     {
-        std::getline(fileIn, buf);
-        weightAsStr += buf;
-        weightAsStr += DELIMITER;
-        line++;
+        const char* cursor = begin;
+        for(Eigen::Index pos = 0; pos < count; ++pos)
+        {
+            if(pos > 0)
+            {
+                if(cursor == end || *cursor != DELIMITER)
+                {
+                    return false;
+                }
+                ++cursor;
+            }
+            const auto [parseEnd, errCode] = std::from_chars(cursor, end, out[pos * stride]);
+            if(errCode != std::errc())
+            {
+                return false;
+            }
+            cursor = parseEnd;
+        }
+        // nothing may follow the last value but a single trailing delimiter and whitespace
+        auto skipWhitespace = [&]()
+        {
+            while(cursor != end && (*cursor == ' ' || *cursor == '\t'))
+            {
+                ++cursor;
+            }
+        };
+        skipWhitespace();
+        if(cursor != end && *cursor == DELIMITER)
+        {
+            ++cursor;
+            skipWhitespace();
+        }
+        return cursor == end;
     }
-    Eigen::Matrix<NetNumT, Eigen::Dynamic, Eigen::Dynamic> weightsToReturn;
-    weightsToReturn.resize(weightsR, weightsC);
 
-    std::stringstream sstream(weightAsStr);
-    Eigen::Index pos = 0;
-    while(std::getline(sstream, buf, DELIMITER))
+    template<typename IntT>
+    IntT parseInteger(std::string_view text)
     {
-        const auto coeff = static_cast<NetNumT>(std::stod(buf));
-
-        weightsToReturn(pos/weightsC, pos % weightsC) = coeff;
-        ++pos;
+        IntT value = 0;
+        const auto [parseEnd, errCode] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if(errCode != std::errc())
+        {
+            throw std::logic_error("Could not parse integer in model file");
+        }
+        return value;
     }
-    return weightsToReturn;
 
+    // calls onToken for each delimited token (a trailing delimiter does not produce an empty token)
+    template<typename FuncT>
+    void forEachToken(std::string_view text, FuncT onToken)
+    {
+        while(!text.empty())
+        {
+            const size_t delimiterPos = text.find(DELIMITER);
+            onToken(text.substr(0, delimiterPos));
+            text = delimiterPos == std::string_view::npos ? std::string_view() : text.substr(delimiterPos + 1);
+        }
+    }
 }
 
-NNetwork deserialise(std::ifstream& fileIn, ActFuncList& actFuncList)
+void generateVectorRow(const TextLine& line, SingleRowT& vecOut)
 {
-    ClassList cList;
-    size_t inputSz;
-    //
-    std::string buf;
-    size_t pos;
-    std::stringstream sstream;
-
-    //get actfuncs
-    std::getline(fileIn, buf);
-    pos = buf.find(PREFIX_ACTFUNCS) + std::string(PREFIX_ACTFUNCS).size();
-    if(pos == std::string::npos)
+    const std::string_view text = line.view();
+    Eigen::Index vecSize = std::count(text.begin(), text.end(), DELIMITER) + 1;
+    if(!text.empty() && text.back() == DELIMITER)
     {
-        throw std::logic_error("No actfuncs specified");
+        vecSize--;
     }
-    buf = buf.substr(pos, std::string::npos);
-    sstream << buf;
-    std::string actFuncStrBuf;
-    while(std::getline(sstream, actFuncStrBuf, DELIMITER))
+    vecOut.resize(vecSize);
+    if(!parseDelimitedRow(line.begin, line.end, vecOut.data(), vecSize, 1))
     {
-        int actFuncAsNum = std::stoi(actFuncStrBuf);
-        actFuncList.push_back(ActFunc(actFuncAsNum));
+        throw std::logic_error("Malformed row in model file");
     }
+}
 
-    // classes
-    std::getline(fileIn, buf);
-    pos = buf.find(PREFIX_CLASSES) + std::string(PREFIX_CLASSES).size();
-    if(pos == std::string::npos)
+void generateMatrix(const std::vector<TextLine>& rows, LayerWeightsT& weightsOut)
+{
+    const auto numRows = static_cast<Eigen::Index>(rows.size());
+    const Eigen::Index numCols = weightsOut.cols();
+    bool allRowsValid = true;
+    // rows are independent so large blocks are parsed in parallel, straight into the (column major) matrix
+#pragma omp parallel for schedule(static) if(numRows * numCols > 65536) reduction(&&:allRowsValid)
+    for(Eigen::Index row = 0; row < numRows; ++row)
     {
-        throw std::logic_error("No prefix class");
+        const TextLine& line = rows[static_cast<size_t>(row)];
+        allRowsValid = parseDelimitedRow(line.begin, line.end, weightsOut.data() + row, numCols, weightsOut.rows()) && allRowsValid;
     }
-    buf = buf.substr(pos, std::string::npos);
-    sstream.clear();
-    sstream << buf;
-    std::string classesAsStr;
-    while(std::getline(sstream, classesAsStr, DELIMITER))
+    if(!allRowsValid)
     {
-        cList.insert(classesAsStr);
+        throw std::logic_error("Malformed weight row in model file");
     }
+}
 
+NNetwork deserialise(std::ifstream& fileIn, ActFuncList& actFuncList)
+{
+    // read the rest of the file in one go and parse it in place
+    const auto startPos = fileIn.tellg();
+    fileIn.seekg(0, std::ios::end);
+    const auto endPos = fileIn.tellg();
+    fileIn.seekg(startPos);
+    std::vector<char> contents(static_cast<size_t>(endPos - startPos));
+    fileIn.read(contents.data(), static_cast<std::streamsize>(contents.size()));
+    TextCursor cursor(contents.data(), contents.data() + contents.size());
 
-    //get input sz
-    std::getline(fileIn, buf);
-    pos = buf.find(PREFIX_INPUTSZ) + std::string(PREFIX_INPUTSZ).size();
-    if(pos == std::string::npos)
+    //get actfuncs
+    forEachToken(cursor.expectLine(PREFIX_ACTFUNCS).view(), [&](std::string_view token)
     {
-        throw std::logic_error("No input sz prefix");
-    }
-    inputSz = std::stoi (buf.substr(pos, std::string::npos));
+        actFuncList.push_back(ActFunc(parseInteger<int>(token)));
+    });
+
+    // classes
+    ClassList cList;
+    forEachToken(cursor.expectLine(PREFIX_CLASSES).view(), [&](std::string_view token)
+    {
+        cList.emplace(token);
+    });
+
+    //get input sz
+    const auto inputSz = parseInteger<size_t>(cursor.expectLine(PREFIX_INPUTSZ).view());
 
     // construct Network
     NNetwork networkToReturn(inputSz, cList);
 
     //get biases and add layers
-    std::getline(fileIn, buf);
-    if(buf.find(PREFIX_BIASES) == std::string::npos)
-    {
-        throw std::logic_error("No bias prefix");
-    }
-    sstream.clear();
+    cursor.expectLine(PREFIX_BIASES);
+    SingleRowT biasForLayer;
     for(size_t biasLayer = 0; biasLayer < actFuncList.size(); ++biasLayer)
     {
-        std::getline(fileIn, buf);
-        auto biasForLayer  = generateVectorRow(buf);
+        TextLine line{};
+        if(!cursor.nextLine(line))
+        {
+            throw std::logic_error("Missing biases in model file");
+        }
+        generateVectorRow(line, biasForLayer);
         if(biasLayer < actFuncList.size() - 1)
         {
-            networkToReturn.addLayer(biasForLayer.size(), biasLayer);
+            networkToReturn.addLayer(static_cast<size_t>(biasForLayer.size()), biasLayer);
         }
         networkToReturn.layer(biasLayer).setBiases(biasForLayer);
     }
 
     // add weights
-    std::getline(fileIn, buf);
-    if(buf.find(PREFIX_WEIGHTS) == std::string::npos)
-    {
-        throw std::logic_error("No weight prefix");
-    }
+    cursor.expectLine(PREFIX_WEIGHTS);
     size_t weightLayerPos = 0;
-    while(std::getline(fileIn, buf))
+    TextLine line{};
+    std::vector<TextLine> rows;
+    LayerWeightsT weightMatrix;
+    while(cursor.nextLine(line))
     {
-        sstream.clear();
-        sstream << buf;
-        Eigen::Index weightRows, weightCols;
-
-        std::getline(sstream, buf, ',');
-        weightRows = stoi(buf);
-        std::getline(sstream, buf);
-        weightCols = stoi(buf);
+        if(line.begin == line.end)
+        {
+            continue;
+        }
+        const std::string_view dims = line.view();
+        const size_t delimiterPos = dims.find(DELIMITER);
+        if(delimiterPos == std::string_view::npos)
+        {
+            throw std::logic_error("Malformed weight dimensions in model file");
+        }
+        const auto weightRows = parseInteger<Eigen::Index>(dims.substr(0, delimiterPos));
+        const auto weightCols = parseInteger<Eigen::Index>(dims.substr(delimiterPos + 1));
+        if(weightRows < 0 || weightCols < 0)
+        {
+            throw std::logic_error("Malformed weight dimensions in model file");
+        }
 
-        Eigen::Matrix<NetNumT, Eigen::Dynamic, Eigen::Dynamic> weightMatrix = generateMatrix(fileIn, weightRows, weightCols);
+        // find the start of every row first (cheap) so the rows can then be parsed in parallel
+        rows.resize(static_cast<size_t>(weightRows));
+        for(TextLine& row : rows)
+        {
+            if(!cursor.nextLine(row))
+            {
+                throw std::logic_error("Missing weight rows in model file");
+            }
+        }
+        weightMatrix.resize(weightRows, weightCols);
+        generateMatrix(rows, weightMatrix);
         networkToReturn.layer(weightLayerPos).setWeights(weightMatrix);
         weightLayerPos++;
     }
     return networkToReturn;
-}
\ No newline at end of file
+}
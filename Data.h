@@ -5,6 +5,8 @@
 #ifndef NNETWORK2_DATA_H
 #define NNETWORK2_DATA_H
 
+#include <cstdint>
+
 #include "NNetwork.h"
 #include "Training.h"
 
@@ -18,11 +20,48 @@ enum class DataNormalisationMethod
 SingleRowT trainingItemToVector(const std::map<ClassT, NetNumT>& trItem);
 bool isTrainingDataValid(const std::map<ClassT, size_t>& networkLabels, const ExampleData& trainingData, size_t networkInputSz);
 
-void normaliseTrainingData(ExampleData& trData, DataNormalisationMethod method);
+// per-feature transform fitted on training data: normalised = (raw - shift) / scale (unused for LOG)
+struct DataNormaliser
+{
+    DataNormalisationMethod method = DataNormalisationMethod::Z_SCORE;
+    SingleRowT shift;
+    SingleRowT scale;
+};
+
+DataNormaliser fitNormaliser(const ExampleData& trData, DataNormalisationMethod method);
+void applyNormaliser(ExampleData& trData, const DataNormaliser& normaliser);
+DataNormaliser normaliseTrainingData(ExampleData& trData, DataNormalisationMethod method);
+void foldNormaliserIntoNetwork(NNetwork& network, const DataNormaliser& normaliser);
+
+// compact storage for integer valued inputs (e.g. 0-255 pixels) - converted and normalised when a batch is gathered
+template<typename RawT>
+struct RawExampleData
+{
+    Eigen::Matrix<RawT, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> inputs; // one row per item
+    std::vector<Eigen::Index> labels; // position of the target class of each item
+    Eigen::Index numClasses = 0;
+
+    [[nodiscard]] size_t size() const { return labels.size(); }
+};
+using ExampleDataU8 = RawExampleData<uint8_t>;
+using ExampleDataU16 = RawExampleData<uint16_t>;
+
+template<typename RawT>
+RawExampleData<RawT> loadRawTrainingDataFromFile(const std::string &fName);
+template<typename RawT>
+DataNormaliser fitNormaliser(const RawExampleData<RawT>& rawData, DataNormalisationMethod method);
+template<typename RawT>
+void gatherBatch(const RawExampleData<RawT>& rawData, const DataNormaliser& normaliser, const std::vector<size_t>& order, size_t first, size_t last, ExampleData& batch);
 std::set<std::string> getClasses();
 Eigen::Index getInputSz();
 ExampleData loadTrainingDataFromFile(const std::string &fName);
 
+// binary shards store items as raw NetNumT values (inputs then labels for each item) so they load without parsing
+void writeBinaryShard(const std::string& fName, const ExampleData& data);
+bool isBinaryShard(const std::string& fName);
+ExampleData loadBinaryShard(const std::string& fName);
+ExampleData loadShard(const std::string& fName); // binary shard or csv
+
 bool serialise(std::ofstream& fileOut, NNetwork& network, const ActFuncList& actFuncList);
 NNetwork deserialise(std::ifstream& fileIn, ActFuncList& actFuncList);
 
@@ -34,5 +73,6 @@ NNetwork deserialise(std::ifstream& fileIn, ActFuncList& actFuncList);
 #define PREFIX_BIASES "LAYER_BIASES"
 #define PREFIX_WEIGHTS "LAYER_WEIGHTS:"
 #define DELIMITER ','
+#define BINARY_SHARD_MAGIC "NNSHARD1"
 
 #endif //NNETWORK2_DATA_H
@@ -0,0 +1,355 @@
+//
+// Created by Lenovo on 09/08/2023.
+//
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+
+#include "Checksum.h"
+#include "DataCache.h"
+#include "DataSpecs.h"
+
+namespace
+{
+    constexpr uint32_t DATA_CACHE_VERSION = 1;
+    constexpr uint64_t DATA_CACHE_ALIGNMENT = 64;
+
+    struct DataCacheHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t numTypeSz;
+        uint64_t numItems;
+        uint64_t inputSz;
+        uint64_t labelSz;
+        uint64_t keyLength;
+        uint64_t hasNormaliser;
+        uint64_t normaliserMethod;
+        uint64_t normaliserSz;
+        uint64_t dataOffset; // aligned start of the inputs block (labels block follows)
+    };
+
+    uint64_t hashFileContents(const std::string& fName)
+    {
+        std::ifstream fileIn(fName, std::ios::binary);
+        std::vector<char> buffer(1 << 20);
+        uint64_t hash = FNV1A_OFFSET_BASIS;
+        while(fileIn.read(buffer.data(), static_cast<std::streamsize>(buffer.size())) || fileIn.gcount() > 0)
+        {
+            hash = fnv1aHash(buffer.data(), static_cast<size_t>(fileIn.gcount()), hash);
+        }
+        return hash;
+    }
+
+    // nullopt when the source cannot be keyed (e.g. it does not exist) - the load then bypasses the cache and reports its own error
+    std::optional<std::string> buildCacheKey(const std::string& fName, const DataCacheOptions& options, const DataNormalisationMethod* method)
+    {
+        std::error_code error;
+        const std::filesystem::path sourcePath = std::filesystem::canonical(fName, error);
+        if(error)
+        {
+            return std::nullopt;
+        }
+        const auto sourceSz = std::filesystem::file_size(sourcePath, error);
+        if(error)
+        {
+            return std::nullopt;
+        }
+        const auto modifiedTime = std::filesystem::last_write_time(sourcePath, error);
+        if(error)
+        {
+            return std::nullopt;
+        }
+        std::ostringstream key;
+        key << "path=" << sourcePath.string() << "\n";
+        key << "size=" << sourceSz << "\n";
+        key << "mtime=" << modifiedTime.time_since_epoch().count() << "\n";
+        if(options.hashContents)
+        {
+            key << "hash=" << hashFileContents(fName) << "\n";
+        }
+        key << "normalise=" << (method == nullptr ? -1 : static_cast<int>(*method)) << "\n";
+        key << "numType=" << sizeof(NetNumT) << "\n";
+        key << "inputSz=" << getInputSz() << "\n";
+        key << "classes=";
+        for(const auto& c : getClasses())
+        {
+            key << c << DELIMITER;
+        }
+        return key.str();
+    }
+
+    std::filesystem::path cacheFilePath(const std::string& fName, const DataCacheOptions& options, const std::string& key)
+    {
+        std::ostringstream fileName;
+        fileName << std::filesystem::path(fName).stem().string() << "." << std::hex << fnv1aHash(key.data(), key.size()) << DATA_CACHE_EXTENSION;
+        return std::filesystem::path(options.cacheDir) / fileName.str();
+    }
+
+    std::optional<MappedExampleData> tryMapCache(const std::filesystem::path& cachePath, const std::string& key, const DataNormalisationMethod* method, DataNormaliser* normaliser)
+    {
+        if(!std::filesystem::exists(cachePath))
+        {
+            return std::nullopt;
+        }
+        MappedFile cacheFile(cachePath.string());
+        DataCacheHeader header{};
+        if(cacheFile.size() < sizeof(header))
+        {
+            return std::nullopt;
+        }
+        std::memcpy(&header, cacheFile.data(), sizeof(header));
+        const uint64_t fileSz = cacheFile.size();
+        if(std::memcmp(header.magic, DATA_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != DATA_CACHE_VERSION ||
+           header.numTypeSz != sizeof(NetNumT) || header.keyLength != key.size() || (method != nullptr) != (header.hasNormaliser != 0))
+        {
+            return std::nullopt;
+        }
+        // the stored normaliser must be the one asked for - LOG has no statistics so stores none
+        if(method != nullptr &&
+           (header.normaliserMethod != static_cast<uint64_t>(*method) ||
+            header.normaliserSz != (*method == DataNormalisationMethod::LOG ? 0 : header.inputSz)))
+        {
+            return std::nullopt;
+        }
+        // a truncated or corrupt cache is reparsed - every size is bounded by the file before it is used so nothing below
+        // overflows or reads past the end
+        if(header.inputSz > fileSz || header.labelSz > fileSz || header.normaliserSz > fileSz || header.dataOffset > fileSz)
+        {
+            return std::nullopt;
+        }
+        const uint64_t metadataEnd = sizeof(header) + header.keyLength + (header.hasNormaliser != 0 ? 2 * sizeof(NetNumT) * header.normaliserSz : 0);
+        const uint64_t itemBytes = (header.inputSz + header.labelSz) * sizeof(NetNumT);
+        if(metadataEnd > header.dataOffset ||
+           (itemBytes == 0 ? header.numItems != 0 : header.numItems > (fileSz - header.dataOffset) / itemBytes))
+        {
+            return std::nullopt;
+        }
+        // the full key is stored so that hash collisions are never mistaken for hits
+        const char* cursor = cacheFile.data() + sizeof(header);
+        if(std::memcmp(cursor, key.data(), key.size()) != 0)
+        {
+            return std::nullopt;
+        }
+        cursor += key.size();
+        if(normaliser != nullptr)
+        {
+            normaliser->method = *method;
+            const auto normaliserSz = static_cast<Eigen::Index>(header.normaliserSz);
+            normaliser->shift.resize(normaliserSz);
+            normaliser->scale.resize(normaliserSz);
+            if(normaliserSz > 0)
+            {
+                std::memcpy(normaliser->shift.data(), cursor, sizeof(NetNumT) * header.normaliserSz);
+                cursor += sizeof(NetNumT) * header.normaliserSz;
+                std::memcpy(normaliser->scale.data(), cursor, sizeof(NetNumT) * header.normaliserSz);
+            }
+        }
+        return MappedExampleData(std::move(cacheFile), header.dataOffset, header.numItems,
+                                 static_cast<Eigen::Index>(header.inputSz), static_cast<Eigen::Index>(header.labelSz));
+    }
+
+    void writeCache(const std::filesystem::path& cachePath, const std::string& key, const ExampleData& data, const DataNormaliser* normaliser)
+    {
+        DataCacheHeader header{};
+        std::memcpy(header.magic, DATA_CACHE_MAGIC, sizeof(header.magic));
+        header.version = DATA_CACHE_VERSION;
+        header.numTypeSz = sizeof(NetNumT);
+        header.numItems = data.size();
+        header.inputSz = data.empty() ? 0 : static_cast<uint64_t>(data[0].inputs.size());
+        header.labelSz = data.empty() ? 0 : static_cast<uint64_t>(data[0].labels.size());
+        header.keyLength = key.size();
+        header.hasNormaliser = normaliser != nullptr;
+        header.normaliserMethod = normaliser == nullptr ? 0 : static_cast<uint64_t>(normaliser->method);
+        header.normaliserSz = normaliser == nullptr ? 0 : static_cast<uint64_t>(normaliser->shift.size());
+        const uint64_t metadataEnd = sizeof(header) + key.size() + 2 * sizeof(NetNumT) * header.normaliserSz;
+        header.dataOffset = (metadataEnd + DATA_CACHE_ALIGNMENT - 1) / DATA_CACHE_ALIGNMENT * DATA_CACHE_ALIGNMENT;
+
+        // write to a temporary file then rename so a partially written cache is never read
+        std::filesystem::create_directories(cachePath.parent_path());
+        const std::filesystem::path tempPath = cachePath.string() + ".tmp";
+        {
+            std::ofstream fileOut(tempPath, std::ios::binary | std::ios::trunc);
+            fileOut.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            fileOut.write(key.data(), static_cast<std::streamsize>(key.size()));
+            if(normaliser != nullptr)
+            {
+                fileOut.write(reinterpret_cast<const char*>(normaliser->shift.data()), static_cast<std::streamsize>(sizeof(NetNumT) * header.normaliserSz));
+                fileOut.write(reinterpret_cast<const char*>(normaliser->scale.data()), static_cast<std::streamsize>(sizeof(NetNumT) * header.normaliserSz));
+            }
+            const std::string padding(header.dataOffset - metadataEnd, '\0');
+            fileOut.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+            for(const ExampleItem& item : data)
+            {
+                fileOut.write(reinterpret_cast<const char*>(item.inputs.data()), static_cast<std::streamsize>(sizeof(NetNumT) * header.inputSz));
+            }
+            for(const ExampleItem& item : data)
+            {
+                fileOut.write(reinterpret_cast<const char*>(item.labels.data()), static_cast<std::streamsize>(sizeof(NetNumT) * header.labelSz));
+            }
+            if(!fileOut)
+            {
+                throw std::runtime_error("Failed writing data cache");
+            }
+        }
+        std::filesystem::rename(tempPath, cachePath);
+    }
+
+    ExampleData parseSource(const std::string& fName, const DataNormalisationMethod* method, DataNormaliser* normaliserOut)
+    {
+        ExampleData data = loadTrainingDataFromFile(fName);
+        if(method != nullptr)
+        {
+            *normaliserOut = normaliseTrainingData(data, *method);
+        }
+        return data;
+    }
+
+    ExampleData loadCached(const std::string& fName, const DataCacheOptions& options, const DataNormalisationMethod* method, DataNormaliser* normaliserOut)
+    {
+        const std::optional<std::string> key = options.cacheDir.empty() ? std::nullopt : buildCacheKey(fName, options, method);
+        if(!key)
+        {
+            return parseSource(fName, method, normaliserOut);
+        }
+        const std::filesystem::path cachePath = cacheFilePath(fName, options, *key);
+        if(const std::optional<MappedExampleData> mapped = tryMapCache(cachePath, *key, method, normaliserOut))
+        {
+            // callers wanting ExampleData get a copy - loadTrainingDataMapped avoids it
+            ExampleData data(mapped->size());
+            for(size_t itemPos = 0; itemPos < data.size(); ++itemPos)
+            {
+                data[itemPos].inputs = mapped->inputs(itemPos);
+                data[itemPos].labels = mapped->labels(itemPos);
+            }
+            return data;
+        }
+        ExampleData data = parseSource(fName, method, normaliserOut);
+        // failing to write the cache should not fail the load
+        try
+        {
+            writeCache(cachePath, *key, data, normaliserOut);
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << "Could not write data cache " << cachePath << ": " << e.what() << std::endl;
+        }
+        return data;
+    }
+
+    MappedExampleData loadMapped(const std::string& fName, const DataCacheOptions& options, const DataNormalisationMethod* method, DataNormaliser* normaliserOut)
+    {
+        if(options.cacheDir.empty())
+        {
+            throw std::logic_error("Mapped data needs a cache directory");
+        }
+        const std::optional<std::string> key = buildCacheKey(fName, options, method);
+        if(!key)
+        {
+            throw std::logic_error("Could not open file");
+        }
+        const std::filesystem::path cachePath = cacheFilePath(fName, options, *key);
+        if(std::optional<MappedExampleData> mapped = tryMapCache(cachePath, *key, method, normaliserOut))
+        {
+            return std::move(*mapped);
+        }
+        writeCache(cachePath, *key, parseSource(fName, method, normaliserOut), normaliserOut);
+        std::optional<MappedExampleData> mapped = tryMapCache(cachePath, *key, method, normaliserOut);
+        if(!mapped)
+        {
+            throw std::runtime_error("Could not map data cache");
+        }
+        return std::move(*mapped);
+    }
+}
+
+MappedExampleData::MappedExampleData(MappedFile file, size_t dataOffset, size_t numItems, Eigen::Index inputSz, Eigen::Index labelSz) :
+    mFile(std::move(file)), mNumItems(numItems), mInputSz(inputSz), mLabelSz(labelSz)
+{
+    // labels follow the inputs block (see writeCache)
+    mInputs = reinterpret_cast<const NetNumT*>(mFile.data() + dataOffset);
+    mLabels = mInputs + numItems * static_cast<size_t>(inputSz);
+}
+
+size_t MappedExampleData::size() const
+{
+    return mNumItems;
+}
+
+Eigen::Index MappedExampleData::inputSz() const
+{
+    return mInputSz;
+}
+
+Eigen::Map<const SingleRowT> MappedExampleData::inputs(size_t item) const
+{
+    return {mInputs + item * static_cast<size_t>(mInputSz), mInputSz};
+}
+
+Eigen::Map<const SingleRowT> MappedExampleData::labels(size_t item) const
+{
+    return {mLabels + item * static_cast<size_t>(mLabelSz), mLabelSz};
+}
+
+void gatherBatch(const MappedExampleData& data, const DataNormaliser& normaliser, const std::vector<size_t>& order, size_t first, size_t last, ExampleData& batch)
+{
+    // an empty shift means inputs are only copied
+    const bool shiftAndScale = normaliser.method != DataNormalisationMethod::LOG && normaliser.shift.size() > 0;
+    if(shiftAndScale && normaliser.shift.size() != data.inputSz())
+    {
+        throw std::logic_error("Normaliser size does not match inputs");
+    }
+    batch.resize(last - first);
+    for(size_t batchPos = 0; batchPos < batch.size(); ++batchPos)
+    {
+        const size_t itemPos = order[first + batchPos];
+        ExampleItem& item = batch[batchPos];
+        if(normaliser.method == DataNormalisationMethod::LOG)
+        {
+            item.inputs = (data.inputs(itemPos).array() + 1).log();
+        }
+        else if(shiftAndScale)
+        {
+            item.inputs = (data.inputs(itemPos).array() - normaliser.shift.array()) / normaliser.scale.array();
+        }
+        else
+        {
+            item.inputs = data.inputs(itemPos);
+        }
+        item.labels = data.labels(itemPos);
+    }
+}
+
+DataCacheOptions DataCacheOptions::fromEnvironment()
+{
+    DataCacheOptions options;
+    if(const char* cacheDir = std::getenv("NNETWORK_DATA_CACHE"))
+    {
+        options.cacheDir = cacheDir;
+    }
+    return options;
+}
+
+ExampleData loadTrainingDataCached(const std::string& fName, const DataCacheOptions& options)
+{
+    return loadCached(fName, options, nullptr, nullptr);
+}
+
+ExampleData loadTrainingDataCached(const std::string& fName, const DataCacheOptions& options, DataNormalisationMethod method, DataNormaliser& normaliserOut)
+{
+    return loadCached(fName, options, &method, &normaliserOut);
+}
+
+MappedExampleData loadTrainingDataMapped(const std::string& fName, const DataCacheOptions& options)
+{
+    return loadMapped(fName, options, nullptr, nullptr);
+}
+
+MappedExampleData loadTrainingDataMapped(const std::string& fName, const DataCacheOptions& options, DataNormalisationMethod method, DataNormaliser& normaliserOut)
+{
+    return loadMapped(fName, options, &method, &normaliserOut);
+}
@@ -0,0 +1,54 @@
+//
+// Created by Lenovo on 09/08/2023.
+//
+
+#ifndef NNETWORK2_DATACACHE_H
+#define NNETWORK2_DATACACHE_H
+
+#include "Data.h"
+#include "MappedFile.h"
+
+// opt-in cache of parsed (and optionally normalised) csv data in binary side files.
+// cache files are keyed by the source path, size, modification time (or content hash), normalisation and data specs
+struct DataCacheOptions
+{
+    std::string cacheDir; // caching is disabled when empty
+    bool hashContents = false; // also key on a hash of the whole source file (slower but robust to copied timestamps)
+
+    static DataCacheOptions fromEnvironment(); // cacheDir taken from NNETWORK_DATA_CACHE if set
+};
+
+ExampleData loadTrainingDataCached(const std::string& fName, const DataCacheOptions& options);
+ExampleData loadTrainingDataCached(const std::string& fName, const DataCacheOptions& options, DataNormalisationMethod method, DataNormaliser& normaliserOut);
+
+// the items of a cache file served straight from its mapping - nothing is copied until a batch is gathered
+class MappedExampleData
+{
+    private:
+        MappedFile mFile;
+        const NetNumT* mInputs;
+        const NetNumT* mLabels;
+        size_t mNumItems;
+        Eigen::Index mInputSz;
+        Eigen::Index mLabelSz;
+
+    public:
+        MappedExampleData(MappedFile file, size_t dataOffset, size_t numItems, Eigen::Index inputSz, Eigen::Index labelSz);
+
+        [[nodiscard]] size_t size() const;
+        [[nodiscard]] Eigen::Index inputSz() const;
+        [[nodiscard]] Eigen::Map<const SingleRowT> inputs(size_t item) const;
+        [[nodiscard]] Eigen::Map<const SingleRowT> labels(size_t item) const;
+};
+
+// as loadTrainingDataCached but the cache file is mapped rather than copied (it is parsed and written first on a miss).
+// needs options.cacheDir
+MappedExampleData loadTrainingDataMapped(const std::string& fName, const DataCacheOptions& options);
+MappedExampleData loadTrainingDataMapped(const std::string& fName, const DataCacheOptions& options, DataNormalisationMethod method, DataNormaliser& normaliserOut);
+// converts the items order[first, last) into batch, applying the normaliser as gatherBatch does for raw data
+void gatherBatch(const MappedExampleData& data, const DataNormaliser& normaliser, const std::vector<size_t>& order, size_t first, size_t last, ExampleData& batch);
+
+#define DATA_CACHE_MAGIC "NNCACHE1"
+#define DATA_CACHE_EXTENSION ".nncache"
+
+#endif //NNETWORK2_DATACACHE_H
@@ -0,0 +1,289 @@
+//
+// Created by Lenovo on 24/06/2023.
+//
+
+// End to end benchmark: time to a target test accuracy for the README's 784-128-64-10 network, then training / evaluation
+// throughput for 1..N threads. Uses the MNIST csv files if present, otherwise synthetic MNIST shaped data.
+// usage: NNetwork2EndToEnd [--train FILE --test FILE] [--synthetic-items N] [--target-accuracy X] [--max-epochs N]
+//                          [--max-threads N] [--scaling-batches N] [--json FILE]
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <omp.h>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "Benchmark.h"
+#include "BatchSource.h"
+#include "Data.h"
+#include "DataCache.h"
+#include "ExecutionPlan.h"
+#include "NNetwork.h"
+#include "Training.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct EndToEndOptions
+{
+    std::string trainingFile = "../TrainingData/mnist_train_3.csv";
+    std::string testFile = "../TrainingData/mnist_test.csv";
+    size_t syntheticItems = 20000; // training items when the csv files are missing (test set is a tenth of this)
+    double targetAccuracy = 98.5; // the README's figure
+    size_t maxEpochs = 10;
+    size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t scalingBatches = 500;
+    std::string jsonFile;
+
+    static EndToEndOptions fromArgs(int argc, char** argv)
+    {
+        EndToEndOptions options;
+        for(int argPos = 1; argPos < argc; ++argPos)
+        {
+            const std::string arg = argv[argPos];
+            if(argPos + 1 >= argc)
+            {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            const std::string value = argv[++argPos];
+            if(arg == "--train") options.trainingFile = value;
+            else if(arg == "--test") options.testFile = value;
+            else if(arg == "--synthetic-items") options.syntheticItems = std::stoul(value);
+            else if(arg == "--target-accuracy") options.targetAccuracy = std::stod(value);
+            else if(arg == "--max-epochs") options.maxEpochs = std::stoul(value);
+            else if(arg == "--max-threads") options.maxThreads = std::max<size_t>(1, std::stoul(value));
+            else if(arg == "--scaling-batches") options.scalingBatches = std::stoul(value);
+            else if(arg == "--json") options.jsonFile = value;
+            else throw std::invalid_argument("Unknown argument " + arg);
+        }
+        return options;
+    }
+};
+
+// the README's configuration
+constexpr size_t BATCH_SZ = 16;
+const ActFuncList ACT_FUNCS{ActFunc::RELU, ActFunc::RELU, ActFunc::SOFTMAX};
+const LearningRateList LEARNING_RATES{0.01f, 0.01f, 0.01f};
+constexpr NetNumT MOMENTUM = 0;
+
+static NNetwork makeNetwork()
+{
+    NNetwork network(static_cast<size_t> (getInputSz()), getClasses());
+    network.addLayer(128, 0);
+    network.addLayer(64, 1);
+    initialiseWeightsBiases(network, InitMethod::UNIFORM_HE);
+    return network;
+}
+
+static void setThreads(size_t threads)
+{
+    omp_set_num_threads(static_cast<int> (threads));
+    Eigen::setNbThreads(static_cast<int> (threads));
+}
+
+// trains on up to maxBatches batches of an epoch (all if 0), returns the number of items trained on
+class EpochRunner
+{
+    private:
+        NNetwork& mNetwork;
+        NetworkLayerGradients mLayerGrads, mPrevBiasDelta;
+        NetworkWeightGradients mWeightGrads, mPrevWeightDelta;
+        ExecutionPlan mPlan;
+
+    public:
+        explicit EpochRunner(NNetwork& network) :
+            mNetwork(network),
+            mLayerGrads(network), mPrevBiasDelta(network),
+            mWeightGrads(network), mPrevWeightDelta(network),
+            mPlan(network, BATCH_SZ)
+        {
+        }
+
+        size_t run(BatchSource& source, size_t epoch, size_t maxBatches)
+        {
+            size_t numItems = 0, numBatches = 0;
+            ExampleBatchIterator batchStart, batchEnd;
+            source.startEpoch(epoch);
+            while((maxBatches == 0 || numBatches < maxBatches) && source.nextBatch(BATCH_SZ, batchStart, batchEnd))
+            {
+                calculateGradientsOverBatch(mNetwork, batchStart, batchEnd, ACT_FUNCS, LossFunc::CROSS_ENTROPY, mLayerGrads, mWeightGrads, 0, mPlan);
+                updateNetworkUsingGradients(mNetwork, mLayerGrads, mWeightGrads, LEARNING_RATES, MOMENTUM, mPrevBiasDelta, mPrevWeightDelta);
+                mLayerGrads.setToZero();
+                mWeightGrads.setToZero();
+                numItems += static_cast<size_t> (std::distance(batchStart, batchEnd));
+                numBatches++;
+            }
+            return numItems;
+        }
+};
+
+struct EpochResult
+{
+    size_t epoch;
+    double trainSeconds;
+    double cumulativeTrainSeconds;
+    double samplesPerSecond;
+    NetNumT testLoss;
+    NetNumT testAccuracy;
+};
+
+struct ScalingResult
+{
+    size_t threads;
+    double trainSamplesPerSecond;
+    double evaluationSamplesPerSecond;
+    double trainSpeedup;
+    double evaluationSpeedup;
+};
+
+static double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        const EndToEndOptions options = EndToEndOptions::fromArgs(argc, argv);
+
+        // Data
+        const bool useCsv = std::filesystem::exists(options.trainingFile) && std::filesystem::exists(options.testFile);
+        const auto loadStart = Clock::now();
+        ExampleData trainingData, testData;
+        if(useCsv)
+        {
+            const DataCacheOptions cacheOptions = DataCacheOptions::fromEnvironment();
+            trainingData = loadTrainingDataCached(options.trainingFile, cacheOptions);
+            testData = loadTrainingDataCached(options.testFile, cacheOptions);
+        }
+        else
+        {
+            trainingData = makeSyntheticExampleData(options.syntheticItems, 1);
+            testData = makeSyntheticExampleData(std::max<size_t>(1, options.syntheticItems / 10), 2);
+        }
+        const DataNormaliser normaliser = normaliseTrainingData(trainingData, DataNormalisationMethod::Z_SCORE);
+        applyNormaliser(testData, normaliser);
+        const double loadSeconds = secondsSince(loadStart);
+        std::cout << "Data: " << (useCsv ? "csv" : "synthetic") << ", " << trainingData.size() << " training / " << testData.size()
+                  << " test items, loaded in " << loadSeconds << " s" << std::endl;
+
+        ExampleDataSource trainingSource(trainingData, true);
+        ExampleDataSource testSource(testData, false);
+
+        // Time to accuracy (training time only - evaluation between epochs is excluded)
+        setThreads(options.maxThreads);
+        std::vector<EpochResult> epochs;
+        std::optional<double> timeToTarget;
+        {
+            NNetwork network = makeNetwork();
+            EpochRunner runner(network);
+            ExecutionPlan evaluationPlan(network, 256);
+            double cumulativeSeconds = 0;
+            for(size_t epoch = 0; epoch < options.maxEpochs && !timeToTarget; ++epoch)
+            {
+                const auto epochStart = Clock::now();
+                const size_t numItems = runner.run(trainingSource, epoch, 0);
+                const double epochSeconds = secondsSince(epochStart);
+                cumulativeSeconds += epochSeconds;
+
+                EpochResult result{epoch, epochSeconds, cumulativeSeconds, static_cast<double> (numItems) / epochSeconds,
+                                   calculateLossForBatchSource(network, testSource, ACT_FUNCS, LossFunc::CROSS_ENTROPY, evaluationPlan),
+                                   calculateAccuracyForBatchSource(network, testSource, ACT_FUNCS, evaluationPlan)};
+                epochs.push_back(result);
+                std::cout << "Epoch " << epoch << ": " << epochSeconds << " s, " << result.samplesPerSecond << " samples/s, test accuracy "
+                          << result.testAccuracy << "%" << std::endl;
+                if(result.testAccuracy >= options.targetAccuracy)
+                {
+                    timeToTarget = cumulativeSeconds;
+                }
+            }
+        }
+        if(timeToTarget)
+        {
+            std::cout << "Reached " << options.targetAccuracy << "% in " << *timeToTarget << " s of training" << std::endl;
+        }
+        else
+        {
+            std::cout << "Did not reach " << options.targetAccuracy << "% in " << options.maxEpochs << " epochs" << std::endl;
+        }
+
+        // Strong scaling - the same work for 1..N threads
+        std::vector<size_t> threadCounts; // powers of two then the maximum
+        for(size_t threads = 1; threads < options.maxThreads; threads *= 2)
+        {
+            threadCounts.push_back(threads);
+        }
+        threadCounts.push_back(options.maxThreads);
+
+        std::vector<ScalingResult> scaling;
+        for(const size_t threads : threadCounts)
+        {
+            setThreads(threads);
+            NNetwork network = makeNetwork();
+            EpochRunner runner(network);
+            const auto trainStart = Clock::now();
+            const size_t trainItems = runner.run(trainingSource, 0, options.scalingBatches);
+            const double trainSeconds = secondsSince(trainStart);
+
+            ExecutionPlan evaluationPlan(network, 256);
+            const auto evaluationStart = Clock::now();
+            calculateAccuracyForBatchSource(network, testSource, ACT_FUNCS, evaluationPlan);
+            const double evaluationSeconds = secondsSince(evaluationStart);
+
+            ScalingResult result{threads, static_cast<double> (trainItems) / trainSeconds, static_cast<double> (testData.size()) / evaluationSeconds, 1, 1};
+            if(!scaling.empty())
+            {
+                result.trainSpeedup = result.trainSamplesPerSecond / scaling.front().trainSamplesPerSecond;
+                result.evaluationSpeedup = result.evaluationSamplesPerSecond / scaling.front().evaluationSamplesPerSecond;
+            }
+            scaling.push_back(result);
+            std::cout << "Threads " << threads << ": training " << result.trainSamplesPerSecond << " samples/s (x" << result.trainSpeedup
+                      << "), evaluation " << result.evaluationSamplesPerSecond << " samples/s (x" << result.evaluationSpeedup << ")" << std::endl;
+        }
+
+        if(!options.jsonFile.empty())
+        {
+            std::ofstream jsonOut(options.jsonFile);
+            if(!jsonOut)
+            {
+                throw std::runtime_error("Could not open " + options.jsonFile);
+            }
+            jsonOut << std::setprecision(6);
+            jsonOut << "{\n  \"data\": {\"source\": \"" << (useCsv ? "csv" : "synthetic") << "\", \"trainingItems\": " << trainingData.size()
+                    << ", \"testItems\": " << testData.size() << ", \"loadSeconds\": " << loadSeconds << "},\n";
+            jsonOut << "  \"config\": {\"layers\": [784, 128, 64, 10], \"batchSz\": " << BATCH_SZ << ", \"learningRate\": " << LEARNING_RATES.front()
+                    << ", \"momentum\": " << MOMENTUM << ", \"numType\": \"" << (sizeof(NetNumT) == sizeof(float) ? "float" : "double") << "\"},\n";
+            jsonOut << "  \"targetAccuracy\": " << options.targetAccuracy << ",\n";
+            jsonOut << "  \"timeToTargetSeconds\": ";
+            if(timeToTarget) jsonOut << *timeToTarget; else jsonOut << "null";
+            jsonOut << ",\n  \"threads\": " << options.maxThreads << ",\n  \"epochs\": [\n";
+            for(size_t pos = 0; pos < epochs.size(); ++pos)
+            {
+                const EpochResult& result = epochs[pos];
+                jsonOut << "    {\"epoch\": " << result.epoch << ", \"trainSeconds\": " << result.trainSeconds << ", \"cumulativeTrainSeconds\": " << result.cumulativeTrainSeconds
+                        << ", \"samplesPerSecond\": " << result.samplesPerSecond << ", \"testLoss\": " << result.testLoss << ", \"testAccuracy\": " << result.testAccuracy
+                        << "}" << (pos + 1 < epochs.size() ? "," : "") << "\n";
+            }
+            jsonOut << "  ],\n  \"scaling\": [\n";
+            for(size_t pos = 0; pos < scaling.size(); ++pos)
+            {
+                const ScalingResult& result = scaling[pos];
+                jsonOut << "    {\"threads\": " << result.threads << ", \"trainSamplesPerSecond\": " << result.trainSamplesPerSecond
+                        << ", \"trainSpeedup\": " << result.trainSpeedup << ", \"trainEfficiency\": " << result.trainSpeedup / static_cast<double> (result.threads)
+                        << ", \"evaluationSamplesPerSecond\": " << result.evaluationSamplesPerSecond << ", \"evaluationSpeedup\": " << result.evaluationSpeedup
+                        << "}" << (pos + 1 < scaling.size() ? "," : "") << "\n";
+            }
+            jsonOut << "  ]\n}\n";
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,263 @@
+//
+// Created by Lenovo on 16/06/2023.
+//
+
+#include "ExecutionPlan.h"
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+// rounds a buffer up so the next one in the workspace stays aligned
+static size_t paddedWorkspaceSz(size_t numElements)
+{
+    constexpr size_t elementsPerBlock = PARAMETER_ALIGNMENT / sizeof(NetNumT);
+    return (numElements + elementsPerBlock - 1) / elementsPerBlock * elementsPerBlock;
+}
+
+ExecutionPlan::ExecutionPlan(NNetwork& network, size_t batchSz) :
+    mTopologyVersion(network.topologyVersion()),
+    mBatchSz(batchSz),
+    mDropOutMask(nullptr, 0),
+    mBatchTargets(nullptr, 0, 0)
+{
+    if(batchSz == 0)
+    {
+        throw std::logic_error("Execution plan batch size must be greater than 0");
+    }
+    buildWorkspace(network);
+}
+
+void ExecutionPlan::rebuild(NNetwork& network)
+{
+    mTopologyVersion = network.topologyVersion();
+    buildWorkspace(network);
+}
+
+void ExecutionPlan::buildWorkspace(NNetwork& network)
+{
+    mBatchActivations.clear();
+    mBatchErrors.clear();
+    mBatchDropOutMasks.clear();
+    mBatchParallelism.clear();
+    mBackwardParallelism.clear();
+    mSampleParallelism.clear();
+    mWeightGradientPartials.clear();
+    mForwardPacking.clear();
+    mBackwardPacking.clear();
+    mWeightGradientPacking.clear();
+    // layer sizes with the input layer first
+    std::vector<size_t> layerSzs{static_cast<size_t> (network.getInputs().size())};
+    for(size_t layerPos = 0; layerPos < network.numLayers(); ++layerPos)
+    {
+        layerSzs.push_back(network.layer(layerPos).size());
+    }
+    const size_t maxLayerSz = *std::max_element(layerSzs.begin(), layerSzs.end());
+
+    // how each product is parallelised decides which layers need partial weight gradients
+    const ParallelismPolicy& policy = activeParallelismPolicy();
+    const auto threads = static_cast<size_t> (Eigen::nbThreads());
+    const auto batchRows = static_cast<Eigen::Index> (mBatchSz);
+    // Eigen's threaded GEMM allocates its packing, so the batched products split wide layers' neurons over the threads instead
+    auto packedParallelism = [&](LayerParallelism parallelism, Eigen::Index neurons)
+    {
+        const bool splitColumns = parallelism == LayerParallelism::GEMM && threads > 1 &&
+                                  neurons >= static_cast<Eigen::Index> (threads) * ParallelismPolicy::MIN_COLUMNS_PER_THREAD;
+        return splitColumns ? LayerParallelism::COLUMNS : parallelism;
+    };
+    size_t packingSz = 0;
+    for(size_t layerPos = 1; layerPos < layerSzs.size(); ++layerPos)
+    {
+        const auto inputs = static_cast<Eigen::Index> (layerSzs[layerPos - 1]), neurons = static_cast<Eigen::Index> (layerSzs[layerPos]);
+        mBatchParallelism.push_back(packedParallelism(policy.choose(batchRows, inputs, neurons, threads), neurons));
+        mBackwardParallelism.push_back(packedParallelism(policy.choose(batchRows, neurons, inputs, threads), inputs));
+        mSampleParallelism.push_back(policy.choose(1, inputs, neurons, threads));
+        mForwardPacking.push_back({GemmBlocking::forProduct(batchRows, inputs, neurons, true), nullptr, static_cast<int> (threads)});
+        mBackwardPacking.push_back({GemmBlocking::forProduct(batchRows, neurons, inputs, true), nullptr, static_cast<int> (threads)});
+        mWeightGradientPacking.push_back({GemmBlocking::forProduct(inputs, batchRows, neurons, false), nullptr, static_cast<int> (threads)});
+        packingSz = std::max({packingSz, mForwardPacking.back().blocking.packingSz(), mBackwardPacking.back().blocking.packingSz(),
+                              mWeightGradientPacking.back().blocking.packingSz()});
+    }
+    mNumWeightGradientPartials = threads - 1;
+
+    // size the workspace in one go
+    size_t workspaceSz = paddedWorkspaceSz(maxLayerSz) + paddedWorkspaceSz(mBatchSz * layerSzs.back()) + paddedWorkspaceSz(threads * packingSz);
+    for(size_t layerPos = 0; layerPos < layerSzs.size(); ++layerPos)
+    {
+        workspaceSz += paddedWorkspaceSz(mBatchSz * layerSzs[layerPos]);
+        if(layerPos > 0)
+        {
+            workspaceSz += paddedWorkspaceSz(mBatchSz * layerSzs[layerPos]);
+            if(layerPos + 1 < layerSzs.size())
+            {
+                workspaceSz += paddedWorkspaceSz(mBatchSz * layerSzs[layerPos]);
+            }
+            if(mBatchParallelism[layerPos - 1] == LayerParallelism::SAMPLES)
+            {
+                workspaceSz += paddedWorkspaceSz(mNumWeightGradientPartials * layerSzs[layerPos - 1] * layerSzs[layerPos]);
+            }
+        }
+    }
+    mWorkspace = AlignedParameterBuffer(workspaceSz);
+
+    // then hand out the views
+    size_t offset = 0;
+    auto take = [&](size_t numElements)
+    {
+        NetNumT* ptr = mWorkspace.data() + offset;
+        offset += paddedWorkspaceSz(numElements);
+        return ptr;
+    };
+    new (&mDropOutMask) SingleRowMapT(take(maxLayerSz), static_cast<Eigen::Index> (maxLayerSz));
+    new (&mBatchTargets) BatchActivationsMapT(take(mBatchSz * layerSzs.back()), batchRows, static_cast<Eigen::Index> (layerSzs.back()));
+    NetNumT* packingBuffers = take(threads * packingSz);
+    for(size_t layerPos = 0; layerPos < mForwardPacking.size(); ++layerPos)
+    {
+        mForwardPacking[layerPos].buffers = mBackwardPacking[layerPos].buffers = mWeightGradientPacking[layerPos].buffers = packingBuffers;
+    }
+    for(size_t layerPos = 0; layerPos < layerSzs.size(); ++layerPos)
+    {
+        const auto layerSz = static_cast<Eigen::Index> (layerSzs[layerPos]);
+        mBatchActivations.emplace_back(take(mBatchSz * layerSzs[layerPos]), batchRows, layerSz);
+        if(layerPos > 0)
+        {
+            mBatchErrors.emplace_back(take(mBatchSz * layerSzs[layerPos]), batchRows, layerSz);
+            if(layerPos + 1 < layerSzs.size())
+            {
+                mBatchDropOutMasks.emplace_back(take(mBatchSz * layerSzs[layerPos]), batchRows, layerSz);
+            }
+            const bool needsPartials = mBatchParallelism[layerPos - 1] == LayerParallelism::SAMPLES;
+            mWeightGradientPartials.push_back(needsPartials ? take(mNumWeightGradientPartials * layerSzs[layerPos - 1] * layerSzs[layerPos]) : nullptr);
+        }
+    }
+}
+
+bool ExecutionPlan::isValidFor(const NNetwork& network, size_t batchSz) const
+{
+    return isValidFor(network) && batchSz <= mBatchSz;
+}
+
+bool ExecutionPlan::isValidFor(const NNetwork& network) const
+{
+    return network.topologyVersion() == mTopologyVersion;
+}
+
+size_t ExecutionPlan::batchSz() const
+{
+    return mBatchSz;
+}
+
+size_t ExecutionPlan::workspaceSz() const
+{
+    return mWorkspace.size();
+}
+
+BatchActivationsMapT& ExecutionPlan::batchInputs()
+{
+    return mBatchActivations[0];
+}
+
+BatchActivationsMapT& ExecutionPlan::batchOutputs(size_t layer)
+{
+    if(layer + 1 >= mBatchActivations.size())
+    {
+        throw std::out_of_range("Layer does not exist");
+    }
+    return mBatchActivations[layer + 1];
+}
+
+SingleRowMapT& ExecutionPlan::dropOutMask()
+{
+    return mDropOutMask;
+}
+
+BatchActivationsMapT& ExecutionPlan::batchTargets()
+{
+    return mBatchTargets;
+}
+
+BatchActivationsMapT& ExecutionPlan::batchErrors(size_t layer)
+{
+    if(layer >= mBatchErrors.size())
+    {
+        throw std::out_of_range("Layer does not exist");
+    }
+    return mBatchErrors[layer];
+}
+
+BatchActivationsMapT& ExecutionPlan::batchDropOutMasks(size_t layer)
+{
+    if(layer >= mBatchDropOutMasks.size())
+    {
+        throw std::out_of_range("Layer has no drop out");
+    }
+    return mBatchDropOutMasks[layer];
+}
+
+NetNumT* ExecutionPlan::weightGradientPartials(size_t layer)
+{
+    if(layer >= mWeightGradientPartials.size())
+    {
+        throw std::out_of_range("Layer does not exist");
+    }
+    return mWeightGradientPartials[layer];
+}
+
+size_t ExecutionPlan::numWeightGradientPartials() const
+{
+    return mNumWeightGradientPartials;
+}
+
+LayerParallelism ExecutionPlan::batchParallelism(size_t layer) const
+{
+    if(layer >= mBatchParallelism.size())
+    {
+        throw std::out_of_range("Layer does not exist");
+    }
+    return mBatchParallelism[layer];
+}
+
+LayerParallelism ExecutionPlan::backwardParallelism(size_t layer) const
+{
+    if(layer >= mBackwardParallelism.size())
+    {
+        throw std::out_of_range("Layer does not exist");
+    }
+    return mBackwardParallelism[layer];
+}
+
+LayerParallelism ExecutionPlan::sampleParallelism(size_t layer) const
+{
+    if(layer >= mSampleParallelism.size())
+    {
+        throw std::out_of_range("Layer does not exist");
+    }
+    return mSampleParallelism[layer];
+}
+
+const GemmPacking& ExecutionPlan::forwardPacking(size_t layer) const
+{
+    if(layer >= mForwardPacking.size())
+    {
+        throw std::out_of_range("Layer does not exist");
+    }
+    return mForwardPacking[layer];
+}
+
+const GemmPacking& ExecutionPlan::backwardPacking(size_t layer) const
+{
+    if(layer >= mBackwardPacking.size())
+    {
+        throw std::out_of_range("Layer does not exist");
+    }
+    return mBackwardPacking[layer];
+}
+
+const GemmPacking& ExecutionPlan::weightGradientPacking(size_t layer) const
+{
+    if(layer >= mWeightGradientPacking.size())
+    {
+        throw std::out_of_range("Layer does not exist");
+    }
+    return mWeightGradientPacking[layer];
+}
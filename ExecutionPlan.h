@@ -0,0 +1,83 @@
+//
+// Created by Lenovo on 16/06/2023.
+//
+
+#ifndef NNETWORK2_EXECUTIONPLAN_H
+#define NNETWORK2_EXECUTIONPLAN_H
+
+#include <vector>
+
+#include "NNetwork.h"
+#include "Training.h"
+#include "ParameterArena.h"
+#include "ParallelPolicy.h"
+
+using SingleRowMapT = Eigen::Map<SingleRowT, Eigen::Aligned64>;
+using BatchActivationsMapT = Eigen::Map<BatchActivationsT, Eigen::Aligned64>;
+
+// Every activation, gradient and scratch buffer a training or inference step needs, pre-sized for one network
+// topology and batch size. The buffers are views into a single workspace arena so steady state steps do not allocate.
+// addLayer / changeLayerSz change the network's topology version, after which isValidFor() fails and the plan must be rebuilt.
+class ExecutionPlan
+{
+    private:
+        size_t mTopologyVersion;
+        size_t mBatchSz;
+        AlignedParameterBuffer mWorkspace;
+
+        std::vector<BatchActivationsMapT> mBatchActivations; // [0] is the input layer, then one per layer (batchSz x layer size)
+        std::vector<BatchActivationsMapT> mBatchErrors; // per layer, derivative of the loss wrt the net inputs (batched training)
+        std::vector<BatchActivationsMapT> mBatchDropOutMasks; // per hidden layer
+        SingleRowMapT mDropOutMask; // sized for the largest layer
+        BatchActivationsMapT mBatchTargets; // batchSz x output layer size, for the fused losses
+
+        // how each layer's product is parallelised, from the active policy and Eigen::nbThreads() when built
+        std::vector<LayerParallelism> mBatchParallelism; // batchSz rows (also the weight gradients)
+        std::vector<LayerParallelism> mBackwardParallelism; // batchSz rows of errors times the transposed weights
+        std::vector<LayerParallelism> mSampleParallelism; // one row
+
+        // per layer, the other threads' weight gradients when their products are split by samples (else nullptr)
+        std::vector<NetNumT*> mWeightGradientPartials;
+        size_t mNumWeightGradientPartials = 0;
+
+        // per layer, the blocking of each batched product - they share one packing buffer per thread
+        std::vector<GemmPacking> mForwardPacking;
+        std::vector<GemmPacking> mBackwardPacking;
+        std::vector<GemmPacking> mWeightGradientPacking;
+
+        void buildWorkspace(NNetwork& network);
+
+    public:
+        ExecutionPlan(NNetwork& network, size_t batchSz);
+        // the views point into this plan's workspace
+        ExecutionPlan(const ExecutionPlan&) = delete;
+        ExecutionPlan& operator=(const ExecutionPlan&) = delete;
+        ExecutionPlan(ExecutionPlan&&) noexcept = default;
+        ExecutionPlan& operator=(ExecutionPlan&&) = delete; // Map assignment would copy values rather than rebind
+
+        // re-size every buffer for the network's current topology (keeping the batch size)
+        void rebuild(NNetwork& network);
+
+        [[nodiscard]] bool isValidFor(const NNetwork& network, size_t batchSz) const;
+        [[nodiscard]] bool isValidFor(const NNetwork& network) const;
+        [[nodiscard]] size_t batchSz() const;
+        [[nodiscard]] size_t workspaceSz() const; // in NetNumT
+
+        BatchActivationsMapT& batchInputs();
+        BatchActivationsMapT& batchOutputs(size_t layer);
+        SingleRowMapT& dropOutMask();
+        BatchActivationsMapT& batchTargets();
+        BatchActivationsMapT& batchErrors(size_t layer);
+        BatchActivationsMapT& batchDropOutMasks(size_t layer); // hidden layers only
+        NetNumT* weightGradientPartials(size_t layer); // numWeightGradientPartials() blocks the size of the layer's weights
+        [[nodiscard]] size_t numWeightGradientPartials() const;
+        [[nodiscard]] LayerParallelism batchParallelism(size_t layer) const;
+        [[nodiscard]] LayerParallelism backwardParallelism(size_t layer) const; // errors of layer - 1 from this layer's
+        [[nodiscard]] LayerParallelism sampleParallelism(size_t layer) const;
+        // packing for the batched products, so they do not allocate
+        [[nodiscard]] const GemmPacking& forwardPacking(size_t layer) const;
+        [[nodiscard]] const GemmPacking& backwardPacking(size_t layer) const; // errors of layer - 1 from this layer's
+        [[nodiscard]] const GemmPacking& weightGradientPacking(size_t layer) const;
+};
+
+#endif //NNETWORK2_EXECUTIONPLAN_H
@@ -0,0 +1,233 @@
+//
+// Created by Lenovo on 22/07/2023.
+//
+
+#include "FusedLayer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <omp.h>
+
+namespace
+{
+    using RowArrayMapT = Eigen::Map<Eigen::Array<NetNumT, 1, Eigen::Dynamic>>;
+    using ConstRowArrayMapT = Eigen::Map<const Eigen::Array<NetNumT, 1, Eigen::Dynamic>>;
+
+    constexpr Eigen::Index EPILOGUE_TILE = 512; // 2KB of floats - every step of the epilogue finds the tile in L1
+    constexpr Eigen::Index OUTPUT_TILE_ELEMENTS = 1 << 16; // outputs per single threaded product tile (256KB, within L2)
+    constexpr Eigen::Index MIN_TILE_ROWS = 64; // with fewer rows per product Eigen spends too long re-packing the weights
+
+    void checkActFunc(ActFunc actFunc)
+    {
+        if(actFunc != ActFunc::SIGMOID && actFunc != ActFunc::RELU && actFunc != ActFunc::SOFTMAX)
+        {
+            throw std::runtime_error("Unsupported activation function");
+        }
+    }
+
+    bool elementwiseEpilogue(NetNumT* outputs, const NetNumT* biases, Eigen::Index size, ActFunc actFunc, const NetNumT* dropOutMask, NetNumT dropOutScale)
+    {
+        bool finite = true;
+        for(Eigen::Index start = 0; start < size; start += EPILOGUE_TILE)
+        {
+            const Eigen::Index count = std::min(EPILOGUE_TILE, size - start);
+            RowArrayMapT tile(outputs + start, count);
+            const ConstRowArrayMapT tileBiases(biases + start, count);
+            if(dropOutMask)
+            {
+                tile = (tile + tileBiases) * (ConstRowArrayMapT(dropOutMask + start, count) * dropOutScale);
+            }
+            else
+            {
+                tile += tileBiases;
+            }
+            // checked before the activation (ReLU of NaN is not reliably NaN)
+            finite = tile.allFinite() && finite;
+            if(actFunc == ActFunc::SIGMOID)
+            {
+                tile = 1 / (1 + (-tile).exp());
+            }
+            else
+            {
+                tile = tile.max(0);
+            }
+        }
+        return finite;
+    }
+
+    // output layers are narrow so the row is one tile
+    bool softmaxEpilogue(NetNumT* outputs, const NetNumT* biases, Eigen::Index size, const NetNumT* dropOutMask, NetNumT dropOutScale)
+    {
+        RowArrayMapT row(outputs, size);
+        const ConstRowArrayMapT rowBiases(biases, size);
+        if(dropOutMask)
+        {
+            row = (row + rowBiases) * (ConstRowArrayMapT(dropOutMask, size) * dropOutScale);
+        }
+        else
+        {
+            row += rowBiases;
+        }
+        if(!row.allFinite())
+        {
+            return false;
+        }
+        // normalised e^x
+        row = (row - row.maxCoeff()).exp();
+        row /= row.sum();
+        return true;
+    }
+
+    // returns the row's loss - gradients may be nullptr
+    NetNumT softmaxCrossEntropyRow(NetNumT* outputs, const NetNumT* targets, NetNumT* gradients, Eigen::Index size)
+    {
+        RowArrayMapT row(outputs, size);
+        const ConstRowArrayMapT rowTargets(targets, size);
+        if(!row.allFinite())
+        {
+            throw std::logic_error("Output layer net inputs contain INF or NaN");
+        }
+        const NetNumT maxLogit = row.maxCoeff();
+        const NetNumT targetLogits = (rowTargets * row).sum();
+        // e^(x - max) cannot overflow and the largest is 1 so the sum cannot be 0
+        row = (row - maxLogit).exp();
+        const NetNumT sum = row.sum();
+        row *= 1 / sum;
+        if(gradients)
+        {
+            RowArrayMapT(gradients, size) = row - rowTargets;
+        }
+        // -sum(targets * log(softmax)) where log(softmax) = logits - log-sum-exp
+        return (maxLogit + std::log(sum)) * rowTargets.sum() - targetLogits;
+    }
+
+    NetNumT softmaxCrossEntropyRows(Eigen::Ref<BatchActivationsT>& outputs, const Eigen::Ref<const BatchActivationsT>& targets, Eigen::Ref<BatchActivationsT>* gradients)
+    {
+        if(outputs.rows() != targets.rows() || outputs.cols() != targets.cols() ||
+           (gradients && (gradients->rows() != outputs.rows() || gradients->cols() != outputs.cols())))
+        {
+            throw std::logic_error("Outputs and targets do not match");
+        }
+        NetNumT loss = 0;
+        for(Eigen::Index row = 0; row < outputs.rows(); ++row)
+        {
+            loss += softmaxCrossEntropyRow(outputs.row(row).data(), targets.row(row).data(), gradients ? gradients->row(row).data() : nullptr, outputs.cols());
+        }
+        return loss;
+    }
+
+    bool rowEpilogue(NetNumT* outputs, const NetNumT* biases, Eigen::Index size, ActFunc actFunc, const NetNumT* dropOutMask, NetNumT dropOutScale)
+    {
+        return actFunc == ActFunc::SOFTMAX ? softmaxEpilogue(outputs, biases, size, dropOutMask, dropOutScale)
+                                           : elementwiseEpilogue(outputs, biases, size, actFunc, dropOutMask, dropOutScale);
+    }
+}
+
+bool fusedLayerEpilogue(Eigen::Ref<SingleRowT> outputs, const Eigen::Ref<const SingleRowT>& biases, ActFunc actFunc, const NetNumT* dropOutMask, NetNumT dropOutScale)
+{
+    if(outputs.size() < 1 || outputs.size() != biases.size())
+    {
+        throw std::logic_error("Layer outputs and biases do not match");
+    }
+    checkActFunc(actFunc);
+    return rowEpilogue(outputs.data(), biases.data(), outputs.size(), actFunc, dropOutMask, dropOutScale);
+}
+
+bool fusedBatchEpilogue(Eigen::Ref<BatchActivationsT> outputs, const Eigen::Ref<const SingleRowT>& biases, ActFunc actFunc)
+{
+    if(outputs.cols() != biases.size())
+    {
+        throw std::logic_error("Layer outputs and biases do not match");
+    }
+    checkActFunc(actFunc);
+    bool finite = true;
+    for(Eigen::Index row = 0; row < outputs.rows(); ++row)
+    {
+        finite = rowEpilogue(outputs.row(row).data(), biases.data(), outputs.cols(), actFunc, nullptr, 1) && finite;
+    }
+    return finite;
+}
+
+bool fusedLayerForward(const Eigen::Ref<const BatchActivationsT>& inputs, const Eigen::Ref<const LayerWeightsT>& weights,
+                       const Eigen::Ref<const SingleRowT>& biases, ActFunc actFunc, Eigen::Ref<BatchActivationsT> outputs,
+                       LayerParallelism parallelism, const NetNumT* dropOutMasks, NetNumT dropOutScale, const GemmPacking* packing)
+{
+    const Eigen::Index rows = inputs.rows(), neurons = weights.cols();
+    if(inputs.cols() != weights.rows() || biases.size() != neurons || outputs.rows() != rows || outputs.cols() != neurons)
+    {
+        throw std::logic_error("Layer dimensions do not match");
+    }
+    checkActFunc(actFunc); // nothing may throw inside the parallel regions
+    const int threads = packing ? std::min(Eigen::nbThreads(), packing->threads) : Eigen::nbThreads();
+    bool finite = true;
+    auto rowMask = [&](Eigen::Index row, Eigen::Index firstNeuron) -> const NetNumT*
+    {
+        return dropOutMasks ? dropOutMasks + row * neurons + firstNeuron : nullptr;
+    };
+
+    // inside the parallel regions Eigen sees a team already running so each product stays single threaded
+    if(parallelism == LayerParallelism::SAMPLES && threads > 1 && rows > 1)
+    {
+#pragma omp parallel num_threads(threads) reduction(&&:finite)
+        {
+            const auto [start, count] = splitRange(rows, omp_get_thread_num(), omp_get_num_threads());
+            if(count > 0)
+            {
+                auto block = outputs.middleRows(start, count);
+                multiplyLayerBlock(inputs.middleRows(start, count), weights, block, packing, omp_get_thread_num());
+                for(Eigen::Index row = 0; row < count; ++row)
+                {
+                    finite = rowEpilogue(block.row(row).data(), biases.data(), neurons, actFunc, rowMask(start + row, 0), dropOutScale) && finite;
+                }
+            }
+        }
+        return finite;
+    }
+    if(parallelism == LayerParallelism::COLUMNS && threads > 1 && neurons > 1)
+    {
+        const bool elementwise = actFunc != ActFunc::SOFTMAX;
+#pragma omp parallel num_threads(threads) reduction(&&:finite)
+        {
+            const auto [start, count] = splitRange(neurons, omp_get_thread_num(), omp_get_num_threads(), ParallelismPolicy::MIN_COLUMNS_PER_THREAD);
+            if(count > 0)
+            {
+                auto block = outputs.middleCols(start, count);
+                multiplyLayerBlock(inputs, weights.middleCols(start, count), block, packing, omp_get_thread_num());
+                for(Eigen::Index row = 0; elementwise && row < rows; ++row)
+                {
+                    finite = elementwiseEpilogue(block.row(row).data(), biases.data() + start, count, actFunc, rowMask(row, start), dropOutScale) && finite;
+                }
+            }
+        }
+        // softmax needs whole rows
+        for(Eigen::Index row = 0; !elementwise && row < rows; ++row)
+        {
+            finite = softmaxEpilogue(outputs.row(row).data(), biases.data(), neurons, rowMask(row, 0), dropOutScale) && finite;
+        }
+        return finite;
+    }
+    const Eigen::Index tileRows = std::max(MIN_TILE_ROWS, OUTPUT_TILE_ELEMENTS / std::max<Eigen::Index>(1, neurons));
+    for(Eigen::Index start = 0; start < rows; start += tileRows)
+    {
+        const Eigen::Index count = std::min(tileRows, rows - start);
+        auto block = outputs.middleRows(start, count);
+        multiplyLayerBlock(inputs.middleRows(start, count), weights, block, packing, 0);
+        for(Eigen::Index row = 0; row < count; ++row)
+        {
+            finite = rowEpilogue(block.row(row).data(), biases.data(), neurons, actFunc, rowMask(start + row, 0), dropOutScale) && finite;
+        }
+    }
+    return finite;
+}
+
+NetNumT fusedSoftmaxCrossEntropy(Eigen::Ref<BatchActivationsT> outputs, const Eigen::Ref<const BatchActivationsT>& targets,
+                                 Eigen::Ref<BatchActivationsT> gradients)
+{
+    return softmaxCrossEntropyRows(outputs, targets, &gradients);
+}
+
+NetNumT fusedSoftmaxCrossEntropy(Eigen::Ref<BatchActivationsT> outputs, const Eigen::Ref<const BatchActivationsT>& targets)
+{
+    return softmaxCrossEntropyRows(outputs, targets, nullptr);
+}
@@ -0,0 +1,38 @@
+//
+// Created by Lenovo on 22/07/2023.
+//
+
+#ifndef NNETWORK2_FUSEDLAYER_H
+#define NNETWORK2_FUSEDLAYER_H
+
+#include "NNetwork.h"
+#include "ParallelPolicy.h"
+
+// The work after a layer's product, fused: outputs = act((outputs + biases) * dropOutMask * dropOutScale).
+// Instead of a pass over the whole layer for each step (bias, drop out, scaling, activation, INF / NaN check) every step
+// runs on one small tile of outputs at a time, so each tile is loaded once and finished while it is in L1. Sigmoid and ReLU
+// are element-wise (vectorised by Eigen), softmax is per row. dropOutMask may be nullptr.
+// Returns false if any output is INF or NaN
+bool fusedLayerEpilogue(Eigen::Ref<SingleRowT> outputs, const Eigen::Ref<const SingleRowT>& biases, ActFunc actFunc,
+                        const NetNumT* dropOutMask = nullptr, NetNumT dropOutScale = 1);
+// every row of a batch (no drop out)
+bool fusedBatchEpilogue(Eigen::Ref<BatchActivationsT> outputs, const Eigen::Ref<const SingleRowT>& biases, ActFunc actFunc);
+
+// outputs = act(inputs * weights + biases) with the product parallelised as decided. Each thread finishes its own block
+// of outputs straight after computing it, and single threaded products run in tiles of rows for the same reason.
+// dropOutMasks (may be nullptr) holds one row major mask row per output row. packing as for multiplyLayer
+bool fusedLayerForward(const Eigen::Ref<const BatchActivationsT>& inputs, const Eigen::Ref<const LayerWeightsT>& weights,
+                       const Eigen::Ref<const SingleRowT>& biases, ActFunc actFunc, Eigen::Ref<BatchActivationsT> outputs,
+                       LayerParallelism parallelism, const NetNumT* dropOutMasks = nullptr, NetNumT dropOutScale = 1,
+                       const GemmPacking* packing = nullptr);
+
+// Softmax and cross entropy loss fused for output layers, on the net inputs (logits) rather than the probabilities. Each row
+// takes one numerically stable pass: log-sum-exp, then the probabilities (written over the logits), the loss
+// (log-sum-exp - targets . logits) and its gradient wrt the net inputs (probabilities - targets). No log of every output and
+// no epsilon to avoid log(0). Returns the loss summed over the rows
+NetNumT fusedSoftmaxCrossEntropy(Eigen::Ref<BatchActivationsT> outputs, const Eigen::Ref<const BatchActivationsT>& targets,
+                                 Eigen::Ref<BatchActivationsT> gradients);
+// the loss only (evaluation)
+NetNumT fusedSoftmaxCrossEntropy(Eigen::Ref<BatchActivationsT> outputs, const Eigen::Ref<const BatchActivationsT>& targets);
+
+#endif //NNETWORK2_FUSEDLAYER_H
@@ -0,0 +1,377 @@
+//
+// Created by Lenovo on 11/07/2023.
+//
+
+#include "HyperparameterSweep.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "BatchSource.h"
+#include "ThreadConfig.h"
+
+namespace
+{
+    struct Trial
+    {
+        std::unique_ptr<NNetwork> network;
+        // momentum state carried from rung to rung
+        std::unique_ptr<NetworkWeightGradients> prevWeightDelta;
+        std::unique_ptr<NetworkLayerGradients> prevBiasDelta;
+        ActFuncList actFuncs;
+        LearningRateList lrList;
+        bool stoppedEarly = false; // no more training after this
+        TrialResult result;
+
+        // finished with
+        void release()
+        {
+            network.reset();
+            prevWeightDelta.reset();
+            prevBiasDelta.reset();
+        }
+    };
+
+    bool isLossMetric(StoppingMetric metric)
+    {
+        return metric == StoppingMetric::TEST_LOSS || metric == StoppingMetric::TRAINING_LOSS;
+    }
+
+    bool isBetter(StoppingMetric metric, NetNumT value, NetNumT other)
+    {
+        return isLossMetric(metric) ? value < other : value > other;
+    }
+
+    // calls work(0) ... work(count - 1) spread over threads, rethrowing the first exception once all have finished.
+    // when pinning, each worker gets its own slice of cpusPerWorker cpus (one per GEMM thread it runs)
+    void runConcurrently(size_t count, size_t threads, size_t cpusPerWorker, const std::function<void(size_t)>& work)
+    {
+        std::atomic<size_t> next{0};
+        std::mutex errorMutex;
+        std::exception_ptr error;
+        const auto worker = [&]()
+        {
+            for(size_t index = next++; index < count; index = next++)
+            {
+                try
+                {
+                    work(index);
+                }
+                catch(...)
+                {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if(!error)
+                    {
+                        error = std::current_exception();
+                    }
+                }
+            }
+        };
+        const size_t numWorkers = std::min(threads, count);
+        if(numWorkers <= 1)
+        {
+            worker(); // this thread keeps the pinning (and OpenMP threads) the thread config gave it
+        }
+        else
+        {
+            // every worker is a fresh thread so this one's affinity is left alone
+            std::vector<std::thread> workers;
+            for(size_t thread = 0; thread < numWorkers; ++thread)
+            {
+                workers.emplace_back([&, thread]()
+                {
+                    pinCurrentThreadToWorkerCpus(thread, cpusPerWorker);
+                    worker();
+                });
+            }
+            for(std::thread& workerThread : workers)
+            {
+                workerThread.join();
+            }
+        }
+        if(error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // concurrent trials share the thread budget between them
+    class EigenThreadLimit
+    {
+        private:
+            int mPrevThreads;
+
+        public:
+            explicit EigenThreadLimit(int threads) : mPrevThreads(Eigen::nbThreads())
+            {
+                Eigen::setNbThreads(threads);
+            }
+            ~EigenThreadLimit()
+            {
+                Eigen::setNbThreads(mPrevThreads);
+            }
+            EigenThreadLimit(const EigenThreadLimit&) = delete;
+            EigenThreadLimit& operator=(const EigenThreadLimit&) = delete;
+    };
+}
+
+std::string TrialConfig::describe() const
+{
+    std::ostringstream description;
+    description << "lr " << learningRate << ", batch " << batchSz << ", layers ";
+    for(size_t layerPos = 0; layerPos < hiddenLayerSizes.size(); ++layerPos)
+    {
+        description << (layerPos > 0 ? "-" : "") << hiddenLayerSizes[layerPos];
+    }
+    description << ", drop out " << dropOutRate << ", momentum " << momentum;
+    return description.str();
+}
+
+size_t SearchSpace::numCombinations() const
+{
+    return learningRates.size() * batchSizes.size() * hiddenLayerSizes.size() * dropOutRates.size() * momentums.size();
+}
+
+TrialConfig SearchSpace::combination(size_t index) const
+{
+    if(index >= numCombinations())
+    {
+        throw std::out_of_range("Combination does not exist");
+    }
+    // mixed radix - the last hyperparameter varies fastest
+    TrialConfig config;
+    config.momentum = momentums[index % momentums.size()];
+    index /= momentums.size();
+    config.dropOutRate = dropOutRates[index % dropOutRates.size()];
+    index /= dropOutRates.size();
+    config.hiddenLayerSizes = hiddenLayerSizes[index % hiddenLayerSizes.size()];
+    index /= hiddenLayerSizes.size();
+    config.batchSz = batchSizes[index % batchSizes.size()];
+    index /= batchSizes.size();
+    config.learningRate = learningRates[index];
+    return config;
+}
+
+//***********//
+
+SweepRunner::SweepRunner(const ExampleData& trainingData, const ExampleData& validationData) :
+    mTrainingData(trainingData),
+    mValidationData(validationData)
+{
+    if(mTrainingData.empty() || mValidationData.empty())
+    {
+        throw std::logic_error("Sweep needs training and validation data");
+    }
+}
+
+std::vector<TrialResult> SweepRunner::run(const SearchSpace& space, const SweepOptions& options) const
+{
+    if(space.numCombinations() == 0)
+    {
+        throw std::logic_error("Search space is empty");
+    }
+    if(options.strategy == SweepStrategy::SUCCESSIVE_HALVING && (options.reductionFactor < 2 || options.minEpochs == 0))
+    {
+        throw std::logic_error("Successive halving needs a reduction factor of at least 2 and a first rung of at least one epoch");
+    }
+
+    // pick the configurations
+    std::vector<size_t> combinations(space.numCombinations());
+    std::iota(combinations.begin(), combinations.end(), 0);
+    if(options.strategy != SweepStrategy::GRID)
+    {
+        std::mt19937 generator(options.seed);
+        std::shuffle(combinations.begin(), combinations.end(), generator);
+        combinations.resize(std::min(options.numTrials, combinations.size()));
+    }
+    std::vector<Trial> trials(combinations.size());
+    for(size_t trialPos = 0; trialPos < trials.size(); ++trialPos)
+    {
+        trials[trialPos].result.trial = trialPos;
+        trials[trialPos].result.config = space.combination(combinations[trialPos]);
+    }
+
+    // by default every thread in the budget runs its own trial
+    const size_t budget = activeThreadConfig().threads;
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+    // the Eigen malloc check is one process wide flag that each trial's training phases toggle
+    if(options.concurrentTrials > 1)
+    {
+        throw std::logic_error("Trials can't run concurrently with the Eigen malloc check (NNETWORK_CHECK_EIGEN_MALLOC)");
+    }
+    const size_t threads = 1;
+#else
+    const size_t threads = options.concurrentTrials > 0 ? options.concurrentTrials : budget;
+#endif
+    const size_t gemmThreadsPerTrial = std::max<size_t>(1, budget / threads);
+    std::optional<EigenThreadLimit> eigenThreadLimit;
+    if(threads > 1)
+    {
+        eigenThreadLimit.emplace(static_cast<int> (gemmThreadsPerTrial));
+    }
+
+    // trains a trial until it has run targetEpochs (from where it left off) then evaluates it
+    const auto trainTrial = [&](Trial& trial, size_t targetEpochs)
+    {
+        TrialResult& result = trial.result;
+        const TrialConfig& config = result.config;
+        if(trial.stoppedEarly || result.epochsRun >= targetEpochs)
+        {
+            return;
+        }
+        const bool initialise = !trial.network;
+        if(initialise)
+        {
+            trial.network = std::make_unique<NNetwork>(static_cast<size_t> (mTrainingData.front().inputs.size()), getClasses());
+            for(size_t layerPos = 0; layerPos < config.hiddenLayerSizes.size(); ++layerPos)
+            {
+                trial.network->addLayer(config.hiddenLayerSizes[layerPos], layerPos);
+            }
+            trial.actFuncs.assign(trial.network->numLayers(), options.hiddenActFunc);
+            trial.actFuncs.back() = options.lossFunc == LossFunc::CROSS_ENTROPY ? ActFunc::SOFTMAX : options.hiddenActFunc;
+            trial.lrList.assign(trial.network->numLayers(), config.learningRate);
+            initialiseWeightsBiases(*trial.network, options.initMethod);
+            trial.prevWeightDelta = std::make_unique<NetworkWeightGradients>(*trial.network);
+            trial.prevBiasDelta = std::make_unique<NetworkLayerGradients>(*trial.network);
+        }
+
+        // each trial (and each rung) sees its own shuffle order over the shared data
+        ExampleDataSource trainingSource(mTrainingData, Sampler(SamplingMethod::SHUFFLE, options.seed + static_cast<unsigned int> (result.trial * 1009 + result.epochsRun)));
+        ExampleDataSource validationSource(mValidationData, false);
+        TrainingOptions trainingOptions;
+        trainingOptions.consoleOutput = false;
+        trainingOptions.schedule = options.schedule;
+        trainingOptions.scheduleEpochs = options.epochs; // one schedule over every rung
+        trainingOptions.earlyStopping = options.earlyStopping;
+        trainingOptions.evaluateEveryNEpochs = options.earlyStopping.patience > 0 ? 1 : 0;
+        trainingOptions.evaluateTrainingData = options.earlyStopping.metric == StoppingMetric::TRAINING_LOSS || options.earlyStopping.metric == StoppingMetric::TRAINING_ACCURACY;
+
+        const auto start = std::chrono::steady_clock::now();
+        const TrainingResult trainingResult = continueTraining(*trial.network, trainingSource, trial.actFuncs, options.lossFunc, trial.lrList, config.momentum,
+                                                               result.epochsRun, targetEpochs, config.batchSz, validationSource, config.dropOutRate,
+                                                               *trial.prevWeightDelta, *trial.prevBiasDelta, trainingOptions);
+        result.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.epochsRun = trainingResult.epochsRun;
+        trial.stoppedEarly = trainingResult.stoppedEarly;
+
+        result.validationLoss = calculateLossForBatchSource(*trial.network, validationSource, trial.actFuncs, options.lossFunc);
+        result.validationAccuracy = calculateAccuracyForBatchSource(*trial.network, validationSource, trial.actFuncs);
+        switch (options.metric)
+        {
+            case StoppingMetric::TEST_LOSS: result.metric = result.validationLoss; break;
+            case StoppingMetric::TEST_ACCURACY: result.metric = result.validationAccuracy; break;
+            case StoppingMetric::TRAINING_LOSS: result.metric = calculateLossForBatchSource(*trial.network, trainingSource, trial.actFuncs, options.lossFunc); break;
+            case StoppingMetric::TRAINING_ACCURACY: result.metric = calculateAccuracyForBatchSource(*trial.network, trainingSource, trial.actFuncs); break;
+        }
+    };
+
+    if(options.strategy != SweepStrategy::SUCCESSIVE_HALVING)
+    {
+        runConcurrently(trials.size(), threads, gemmThreadsPerTrial, [&](size_t trialPos)
+        {
+            trainTrial(trials[trialPos], options.epochs);
+            trials[trialPos].result.completed = true;
+            trials[trialPos].release();
+        });
+    }
+    else
+    {
+        std::vector<Trial*> active;
+        for(Trial& trial : trials)
+        {
+            active.push_back(&trial);
+        }
+        for(size_t rungEpochs = options.minEpochs; ; rungEpochs *= options.reductionFactor)
+        {
+            const size_t targetEpochs = std::min(rungEpochs, options.epochs);
+            runConcurrently(active.size(), threads, gemmThreadsPerTrial, [&](size_t activePos){ trainTrial(*active[activePos], targetEpochs); });
+            if(targetEpochs >= options.epochs || active.size() <= 1)
+            {
+                break;
+            }
+            // drop all but the best 1 / reductionFactor
+            std::sort(active.begin(), active.end(), [&](const Trial* lhs, const Trial* rhs)
+            {
+                return isBetter(options.metric, lhs->result.metric, rhs->result.metric);
+            });
+            const size_t survivors = std::max<size_t>(1, active.size() / options.reductionFactor);
+            for(size_t activePos = survivors; activePos < active.size(); ++activePos)
+            {
+                active[activePos]->release();
+            }
+            active.resize(survivors);
+        }
+        for(Trial* trial : active)
+        {
+            trial->result.completed = true;
+            trial->release();
+        }
+    }
+
+    std::vector<TrialResult> results;
+    for(const Trial& trial : trials)
+    {
+        results.push_back(trial.result);
+    }
+    // trials that ran to the end first, then by the metric
+    std::stable_sort(results.begin(), results.end(), [&](const TrialResult& lhs, const TrialResult& rhs)
+    {
+        if(lhs.completed != rhs.completed)
+        {
+            return lhs.completed;
+        }
+        return isBetter(options.metric, lhs.metric, rhs.metric);
+    });
+    return results;
+}
+
+//***********//
+
+std::ostream& printSweepResults(std::ostream& out, const std::vector<TrialResult>& results)
+{
+    const std::streamsize prevPrecision = out.precision();
+    const std::ios_base::fmtflags prevFlags = out.flags();
+    out << std::fixed << std::setprecision(4);
+    for(const TrialResult& result : results)
+    {
+        out << "Trial " << result.trial << " (" << result.config.describe() << "): " << result.epochsRun << " epochs"
+            << (result.completed ? "" : " (dropped)") << ", loss " << result.validationLoss << ", accuracy " << result.validationAccuracy
+            << "%, " << std::setprecision(1) << result.seconds << " s" << std::setprecision(4) << std::endl;
+    }
+    out.precision(prevPrecision);
+    out.flags(prevFlags);
+    return out;
+}
+
+void writeSweepResultsCsv(const std::string& fName, const std::vector<TrialResult>& results)
+{
+    std::ofstream fileOut(fName);
+    if(!fileOut)
+    {
+        throw std::runtime_error("Could not open sweep results file " + fName);
+    }
+    fileOut << "trial,learning_rate,batch_size,hidden_layers,drop_out,momentum,epochs,completed,validation_loss,validation_accuracy,metric,seconds\n";
+    for(const TrialResult& result : results)
+    {
+        const TrialConfig& config = result.config;
+        fileOut << result.trial << "," << config.learningRate << "," << config.batchSz << ",";
+        for(size_t layerPos = 0; layerPos < config.hiddenLayerSizes.size(); ++layerPos)
+        {
+            fileOut << (layerPos > 0 ? "-" : "") << config.hiddenLayerSizes[layerPos];
+        }
+        fileOut << "," << config.dropOutRate << "," << config.momentum << "," << result.epochsRun << "," << result.completed << ","
+                << result.validationLoss << "," << result.validationAccuracy << "," << result.metric << "," << result.seconds << "\n";
+    }
+}
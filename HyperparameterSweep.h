@@ -0,0 +1,98 @@
+//
+// Created by Lenovo on 11/07/2023.
+//
+
+#ifndef NNETWORK2_HYPERPARAMETERSWEEP_H
+#define NNETWORK2_HYPERPARAMETERSWEEP_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Training.h"
+#include "Data.h"
+
+// Runs many training runs (trials) concurrently over one copy of the data. The training and validation data are
+// shared read-only - each trial only owns its network and its shuffle order.
+// While trials run concurrently Eigen is limited to one thread (the setting is restored afterwards).
+
+// the hyperparameters of one trial
+struct TrialConfig
+{
+    NetNumT learningRate = 0.01f; // for every layer
+    size_t batchSz = 16;
+    std::vector<size_t> hiddenLayerSizes;
+    NetNumT dropOutRate = 0;
+    NetNumT momentum = 0;
+
+    [[nodiscard]] std::string describe() const;
+};
+
+// the values to try for each hyperparameter
+struct SearchSpace
+{
+    std::vector<NetNumT> learningRates = {0.01f};
+    std::vector<size_t> batchSizes = {16};
+    std::vector<std::vector<size_t>> hiddenLayerSizes = {{128, 64}};
+    std::vector<NetNumT> dropOutRates = {0};
+    std::vector<NetNumT> momentums = {0};
+
+    [[nodiscard]] size_t numCombinations() const;
+    // index in [0, numCombinations())
+    [[nodiscard]] TrialConfig combination(size_t index) const;
+};
+
+enum class SweepStrategy
+{
+        GRID, // every combination
+        RANDOM, // numTrials combinations drawn at random
+        SUCCESSIVE_HALVING // numTrials random combinations, the worst dropped after each rung of training
+};
+
+struct SweepOptions
+{
+    SweepStrategy strategy = SweepStrategy::GRID;
+    size_t numTrials = 16; // for RANDOM and SUCCESSIVE_HALVING
+    unsigned int seed = 12345;
+    size_t epochs = 10; // per trial (for successive halving, what the surviving trials end up with)
+    size_t minEpochs = 1; // successive halving: the first rung
+    size_t reductionFactor = 3; // successive halving: keep the best 1 / reductionFactor after each rung, whose budget grows by the same factor
+    size_t concurrentTrials = 0; // 0 for one per thread of the active ThreadConfig (1, and no more, with NNETWORK_CHECK_EIGEN_MALLOC)
+    StoppingMetric metric = StoppingMetric::TEST_ACCURACY; // ranks trials ("test" is the validation data)
+    ActFunc hiddenActFunc = ActFunc::RELU;
+    InitMethod initMethod = InitMethod::UNIFORM_HE;
+    LossFunc lossFunc = LossFunc::CROSS_ENTROPY;
+    LearningRateSchedule schedule; // over epochs - successive halving trials continue it (and their momentum) from rung to rung
+    EarlyStoppingOptions earlyStopping;
+};
+
+struct TrialResult
+{
+    size_t trial = 0;
+    TrialConfig config;
+    size_t epochsRun = 0;
+    bool completed = false; // false if successive halving dropped it
+    NetNumT validationLoss = 0;
+    NetNumT validationAccuracy = 0;
+    NetNumT metric = 0; // the ranking metric
+    double seconds = 0; // training time
+};
+
+class SweepRunner
+{
+    private:
+        const ExampleData& mTrainingData;
+        const ExampleData& mValidationData;
+
+    public:
+        // the data must outlive the runner and not change while a sweep runs
+        SweepRunner(const ExampleData& trainingData, const ExampleData& validationData);
+
+        // results best first
+        std::vector<TrialResult> run(const SearchSpace& space, const SweepOptions& options) const;
+};
+
+std::ostream& printSweepResults(std::ostream& out, const std::vector<TrialResult>& results);
+void writeSweepResultsCsv(const std::string& fName, const std::vector<TrialResult>& results);
+
+#endif //NNETWORK2_HYPERPARAMETERSWEEP_H
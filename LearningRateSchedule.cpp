@@ -0,0 +1,112 @@
+//
+// Created by Lenovo on 07/07/2023.
+//
+
+#include "LearningRateSchedule.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// from 1 at progress 0 to minFactor at progress 1
+static double cosineAnneal(double progress, double minFactor)
+{
+    progress = std::clamp(progress, 0.0, 1.0);
+    return minFactor + (1 - minFactor) * 0.5 * (1 + std::cos(M_PI * progress));
+}
+
+LearningRateSchedule LearningRateSchedule::step(size_t everyNEpochs, double factor)
+{
+    if(everyNEpochs == 0 || factor <= 0)
+    {
+        throw std::logic_error("Step schedule needs a positive interval and factor");
+    }
+    LearningRateSchedule schedule;
+    schedule.mType = Type::STEP;
+    schedule.mStepEveryNEpochs = everyNEpochs;
+    schedule.mStepFactor = factor;
+    return schedule;
+}
+
+LearningRateSchedule LearningRateSchedule::cosine(double minFactor)
+{
+    if(minFactor < 0 || minFactor > 1)
+    {
+        throw std::logic_error("Cosine schedule minimum factor must be in [0, 1]");
+    }
+    LearningRateSchedule schedule;
+    schedule.mType = Type::COSINE;
+    schedule.mMinFactor = minFactor;
+    return schedule;
+}
+
+LearningRateSchedule LearningRateSchedule::oneCycle(double startFactor, double peakFraction, double minFactor)
+{
+    if(startFactor <= 0 || startFactor > 1 || peakFraction <= 0 || peakFraction >= 1 || minFactor < 0 || minFactor > 1)
+    {
+        throw std::logic_error("Invalid one cycle schedule");
+    }
+    LearningRateSchedule schedule;
+    schedule.mType = Type::ONE_CYCLE;
+    schedule.mStartFactor = startFactor;
+    schedule.mPeakFraction = peakFraction;
+    schedule.mMinFactor = minFactor;
+    return schedule;
+}
+
+LearningRateSchedule& LearningRateSchedule::withWarmup(size_t steps, double startFactor)
+{
+    if(startFactor < 0 || startFactor > 1)
+    {
+        throw std::logic_error("Warmup start factor must be in [0, 1]");
+    }
+    mWarmupSteps = steps;
+    mWarmupStartFactor = startFactor;
+    return *this;
+}
+
+LearningRateSchedule::Type LearningRateSchedule::type() const
+{
+    return mType;
+}
+
+bool LearningRateSchedule::isConstant() const
+{
+    return mType == Type::CONSTANT && mWarmupSteps == 0;
+}
+
+size_t LearningRateSchedule::warmupSteps() const
+{
+    return mWarmupSteps;
+}
+
+bool LearningRateSchedule::needsRunLength() const
+{
+    return mType == Type::COSINE || mType == Type::ONE_CYCLE;
+}
+
+double LearningRateSchedule::factor(size_t step, size_t epoch, size_t totalSteps) const
+{
+    const double progress = totalSteps > 1 ? static_cast<double> (step) / static_cast<double> (totalSteps - 1) : 0;
+    double scheduleFactor = 1;
+    switch (mType)
+    {
+        case Type::CONSTANT:
+            break;
+        case Type::STEP:
+            scheduleFactor = std::pow(mStepFactor, static_cast<double> (epoch / mStepEveryNEpochs));
+            break;
+        case Type::COSINE:
+            scheduleFactor = cosineAnneal(progress, mMinFactor);
+            break;
+        case Type::ONE_CYCLE:
+            scheduleFactor = progress < mPeakFraction ? mStartFactor + (1 - mStartFactor) * progress / mPeakFraction
+                                                      : cosineAnneal((progress - mPeakFraction) / (1 - mPeakFraction), mMinFactor);
+            break;
+    }
+    if(step < mWarmupSteps)
+    {
+        scheduleFactor *= mWarmupStartFactor + (1 - mWarmupStartFactor) * static_cast<double> (step + 1) / static_cast<double> (mWarmupSteps);
+    }
+    return scheduleFactor;
+}
@@ -0,0 +1,52 @@
+//
+// Created by Lenovo on 07/07/2023.
+//
+
+#ifndef NNETWORK2_LEARNINGRATESCHEDULE_H
+#define NNETWORK2_LEARNINGRATESCHEDULE_H
+
+#include <cstddef>
+
+// Scales every layer's learning rate (from the LearningRateList) by a factor that depends only on the position in
+// training, so resuming from a checkpoint picks the schedule up where it left off.
+// Positions are counted in batches ("steps"); step schedules change every N epochs.
+class LearningRateSchedule
+{
+    public:
+        enum class Type
+        {
+                CONSTANT,
+                STEP, // multiply by stepFactor every stepEveryNEpochs epochs
+                COSINE, // anneal from 1 to minFactor over the run
+                ONE_CYCLE // rise linearly from startFactor to 1 over the first peakFraction of the run, then cosine anneal to minFactor
+        };
+
+    private:
+        Type mType = Type::CONSTANT;
+        size_t mStepEveryNEpochs = 0;
+        double mStepFactor = 1;
+        double mStartFactor = 1;
+        double mPeakFraction = 0;
+        double mMinFactor = 0;
+        size_t mWarmupSteps = 0;
+        double mWarmupStartFactor = 0;
+
+    public:
+        LearningRateSchedule() = default; // constant
+
+        static LearningRateSchedule step(size_t everyNEpochs, double factor);
+        static LearningRateSchedule cosine(double minFactor = 0);
+        static LearningRateSchedule oneCycle(double startFactor = 0.04, double peakFraction = 0.3, double minFactor = 0);
+        // ramps linearly from startFactor over the first steps, on top of the schedule
+        LearningRateSchedule& withWarmup(size_t steps, double startFactor = 0);
+
+        [[nodiscard]] Type type() const;
+        [[nodiscard]] bool isConstant() const;
+        [[nodiscard]] size_t warmupSteps() const;
+        // COSINE and ONE_CYCLE depend on the length of the run in steps
+        [[nodiscard]] bool needsRunLength() const;
+        // the factor for a batch of the given epoch - step counts batches from 0 over the whole run of totalSteps
+        [[nodiscard]] double factor(size_t step, size_t epoch, size_t totalSteps) const;
+};
+
+#endif //NNETWORK2_LEARNINGRATESCHEDULE_H
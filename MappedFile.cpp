@@ -0,0 +1,75 @@
+//
+// Created by Lenovo on 09/08/2023.
+//
+
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+#include "MappedFile.h"
+
+MappedFile::MappedFile(const std::string& fName)
+{
+    const int fileDescriptor = open(fName.c_str(), O_RDONLY);
+    if(fileDescriptor < 0)
+    {
+        throw std::logic_error("Could not open file");
+    }
+    struct stat fileStats{};
+    if(fstat(fileDescriptor, &fileStats) != 0)
+    {
+        close(fileDescriptor);
+        throw std::runtime_error("Could not stat file");
+    }
+    mSize = static_cast<size_t>(fileStats.st_size);
+    if(mSize > 0)
+    {
+        void* mapping = mmap(nullptr, mSize, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+        if(mapping == MAP_FAILED)
+        {
+            close(fileDescriptor);
+            throw std::runtime_error("Could not map file");
+        }
+        mData = static_cast<const char*>(mapping);
+    }
+    close(fileDescriptor); // the mapping stays valid after the descriptor is closed
+}
+
+MappedFile::~MappedFile()
+{
+    if(mData != nullptr)
+    {
+        munmap(const_cast<char*>(mData), mSize);
+    }
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept : mData(std::exchange(other.mData, nullptr)), mSize(std::exchange(other.mSize, 0))
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if(this != &other)
+    {
+        if(mData != nullptr)
+        {
+            munmap(const_cast<char*>(mData), mSize);
+        }
+        mData = std::exchange(other.mData, nullptr);
+        mSize = std::exchange(other.mSize, 0);
+    }
+    return *this;
+}
+
+const char* MappedFile::data() const
+{
+    return mData;
+}
+
+size_t MappedFile::size() const
+{
+    return mSize;
+}
@@ -0,0 +1,31 @@
+//
+// Created by Lenovo on 09/08/2023.
+//
+
+#ifndef NNETWORK2_MAPPEDFILE_H
+#define NNETWORK2_MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+// read only memory mapping of a whole file (unmapped on destruction)
+class MappedFile
+{
+    private:
+        const char* mData = nullptr;
+        size_t mSize = 0;
+
+    public:
+        explicit MappedFile(const std::string& fName);
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile(MappedFile&& other) noexcept;
+        MappedFile& operator=(MappedFile&& other) noexcept;
+
+        [[nodiscard]] const char* data() const;
+        [[nodiscard]] size_t size() const;
+};
+
+#endif //NNETWORK2_MAPPEDFILE_H
@@ -0,0 +1,423 @@
+//
+// Created by Lenovo on 03/07/2023.
+//
+
+#include "Metrics.h"
+#include "ThreadConfig.h"
+#include "Trace.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+// SINK
+
+MetricsSink::MetricsSink(std::unique_ptr<MetricsWriter> writer, size_t batchInterval) :
+    mWriter(std::move(writer)),
+    mBatchInterval(batchInterval)
+{
+    if(!mWriter)
+    {
+        throw std::logic_error("Metrics sink needs a writer");
+    }
+    mThread = std::thread(&MetricsSink::writeLoop, this);
+}
+
+MetricsSink::~MetricsSink()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mRecordsReady.notify_one();
+    mThread.join();
+}
+
+void MetricsSink::push(Record record)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRecords.push_back(std::move(record));
+    }
+    mRecordsReady.notify_one();
+}
+
+void MetricsSink::onBatchEnd(const BatchMetrics& metrics)
+{
+    if(mBatchInterval > 0 && metrics.batch % mBatchInterval == 0)
+    {
+        push(metrics);
+    }
+}
+
+void MetricsSink::onEpochEnd(const EpochMetrics& metrics)
+{
+    push(metrics);
+}
+
+void MetricsSink::onEvaluation(const EvaluationMetrics& metrics)
+{
+    push(metrics);
+}
+
+void MetricsSink::flush()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDrained.wait(lock, [this]{ return mRecords.empty() && !mWriting; });
+}
+
+void MetricsSink::writeLoop()
+{
+    setTraceThreadName("metrics sink");
+    unpinCurrentThread();
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(true)
+    {
+        mRecordsReady.wait(lock, [this]{ return mStop || !mRecords.empty(); });
+        if(mRecords.empty())
+        {
+            return; // stopping with nothing left to write
+        }
+        Record record = std::move(mRecords.front());
+        mRecords.pop_front();
+        mWriting = true;
+        lock.unlock();
+        try
+        {
+            std::visit([this](const auto& metrics)
+            {
+                using MetricsT = std::decay_t<decltype(metrics)>;
+                if constexpr (std::is_same_v<MetricsT, BatchMetrics>) mWriter->writeBatch(metrics);
+                else if constexpr (std::is_same_v<MetricsT, EpochMetrics>) mWriter->writeEpoch(metrics);
+                else mWriter->writeEvaluation(metrics);
+            }, record);
+            mWriter->flush();
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << "Could not write metrics: " << e.what() << std::endl;
+        }
+        lock.lock();
+        mWriting = false;
+        if(mRecords.empty())
+        {
+            mDrained.notify_all();
+        }
+    }
+}
+
+//***********//
+
+// CONSOLE
+
+ConsoleMetricsWriter::ConsoleMetricsWriter(std::ostream& out) : mOut(out)
+{
+}
+
+void ConsoleMetricsWriter::writeEpoch(const EpochMetrics& metrics)
+{
+    mOut << "Threads: " << metrics.threads << std::endl;
+    mOut << "Epoch: " << metrics.epoch << std::endl;
+    mOut << "Time: " << metrics.seconds * 1000 << " ms" << std::endl;
+    if(mHasEvaluation && mLastEvaluation.epoch == metrics.epoch)
+    {
+        if(mLastEvaluation.trainingEvaluated)
+        {
+            mOut << " -> Training Data (" << mLastEvaluation.trainingItems << " items):\n";
+            mOut << "   --> Average Loss: " << std::fixed << mLastEvaluation.trainingLoss << std::endl;
+            mOut << "   --> Accuracy: " << std::fixed << mLastEvaluation.trainingAccuracy << "%" << std::endl;
+        }
+        mOut << " -> Test Data (" << mLastEvaluation.testItems << " items):\n";
+        mOut << "   --> Average Loss: " << std::fixed << mLastEvaluation.testLoss << std::endl;
+        mOut << "   --> Accuracy: " << std::fixed << mLastEvaluation.testAccuracy << "%" << std::endl;
+    }
+    printEpochStats(mOut, metrics.stats);
+    if(metrics.stoppingEarly)
+    {
+        mOut << " -> Stopping early, no improvement since epoch " << metrics.bestEpoch << std::endl;
+    }
+    if(metrics.allocationsTracked)
+    {
+        printAllocationReport(mOut, metrics.allocations);
+    }
+    mOut << "********************\n";
+}
+
+void ConsoleMetricsWriter::writeEvaluation(const EvaluationMetrics& metrics)
+{
+    // printed with the rest of the epoch
+    mLastEvaluation = metrics;
+    mHasEvaluation = true;
+}
+
+void ConsoleMetricsWriter::flush()
+{
+    mOut.flush();
+}
+
+//***********//
+
+// CSV
+
+CsvMetricsWriter::CsvMetricsWriter(const std::string& fName) : mFileOut(fName)
+{
+    if(!mFileOut)
+    {
+        throw std::runtime_error("Could not open metrics file " + fName);
+    }
+    mFileOut << std::setprecision(8);
+    mFileOut << "record,epoch,batch,samples,seconds,samples_per_second,gflops,training_loss,training_accuracy,test_loss,test_accuracy\n";
+}
+
+void CsvMetricsWriter::writeBatch(const BatchMetrics& metrics)
+{
+    mFileOut << "batch," << metrics.epoch << "," << metrics.batch << "," << metrics.samples << "," << metrics.seconds << ","
+             << (metrics.seconds > 0 ? static_cast<double> (metrics.samples) / metrics.seconds : 0) << ",,,,,\n";
+}
+
+void CsvMetricsWriter::writeEpoch(const EpochMetrics& metrics)
+{
+    mFileOut << "epoch," << metrics.epoch << ",," << metrics.stats.samples << "," << metrics.seconds << ","
+             << metrics.stats.samplesPerSecond << "," << metrics.stats.gflops << ",,,,\n";
+}
+
+void CsvMetricsWriter::writeEvaluation(const EvaluationMetrics& metrics)
+{
+    mFileOut << "evaluation," << metrics.epoch << ",," << metrics.testItems << "," << metrics.seconds << ",,,";
+    if(metrics.trainingEvaluated)
+    {
+        mFileOut << metrics.trainingLoss << "," << metrics.trainingAccuracy;
+    }
+    else
+    {
+        mFileOut << ",";
+    }
+    mFileOut << "," << metrics.testLoss << "," << metrics.testAccuracy << "\n";
+}
+
+void CsvMetricsWriter::flush()
+{
+    mFileOut.flush();
+}
+
+//***********//
+
+// JSONL
+
+JsonlMetricsWriter::JsonlMetricsWriter(const std::string& fName) : mFileOut(fName)
+{
+    if(!mFileOut)
+    {
+        throw std::runtime_error("Could not open metrics file " + fName);
+    }
+    mFileOut << std::setprecision(8);
+}
+
+void JsonlMetricsWriter::writeBatch(const BatchMetrics& metrics)
+{
+    mFileOut << "{\"record\": \"batch\", \"epoch\": " << metrics.epoch << ", \"batch\": " << metrics.batch << ", \"samples\": " << metrics.samples
+             << ", \"seconds\": " << metrics.seconds << "}\n";
+}
+
+void JsonlMetricsWriter::writeEpoch(const EpochMetrics& metrics)
+{
+    mFileOut << "{\"record\": \"epoch\", \"epoch\": " << metrics.epoch << ", \"threads\": " << metrics.threads << ", \"seconds\": " << metrics.seconds
+             << ", \"batches\": " << metrics.batches << ", \"learningRateFactor\": " << metrics.learningRateFactor << ", \"samples\": " << metrics.stats.samples << ", \"samplesPerSecond\": " << metrics.stats.samplesPerSecond
+             << ", \"gflops\": " << metrics.stats.gflops << ", \"phaseSeconds\": {";
+    for(size_t phase = 0; phase < NUM_PROFILED_PHASES; ++phase)
+    {
+        mFileOut << (phase > 0 ? ", " : "") << "\"" << profiledPhaseName(static_cast<ProfiledPhase> (phase)) << "\": " << metrics.stats.phases[phase].seconds;
+    }
+    mFileOut << "}}\n";
+}
+
+void JsonlMetricsWriter::writeEvaluation(const EvaluationMetrics& metrics)
+{
+    mFileOut << "{\"record\": \"evaluation\", \"epoch\": " << metrics.epoch << ", \"seconds\": " << metrics.seconds;
+    if(metrics.trainingEvaluated)
+    {
+        mFileOut << ", \"trainingItems\": " << metrics.trainingItems << ", \"trainingLoss\": " << metrics.trainingLoss
+                 << ", \"trainingAccuracy\": " << metrics.trainingAccuracy;
+    }
+    mFileOut << ", \"testItems\": " << metrics.testItems << ", \"testLoss\": " << metrics.testLoss << ", \"testAccuracy\": " << metrics.testAccuracy << "}\n";
+}
+
+void JsonlMetricsWriter::flush()
+{
+    mFileOut.flush();
+}
+
+//***********//
+
+// STATS FILE
+
+StatsJsonMetricsWriter::StatsJsonMetricsWriter(std::string fileName) : mFileName(std::move(fileName))
+{
+}
+
+void StatsJsonMetricsWriter::writeEpoch(const EpochMetrics& metrics)
+{
+    mStats.epochs.push_back(metrics.stats);
+    std::ofstream fileOut(mFileName);
+    if(!fileOut)
+    {
+        throw std::runtime_error("Could not open stats file " + mFileName);
+    }
+    mStats.writeJson(fileOut);
+}
+
+//***********//
+
+// PROMETHEUS
+
+PrometheusMetricsWriter::PrometheusMetricsWriter(uint16_t port)
+{
+    mListenSocket = ::socket(AF_INET, SOCK_STREAM, 0);
+    if(mListenSocket < 0)
+    {
+        throw std::runtime_error(std::string("Could not create metrics socket: ") + std::strerror(errno));
+    }
+    const int reuse = 1;
+    ::setsockopt(mListenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // local scraping only
+    address.sin_port = htons(port);
+    socklen_t addressSz = sizeof(address);
+    if(::bind(mListenSocket, reinterpret_cast<sockaddr*> (&address), addressSz) < 0 || ::listen(mListenSocket, 8) < 0 ||
+       ::getsockname(mListenSocket, reinterpret_cast<sockaddr*> (&address), &addressSz) < 0)
+    {
+        const std::string error = std::strerror(errno);
+        ::close(mListenSocket);
+        throw std::runtime_error("Could not listen for metrics on port " + std::to_string(port) + ": " + error);
+    }
+    mPort = ntohs(address.sin_port);
+    mServer = std::thread(&PrometheusMetricsWriter::serveLoop, this);
+}
+
+PrometheusMetricsWriter::~PrometheusMetricsWriter()
+{
+    mStop = true;
+    mServer.join();
+    ::close(mListenSocket);
+}
+
+uint16_t PrometheusMetricsWriter::port() const
+{
+    return mPort;
+}
+
+void PrometheusMetricsWriter::serveLoop()
+{
+    unpinCurrentThread();
+    while(!mStop)
+    {
+        // wake up regularly to check for shutdown
+        pollfd listenPoll{mListenSocket, POLLIN, 0};
+        if(::poll(&listenPoll, 1, 100) <= 0)
+        {
+            continue;
+        }
+        const int client = ::accept(mListenSocket, nullptr, nullptr);
+        if(client < 0)
+        {
+            continue;
+        }
+        // the request itself doesn't matter - read what has arrived and reply
+        char request[1024];
+        pollfd clientPoll{client, POLLIN, 0};
+        if(::poll(&clientPoll, 1, 100) > 0)
+        {
+            [[maybe_unused]] const ssize_t received = ::recv(client, request, sizeof(request), 0);
+        }
+        const std::string body = exposition();
+        const std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) +
+                                     "\r\nConnection: close\r\n\r\n" + body;
+        size_t sent = 0;
+        while(sent < response.size())
+        {
+            const ssize_t bytes = ::send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if(bytes <= 0)
+            {
+                break;
+            }
+            sent += static_cast<size_t> (bytes);
+        }
+        ::close(client);
+    }
+}
+
+std::string PrometheusMetricsWriter::exposition()
+{
+    Values values;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        values = mValues;
+    }
+    std::ostringstream out;
+    out << std::setprecision(10);
+    const auto metric = [&](const char* name, const char* type, const char* help, auto value)
+    {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n" << name << " " << value << "\n";
+    };
+    metric("nnetwork_epoch", "gauge", "Last completed epoch.", values.epoch);
+    metric("nnetwork_batches_total", "counter", "Batches trained.", values.batches);
+    metric("nnetwork_samples_total", "counter", "Samples trained.", values.samples);
+    metric("nnetwork_batch_seconds", "gauge", "Time taken by the last batch forwarded to the sink.", values.batchSeconds);
+    metric("nnetwork_epoch_seconds", "gauge", "Training time of the last epoch.", values.epochSeconds);
+    metric("nnetwork_samples_per_second", "gauge", "Training throughput of the last epoch.", values.samplesPerSecond);
+    metric("nnetwork_gflops", "gauge", "GFLOP/s of the last epoch.", values.gflops);
+    metric("nnetwork_learning_rate_factor", "gauge", "Learning rate schedule factor at the end of the last epoch.", values.learningRateFactor);
+    if(values.trainingEvaluated)
+    {
+        metric("nnetwork_training_loss", "gauge", "Average loss over the training data.", values.trainingLoss);
+        metric("nnetwork_training_accuracy", "gauge", "Accuracy (%) over the training data.", values.trainingAccuracy);
+    }
+    if(values.testEvaluated)
+    {
+        metric("nnetwork_test_loss", "gauge", "Average loss over the test data.", values.testLoss);
+        metric("nnetwork_test_accuracy", "gauge", "Accuracy (%) over the test data.", values.testAccuracy);
+    }
+    return out.str();
+}
+
+void PrometheusMetricsWriter::writeBatch(const BatchMetrics& metrics)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mValues.batchSeconds = metrics.seconds;
+}
+
+void PrometheusMetricsWriter::writeEpoch(const EpochMetrics& metrics)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mValues.epoch = metrics.epoch;
+    mValues.batches += metrics.batches;
+    mValues.samples += metrics.stats.samples;
+    mValues.epochSeconds = metrics.seconds;
+    mValues.samplesPerSecond = metrics.stats.samplesPerSecond;
+    mValues.gflops = metrics.stats.gflops;
+    mValues.learningRateFactor = metrics.learningRateFactor;
+}
+
+void PrometheusMetricsWriter::writeEvaluation(const EvaluationMetrics& metrics)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(metrics.trainingEvaluated)
+    {
+        mValues.trainingEvaluated = true;
+        mValues.trainingLoss = metrics.trainingLoss;
+        mValues.trainingAccuracy = metrics.trainingAccuracy;
+    }
+    mValues.testEvaluated = true;
+    mValues.testLoss = metrics.testLoss;
+    mValues.testAccuracy = metrics.testAccuracy;
+}
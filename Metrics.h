@@ -0,0 +1,232 @@
+//
+// Created by Lenovo on 03/07/2023.
+//
+
+#ifndef NNETWORK2_METRICS_H
+#define NNETWORK2_METRICS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <variant>
+
+#include "Eigen/Dense"
+
+#include "AllocationTracker.h"
+#include "DataSpecs.h"
+#include "PhaseTimer.h"
+
+using NetNumT = NUM_TYPE;
+
+// METRICS
+
+struct BatchMetrics
+{
+    size_t epoch = 0;
+    size_t batch = 0; // within the epoch
+    size_t samples = 0;
+    double seconds = 0; // gradients + update
+};
+
+struct EvaluationMetrics
+{
+    size_t epoch = 0;
+    double seconds = 0;
+    bool trainingEvaluated = false; // training loss / accuracy are only set if so
+    size_t trainingItems = 0;
+    NetNumT trainingLoss = 0;
+    NetNumT trainingAccuracy = 0;
+    size_t testItems = 0;
+    NetNumT testLoss = 0;
+    NetNumT testAccuracy = 0;
+};
+
+struct EpochMetrics
+{
+    size_t epoch = 0;
+    int threads = 0;
+    double seconds = 0; // training, excluding evaluation
+    size_t batches = 0;
+    double learningRateFactor = 1; // of the schedule at the last batch
+    bool stoppingEarly = false; // this is the last epoch
+    size_t bestEpoch = 0; // when stopping early
+    EpochStats stats;
+    bool allocationsTracked = false;
+    AllocationReport allocations{};
+};
+
+// CALLBACKS
+
+// hooks into train() - called on the training thread, so anything slow belongs in a MetricsSink
+class TrainingCallback
+{
+    public:
+        virtual ~TrainingCallback() = default;
+
+        virtual void onBatchEnd(const BatchMetrics&) {}
+        // after the epoch's evaluation (if there was one)
+        virtual void onEpochEnd(const EpochMetrics&) {}
+        virtual void onEvaluation(const EvaluationMetrics&) {}
+};
+
+// SINKS
+
+// formats / stores metrics - only ever called on its MetricsSink's thread
+class MetricsWriter
+{
+    public:
+        virtual ~MetricsWriter() = default;
+
+        virtual void writeBatch(const BatchMetrics&) {}
+        virtual void writeEpoch(const EpochMetrics&) {}
+        virtual void writeEvaluation(const EvaluationMetrics&) {}
+        virtual void flush() {}
+};
+
+// queues metrics from the training thread and hands them to a writer on a background thread
+class MetricsSink : public TrainingCallback
+{
+    private:
+        using Record = std::variant<BatchMetrics, EpochMetrics, EvaluationMetrics>;
+
+        std::unique_ptr<MetricsWriter> mWriter;
+        size_t mBatchInterval;
+        std::mutex mMutex;
+        std::condition_variable mRecordsReady;
+        std::condition_variable mDrained;
+        std::deque<Record> mRecords;
+        bool mWriting = false;
+        bool mStop = false;
+        std::thread mThread;
+
+        void push(Record record);
+        void writeLoop();
+
+    public:
+        // batchInterval: forward every Nth batch to the writer (0 for none)
+        explicit MetricsSink(std::unique_ptr<MetricsWriter> writer, size_t batchInterval = 0);
+        ~MetricsSink() override; // writes everything queued first
+        MetricsSink(const MetricsSink&) = delete;
+        MetricsSink& operator=(const MetricsSink&) = delete;
+
+        void onBatchEnd(const BatchMetrics& metrics) override;
+        void onEpochEnd(const EpochMetrics& metrics) override;
+        void onEvaluation(const EvaluationMetrics& metrics) override;
+
+        // blocks until everything queued has been written
+        void flush();
+};
+
+// the progress report train() prints by default
+class ConsoleMetricsWriter : public MetricsWriter
+{
+    private:
+        std::ostream& mOut;
+        EvaluationMetrics mLastEvaluation;
+        bool mHasEvaluation = false;
+
+    public:
+        explicit ConsoleMetricsWriter(std::ostream& out);
+
+        void writeEpoch(const EpochMetrics& metrics) override;
+        void writeEvaluation(const EvaluationMetrics& metrics) override;
+        void flush() override;
+};
+
+// one row per record, with a column saying which kind (unused columns are left empty)
+class CsvMetricsWriter : public MetricsWriter
+{
+    private:
+        std::ofstream mFileOut;
+
+    public:
+        explicit CsvMetricsWriter(const std::string& fName);
+
+        void writeBatch(const BatchMetrics& metrics) override;
+        void writeEpoch(const EpochMetrics& metrics) override;
+        void writeEvaluation(const EvaluationMetrics& metrics) override;
+        void flush() override;
+};
+
+// one json object per line
+class JsonlMetricsWriter : public MetricsWriter
+{
+    private:
+        std::ofstream mFileOut;
+
+    public:
+        explicit JsonlMetricsWriter(const std::string& fName);
+
+        void writeBatch(const BatchMetrics& metrics) override;
+        void writeEpoch(const EpochMetrics& metrics) override;
+        void writeEvaluation(const EvaluationMetrics& metrics) override;
+        void flush() override;
+};
+
+// rewrites a TrainingStats json file (see PhaseTimer.h) after each epoch
+class StatsJsonMetricsWriter : public MetricsWriter
+{
+    private:
+        std::string mFileName;
+        TrainingStats mStats;
+
+    public:
+        explicit StatsJsonMetricsWriter(std::string fileName);
+
+        void writeEpoch(const EpochMetrics& metrics) override;
+};
+
+// serves the latest values in the Prometheus text format over http on 127.0.0.1:port (any path)
+class PrometheusMetricsWriter : public MetricsWriter
+{
+    private:
+        struct Values
+        {
+            size_t epoch = 0;
+            uint64_t batches = 0;
+            uint64_t samples = 0;
+            double batchSeconds = 0;
+            double samplesPerSecond = 0;
+            double gflops = 0;
+            double learningRateFactor = 1;
+            double epochSeconds = 0;
+            bool trainingEvaluated = false;
+            NetNumT trainingLoss = 0;
+            NetNumT trainingAccuracy = 0;
+            bool testEvaluated = false;
+            NetNumT testLoss = 0;
+            NetNumT testAccuracy = 0;
+        };
+
+        int mListenSocket = -1;
+        uint16_t mPort = 0;
+        std::mutex mMutex;
+        Values mValues;
+        std::atomic<bool> mStop{false};
+        std::thread mServer;
+
+        void serveLoop();
+        std::string exposition();
+
+    public:
+        // port 0 picks a free port (see port())
+        explicit PrometheusMetricsWriter(uint16_t port);
+        ~PrometheusMetricsWriter() override;
+        PrometheusMetricsWriter(const PrometheusMetricsWriter&) = delete;
+        PrometheusMetricsWriter& operator=(const PrometheusMetricsWriter&) = delete;
+
+        [[nodiscard]] uint16_t port() const;
+
+        void writeBatch(const BatchMetrics& metrics) override;
+        void writeEpoch(const EpochMetrics& metrics) override;
+        void writeEvaluation(const EvaluationMetrics& metrics) override;
+};
+
+#endif //NNETWORK2_METRICS_H
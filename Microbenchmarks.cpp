@@ -0,0 +1,249 @@
+//
+// Created by Lenovo on 22/06/2023.
+//
+
+// Microbenchmarks for the core kernels on synthetic data (no MNIST files needed)
+// usage: NNetwork2Bench [--warmup N] [--reps N] [--min-sample-ms X] [--filter S] [--json FILE] [--csv FILE]
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "Benchmark.h"
+#include "Data.h"
+#include "ExecutionPlan.h"
+#include "FusedLayer.h"
+#include "ModelFile.h"
+#include "NNetwork.h"
+#include "Training.h"
+
+constexpr unsigned int SYNTHETIC_SEED = 12345;
+constexpr size_t NUM_SYNTHETIC_ITEMS = 2000;
+const std::vector<size_t> HIDDEN_LAYER_SZS = {64, 128, 512};
+constexpr size_t TRAINING_BATCH_SZ = 16;
+
+static std::string actFuncName(ActFunc actFunc)
+{
+    switch (actFunc)
+    {
+        case ActFunc::SIGMOID: return "sigmoid";
+        case ActFunc::RELU: return "relu";
+        case ActFunc::SOFTMAX: return "softmax";
+    }
+    return "unknown";
+}
+
+// input -> hidden -> softmax output
+static NNetwork makeNetwork(size_t hiddenSz)
+{
+    NNetwork network(static_cast<size_t> (getInputSz()), getClasses());
+    network.addLayer(hiddenSz, 0);
+    initialiseWeightsBiases(network, InitMethod::UNIFORM_HE);
+    return network;
+}
+
+// copies the first plan.batchSz() items into the plan's inputs and targets
+static void loadBatch(ExecutionPlan& plan, const ExampleData& data)
+{
+    for(Eigen::Index row = 0; row < plan.batchInputs().rows(); ++row)
+    {
+        plan.batchInputs().row(row) = data[static_cast<size_t> (row)].inputs;
+        plan.batchTargets().row(row) = data[static_cast<size_t> (row)].labels;
+    }
+}
+
+// the kernels of one batched training step (as calculateGradientsOverBatch runs them) plus the single sample feedforward
+static void benchmarkForwardAndBackward(BenchmarkSuite& suite, const ExampleData& data)
+{
+    const ExampleItem& item = data.front();
+    for(const ActFunc hiddenActFunc : {ActFunc::SIGMOID, ActFunc::RELU})
+    {
+        for(const size_t hiddenSz : HIDDEN_LAYER_SZS)
+        {
+            const std::string suffix = "/" + actFuncName(hiddenActFunc) + "/" + std::to_string(hiddenSz);
+            const std::string batchSuffix = suffix + "/" + std::to_string(TRAINING_BATCH_SZ);
+            const ActFuncList actFuncs{hiddenActFunc, ActFunc::SOFTMAX};
+            NNetwork network = makeNetwork(hiddenSz);
+            ExecutionPlan singlePlan(network, 1);
+            network.setInputs(item.inputs);
+            suite.run("feedforward" + suffix, 1, [&]()
+            {
+                network.feedforward(actFuncs, 0, singlePlan);
+            });
+
+            ExecutionPlan plan(network, TRAINING_BATCH_SZ);
+            NetworkLayerGradients layerGrads(network);
+            NetworkWeightGradients weightGrads(network);
+            loadBatch(plan, data);
+            NLayer& hiddenLayer = network.layer(0);
+            NLayer& outputLayer = network.layer(1);
+            suite.run("forward" + batchSuffix, TRAINING_BATCH_SZ, [&]()
+            {
+                fusedLayerForward(plan.batchInputs(), hiddenLayer.getWeights(), hiddenLayer.getBiases(), hiddenActFunc, plan.batchOutputs(0), plan.batchParallelism(0),
+                                  nullptr, 1, &plan.forwardPacking(0));
+                multiplyLayer(plan.batchOutputs(0), outputLayer.getWeights(), plan.batchOutputs(1), plan.batchParallelism(1), &plan.forwardPacking(1));
+                plan.batchOutputs(1).rowwise() += outputLayer.getBiases();
+            });
+            // softmax of the softmax's outputs from the second run on, which costs the same
+            suite.run("outputGradients/cross_entropy" + batchSuffix, TRAINING_BATCH_SZ, [&]()
+            {
+                fusedSoftmaxCrossEntropy(plan.batchOutputs(1), plan.batchTargets(), plan.batchErrors(1));
+            });
+            suite.run("hiddenGradients" + batchSuffix, TRAINING_BATCH_SZ, [&]()
+            {
+                multiplyLayerTransposed(plan.batchErrors(1), outputLayer.getWeights(), plan.batchErrors(0), plan.backwardParallelism(1), &plan.backwardPacking(1));
+                multiplyByActivationGradients(plan.batchErrors(0), plan.batchOutputs(0), hiddenActFunc);
+            });
+            suite.run("weightGradients" + batchSuffix, TRAINING_BATCH_SZ, [&]()
+            {
+                for(size_t layerPos = 0; layerPos < network.numLayers(); ++layerPos)
+                {
+                    const auto& prevOutputs = layerPos == 0 ? plan.batchInputs() : plan.batchOutputs(layerPos - 1);
+                    accumulateWeightGradients(prevOutputs, plan.batchErrors(layerPos), weightGrads.getWeightGradientsForLayer(layerPos),
+                                              plan.batchParallelism(layerPos), plan.weightGradientPartials(layerPos), plan.numWeightGradientPartials(),
+                                              &plan.weightGradientPacking(layerPos));
+                    layerGrads.getLayerGradients(layerPos).noalias() += plan.batchErrors(layerPos).colwise().sum();
+                }
+            });
+        }
+    }
+
+    // mse output gradients use the activation derivative
+    NNetwork network = makeNetwork(HIDDEN_LAYER_SZS.front());
+    ExecutionPlan plan(network, TRAINING_BATCH_SZ);
+    loadBatch(plan, data);
+    NLayer& outputLayer = network.layer(1);
+    fusedLayerForward(plan.batchInputs(), network.layer(0).getWeights(), network.layer(0).getBiases(), ActFunc::RELU, plan.batchOutputs(0), plan.batchParallelism(0));
+    fusedLayerForward(plan.batchOutputs(0), outputLayer.getWeights(), outputLayer.getBiases(), ActFunc::SIGMOID, plan.batchOutputs(1), plan.batchParallelism(1));
+    suite.run("outputGradients/mse/sigmoid/" + std::to_string(TRAINING_BATCH_SZ), TRAINING_BATCH_SZ, [&]()
+    {
+        plan.batchErrors(1) = plan.batchOutputs(1) - plan.batchTargets();
+        multiplyByActivationGradients(plan.batchErrors(1), plan.batchOutputs(1), ActFunc::SIGMOID);
+    });
+}
+
+static void benchmarkBatches(BenchmarkSuite& suite, const ExampleData& data)
+{
+    // the README's configuration
+    NNetwork network(static_cast<size_t> (getInputSz()), getClasses());
+    network.addLayer(128, 0);
+    network.addLayer(64, 1);
+    initialiseWeightsBiases(network, InitMethod::UNIFORM_HE);
+    const ActFuncList actFuncs{ActFunc::RELU, ActFunc::RELU, ActFunc::SOFTMAX};
+    const LearningRateList lrList(network.numLayers(), 0.01f);
+
+    NetworkLayerGradients layerGrads(network), prevBiasDelta(network);
+    NetworkWeightGradients weightGrads(network), prevWeightDelta(network);
+    ExecutionPlan trainingPlan(network, TRAINING_BATCH_SZ);
+    suite.run("gradientsOverBatch/784-128-64-10/" + std::to_string(TRAINING_BATCH_SZ), TRAINING_BATCH_SZ, [&]()
+    {
+        calculateGradientsOverBatch(network, data.begin(), data.begin() + TRAINING_BATCH_SZ, actFuncs, LossFunc::CROSS_ENTROPY, layerGrads, weightGrads, 0, trainingPlan);
+        layerGrads.setToZero();
+        weightGrads.setToZero();
+    });
+    suite.run("updateNetworkUsingGradients/784-128-64-10", 1, [&]()
+    {
+        updateNetworkUsingGradients(network, layerGrads, weightGrads, lrList, 0.9f, prevBiasDelta, prevWeightDelta);
+    });
+
+    constexpr size_t evaluationBatchSz = 256;
+    ExecutionPlan evaluationPlan(network, evaluationBatchSz);
+    suite.run("feedforwardBatch/784-128-64-10/256", evaluationBatchSz, [&]()
+    {
+        feedforwardBatch(network, data.begin(), data.begin() + evaluationBatchSz, actFuncs, evaluationPlan);
+    });
+}
+
+// online (batch size 1) prediction through the network's feedforward
+static void benchmarkInference(BenchmarkSuite& suite, const ExampleData& data)
+{
+    NNetwork network(static_cast<size_t> (getInputSz()), getClasses());
+    network.addLayer(128, 0);
+    network.addLayer(64, 1);
+    initialiseWeightsBiases(network, InitMethod::UNIFORM_HE);
+    const ActFuncList actFuncs{ActFunc::RELU, ActFunc::RELU, ActFunc::SOFTMAX};
+
+    ExecutionPlan plan(network, 1);
+    size_t itemPos = 0;
+    suite.run("predict/feedforward/784-128-64-10", 1, [&]()
+    {
+        network.setInputs(data[itemPos++ % data.size()].inputs);
+        network.feedforward(actFuncs, 0, plan);
+    });
+}
+
+static void benchmarkData(BenchmarkSuite& suite, const ExampleData& data)
+{
+    ExampleData normalisedData = data;
+    suite.run("normaliseTrainingData/z_score/" + std::to_string(data.size()), data.size(), [&]()
+    {
+        normaliseTrainingData(normalisedData, DataNormalisationMethod::Z_SCORE);
+    });
+
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path();
+    const std::string csvFile = (tempDir / "nnetwork2_bench.csv").string();
+    writeSyntheticCsv(csvFile, data.size(), SYNTHETIC_SEED);
+    suite.run("loadTrainingDataFromFile/" + std::to_string(data.size()), data.size(), [&]()
+    {
+        loadTrainingDataFromFile(csvFile);
+    });
+    std::remove(csvFile.c_str());
+
+    NNetwork network(static_cast<size_t> (getInputSz()), getClasses());
+    network.addLayer(128, 0);
+    network.addLayer(64, 1);
+    initialiseWeightsBiases(network, InitMethod::UNIFORM_HE);
+    ActFuncList actFuncs{ActFunc::RELU, ActFunc::RELU, ActFunc::SOFTMAX};
+
+    const std::string textModel = (tempDir / "nnetwork2_bench_model.txt").string();
+    suite.run("serialise/784-128-64-10", 1, [&]()
+    {
+        std::ofstream fileOut(textModel);
+        serialise(fileOut, network, actFuncs);
+    });
+    suite.run("deserialise/784-128-64-10", 1, [&]()
+    {
+        std::ifstream fileIn(textModel);
+        ActFuncList loadedActFuncs;
+        deserialise(fileIn, loadedActFuncs);
+    });
+    std::remove(textModel.c_str());
+
+    const std::string binaryModel = (tempDir / "nnetwork2_bench_model.bin").string();
+    suite.run("serialiseBinary/784-128-64-10", 1, [&]()
+    {
+        serialiseBinary(binaryModel, network, actFuncs);
+    });
+    suite.run("deserialiseBinary/784-128-64-10", 1, [&]()
+    {
+        ActFuncList loadedActFuncs;
+        deserialiseBinary(binaryModel, loadedActFuncs);
+    });
+    std::remove(binaryModel.c_str());
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        BenchmarkSuite suite(BenchmarkOptions::fromArgs(argc, argv));
+        ExampleData data = makeSyntheticExampleData(NUM_SYNTHETIC_ITEMS, SYNTHETIC_SEED);
+        const ExampleData rawData = data;
+        normaliseTrainingData(data, DataNormalisationMethod::Z_SCORE);
+
+        benchmarkForwardAndBackward(suite, data);
+        benchmarkBatches(suite, data);
+        benchmarkInference(suite, data);
+        benchmarkData(suite, rawData);
+
+        suite.writeResultFiles();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,308 @@
+//
+// Created by Lenovo on 12/08/2023.
+//
+
+#include <cstring>
+#include <fstream>
+
+#include "Checksum.h"
+#include "FusedLayer.h"
+#include "ModelFile.h"
+#include "Trace.h"
+
+namespace
+{
+    constexpr uint64_t MODEL_BLOCK_ALIGNMENT = 64;
+
+    enum class ModelDType : uint32_t
+    {
+            FLOAT32 = 0,
+            FLOAT64 = 1
+    };
+
+    constexpr ModelDType netNumDType()
+    {
+        return sizeof(NetNumT) == sizeof(float) ? ModelDType::FLOAT32 : ModelDType::FLOAT64;
+    }
+
+    struct ModelFileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t dtype;
+        uint64_t inputSz;
+        uint64_t numLayers;
+        uint64_t numClasses;
+        uint64_t dataOffset;
+        uint64_t fileSz;
+        uint64_t checksum; // FNV-1a of bytes [sizeof(ModelFileHeader), fileSz)
+    };
+
+    struct ModelLayerEntry
+    {
+        uint64_t rows;
+        uint64_t cols;
+        uint64_t weightsOffset;
+        uint64_t biasesOffset;
+        uint32_t actFunc;
+        uint32_t reserved;
+    };
+
+    uint64_t alignOffset(uint64_t offset)
+    {
+        return (offset + MODEL_BLOCK_ALIGNMENT - 1) / MODEL_BLOCK_ALIGNMENT * MODEL_BLOCK_ALIGNMENT;
+    }
+
+    // whether a rows x cols block of values starting at offset lies within the file - written so that nothing overflows
+    bool blockFitsInFile(uint64_t offset, uint64_t rows, uint64_t cols, uint64_t fileSz)
+    {
+        return offset <= fileSz && (cols == 0 || rows <= (fileSz - offset) / sizeof(NetNumT) / cols);
+    }
+
+    // writes to the file while keeping the running checksum and position
+    class ChecksummedWriter
+    {
+        private:
+            std::ofstream& mFileOut;
+            uint64_t mChecksum = FNV1A_OFFSET_BASIS;
+            uint64_t mPos;
+
+        public:
+            ChecksummedWriter(std::ofstream& fileOut, uint64_t startPos) : mFileOut(fileOut), mPos(startPos) {}
+
+            void write(const void* data, uint64_t size)
+            {
+                mFileOut.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+                mChecksum = fnv1aHash(static_cast<const char*>(data), size, mChecksum);
+                mPos += size;
+            }
+
+            void padTo(uint64_t offset)
+            {
+                const std::string padding(offset - mPos, '\0');
+                write(padding.data(), padding.size());
+            }
+
+            [[nodiscard]] uint64_t checksum() const { return mChecksum; }
+            [[nodiscard]] uint64_t pos() const { return mPos; }
+    };
+}
+
+bool serialiseBinary(const std::string& fName, NNetwork& network, const ActFuncList& actFuncList)
+{
+    if(actFuncList.size() != network.numLayers())
+    {
+        throw std::logic_error("Number of activation functions does not match layers in network");
+    }
+    // classes ordered by their output position
+    std::vector<ClassT> classNames(network.classes().size());
+    for(const auto& c : network.classes())
+    {
+        classNames[c.second] = c.first;
+    }
+
+    // lay out the metadata then the aligned weight and bias blocks
+    std::vector<ModelLayerEntry> layerEntries(network.numLayers());
+    uint64_t offset = sizeof(ModelFileHeader) + sizeof(ModelLayerEntry) * layerEntries.size();
+    for(const ClassT& className : classNames)
+    {
+        offset += sizeof(uint64_t) + className.size();
+    }
+    const uint64_t dataOffset = alignOffset(offset);
+    offset = dataOffset;
+    for(size_t layerPos = 0; layerPos < network.numLayers(); ++layerPos)
+    {
+        const LayerWeightsMapT& weights = network.layer(layerPos).getWeights();
+        ModelLayerEntry& entry = layerEntries[layerPos];
+        entry.rows = static_cast<uint64_t>(weights.rows());
+        entry.cols = static_cast<uint64_t>(weights.cols());
+        entry.actFunc = static_cast<uint32_t>(actFuncList[layerPos]);
+        entry.weightsOffset = offset;
+        entry.biasesOffset = alignOffset(entry.weightsOffset + sizeof(NetNumT) * entry.rows * entry.cols);
+        offset = alignOffset(entry.biasesOffset + sizeof(NetNumT) * entry.cols);
+    }
+
+    std::ofstream fileOut(fName, std::ios::binary | std::ios::trunc);
+    if(!fileOut.is_open())
+    {
+        throw std::logic_error("Could not open file");
+    }
+    ModelFileHeader header{};
+    std::memcpy(header.magic, MODEL_FILE_MAGIC, sizeof(MODEL_FILE_MAGIC));
+    header.version = MODEL_FILE_VERSION;
+    header.dtype = static_cast<uint32_t>(netNumDType());
+    header.inputSz = static_cast<uint64_t>(network.getInputs().size());
+    header.numLayers = network.numLayers();
+    header.numClasses = classNames.size();
+    header.dataOffset = dataOffset;
+    header.fileSz = offset;
+    fileOut.write(reinterpret_cast<const char*>(&header), sizeof(header)); // rewritten once the checksum is known
+
+    ChecksummedWriter writer(fileOut, sizeof(header));
+    writer.write(layerEntries.data(), sizeof(ModelLayerEntry) * layerEntries.size());
+    for(const ClassT& className : classNames)
+    {
+        const uint64_t nameLength = className.size();
+        writer.write(&nameLength, sizeof(nameLength));
+        writer.write(className.data(), nameLength);
+    }
+    for(size_t layerPos = 0; layerPos < network.numLayers(); ++layerPos)
+    {
+        const ModelLayerEntry& entry = layerEntries[layerPos];
+        writer.padTo(entry.weightsOffset);
+        writer.write(network.layer(layerPos).getWeights().data(), sizeof(NetNumT) * entry.rows * entry.cols);
+        writer.padTo(entry.biasesOffset);
+        writer.write(network.layer(layerPos).getBiases().data(), sizeof(NetNumT) * entry.cols);
+    }
+    writer.padTo(header.fileSz);
+
+    header.checksum = writer.checksum();
+    fileOut.seekp(0);
+    fileOut.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return static_cast<bool>(fileOut);
+}
+
+NNetwork deserialiseBinary(const std::string& fName, ActFuncList& actFuncList)
+{
+    const MappedModel model(fName);
+    actFuncList = model.actFuncs();
+    return model.toNetwork();
+}
+
+MappedModel::MappedModel(const std::string& fName, bool verifyChecksum) : mFile(fName)
+{
+    ModelFileHeader header{};
+    if(mFile.size() < sizeof(header))
+    {
+        throw std::logic_error("Model file is too small");
+    }
+    std::memcpy(&header, mFile.data(), sizeof(header));
+    if(std::memcmp(header.magic, MODEL_FILE_MAGIC, sizeof(MODEL_FILE_MAGIC)) != 0)
+    {
+        throw std::logic_error("Not a binary model file");
+    }
+    if(header.version != MODEL_FILE_VERSION)
+    {
+        throw std::logic_error("Unsupported model file version");
+    }
+    if(header.dtype != static_cast<uint32_t>(netNumDType()))
+    {
+        throw std::logic_error("Model file written with a different NUM_TYPE");
+    }
+    if(header.fileSz != mFile.size() || header.dataOffset > header.fileSz || header.dataOffset < sizeof(header) ||
+       header.numLayers > (header.dataOffset - sizeof(header)) / sizeof(ModelLayerEntry))
+    {
+        throw std::logic_error("Model file is truncated or corrupt");
+    }
+    if(verifyChecksum && fnv1aHash(mFile.data() + sizeof(header), mFile.size() - sizeof(header)) != header.checksum)
+    {
+        throw std::logic_error("Model file checksum does not match");
+    }
+    mInputSz = header.inputSz;
+
+    const char* cursor = mFile.data() + sizeof(header);
+    std::vector<ModelLayerEntry> layerEntries(header.numLayers);
+    std::memcpy(layerEntries.data(), cursor, sizeof(ModelLayerEntry) * layerEntries.size());
+    cursor += sizeof(ModelLayerEntry) * layerEntries.size();
+    const char* const classesEnd = mFile.data() + header.dataOffset;
+    for(uint64_t classPos = 0; classPos < header.numClasses; ++classPos)
+    {
+        uint64_t nameLength = 0;
+        if(static_cast<size_t>(classesEnd - cursor) < sizeof(nameLength))
+        {
+            throw std::logic_error("Model file is truncated or corrupt");
+        }
+        std::memcpy(&nameLength, cursor, sizeof(nameLength));
+        cursor += sizeof(nameLength);
+        if(nameLength > static_cast<uint64_t>(classesEnd - cursor))
+        {
+            throw std::logic_error("Model file is truncated or corrupt");
+        }
+        mClasses.emplace(cursor, nameLength);
+        cursor += nameLength;
+    }
+
+    uint64_t prevLayerSz = mInputSz;
+    for(const ModelLayerEntry& entry : layerEntries)
+    {
+        if(entry.rows != prevLayerSz || entry.cols == 0 || entry.actFunc > static_cast<uint32_t>(ActFunc::SOFTMAX) ||
+           entry.weightsOffset % MODEL_BLOCK_ALIGNMENT != 0 || entry.biasesOffset % MODEL_BLOCK_ALIGNMENT != 0 ||
+           !blockFitsInFile(entry.weightsOffset, entry.rows, entry.cols, header.fileSz) || !blockFitsInFile(entry.biasesOffset, 1, entry.cols, header.fileSz))
+        {
+            throw std::logic_error("Model file layer table is corrupt");
+        }
+        mActFuncs.push_back(static_cast<ActFunc>(entry.actFunc));
+        mWeights.emplace_back(reinterpret_cast<const NetNumT*>(mFile.data() + entry.weightsOffset), static_cast<Eigen::Index>(entry.rows), static_cast<Eigen::Index>(entry.cols));
+        mBiases.emplace_back(reinterpret_cast<const NetNumT*>(mFile.data() + entry.biasesOffset), static_cast<Eigen::Index>(entry.cols));
+        prevLayerSz = entry.cols;
+    }
+    if(prevLayerSz != mClasses.size())
+    {
+        throw std::logic_error("Output layer size does not match number of classes");
+    }
+}
+
+size_t MappedModel::inputSz() const
+{
+    return mInputSz;
+}
+
+size_t MappedModel::numLayers() const
+{
+    return mWeights.size();
+}
+
+const ActFuncList& MappedModel::actFuncs() const
+{
+    return mActFuncs;
+}
+
+const ClassList& MappedModel::classes() const
+{
+    return mClasses;
+}
+
+const MappedWeightsT& MappedModel::weights(size_t layer) const
+{
+    return mWeights.at(layer);
+}
+
+const MappedBiasesT& MappedModel::biases(size_t layer) const
+{
+    return mBiases.at(layer);
+}
+
+SingleRowT MappedModel::predict(const SingleRowT& inputs) const
+{
+    TraceScope predictTrace("predict");
+    if(inputs.size() != static_cast<Eigen::Index>(mInputSz))
+    {
+        throw std::out_of_range("Num inputs does not match model input size");
+    }
+    SingleRowT layerOutputs = inputs;
+    for(size_t layerPos = 0; layerPos < numLayers(); ++layerPos)
+    {
+        SingleRowT netInputs = layerOutputs * mWeights[layerPos];
+        if(!fusedLayerEpilogue(netInputs, mBiases[layerPos], mActFuncs[layerPos]))
+        {
+            throw std::logic_error("Prediction contains INF or NaN");
+        }
+        layerOutputs.swap(netInputs);
+    }
+    return layerOutputs;
+}
+
+NNetwork MappedModel::toNetwork() const
+{
+    NNetwork network(mInputSz, mClasses);
+    for(size_t layerPos = 0; layerPos + 1 < numLayers(); ++layerPos)
+    {
+        network.addLayer(static_cast<size_t>(mBiases[layerPos].size()), layerPos);
+    }
+    for(size_t layerPos = 0; layerPos < numLayers(); ++layerPos)
+    {
+        network.layer(layerPos).setWeights(mWeights[layerPos]);
+        network.layer(layerPos).setBiases(mBiases[layerPos]);
+    }
+    return network;
+}
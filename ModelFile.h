@@ -0,0 +1,53 @@
+//
+// Created by Lenovo on 12/08/2023.
+//
+
+#ifndef NNETWORK2_MODELFILE_H
+#define NNETWORK2_MODELFILE_H
+
+#include "NNetwork.h"
+#include "MappedFile.h"
+
+// Binary model format (version 1)
+//  header: magic, version, dtype, input size, number of layers/classes, data offset and a checksum of everything after the header
+//  metadata: one entry per layer (weight dimensions, block offsets, activation function) followed by the class names
+//  data: the weights (column major) and biases of each layer, each block starting on a 64 byte boundary
+// The file can be mapped and the blocks used in place (see MappedModel)
+
+bool serialiseBinary(const std::string& fName, NNetwork& network, const ActFuncList& actFuncList);
+NNetwork deserialiseBinary(const std::string& fName, ActFuncList& actFuncList);
+
+using MappedWeightsT = Eigen::Map<const LayerWeightsT, Eigen::Aligned64>;
+using MappedBiasesT = Eigen::Map<const SingleRowT, Eigen::Aligned64>;
+
+// read-only, zero-copy view of a binary model file. several processes mapping the same file share its pages
+class MappedModel
+{
+    private:
+        MappedFile mFile;
+        size_t mInputSz = 0;
+        ActFuncList mActFuncs;
+        ClassList mClasses;
+        std::vector<MappedWeightsT> mWeights;
+        std::vector<MappedBiasesT> mBiases;
+
+    public:
+        explicit MappedModel(const std::string& fName, bool verifyChecksum = true);
+
+        [[nodiscard]] size_t inputSz() const;
+        [[nodiscard]] size_t numLayers() const;
+        [[nodiscard]] const ActFuncList& actFuncs() const;
+        [[nodiscard]] const ClassList& classes() const;
+        [[nodiscard]] const MappedWeightsT& weights(size_t layer) const;
+        [[nodiscard]] const MappedBiasesT& biases(size_t layer) const;
+
+        // outputs of the final layer for a single input row
+        [[nodiscard]] SingleRowT predict(const SingleRowT& inputs) const;
+        // copies the mapped model into a trainable network
+        [[nodiscard]] NNetwork toNetwork() const;
+};
+
+#define MODEL_FILE_MAGIC "NNMODEL"
+constexpr uint32_t MODEL_FILE_VERSION = 1;
+
+#endif //NNETWORK2_MODELFILE_H
@@ -5,20 +5,49 @@
 #include "NLayer.h"
 
 #include <iostream>
+#include <new>
 
-NLayer::NLayer(size_t layerSz, size_t numIncomingWeightsToEachNeuron)
+NLayer::NLayer(size_t layerSz, size_t numIncomingWeightsToEachNeuron) :
+    mLayerBiases(nullptr, 0),
+    mLayerWeights(nullptr, 0, 0),
+    mNumIncomingWeights(numIncomingWeightsToEachNeuron)
 {
-    mLayerBiases.resize(1,static_cast<Eigen::Index> (layerSz) );
     mLayerOutputs.resize(1, static_cast<Eigen::Index> (layerSz) );
-    mLayerWeights.resize(static_cast<Eigen::Index> (numIncomingWeightsToEachNeuron), static_cast<Eigen::Index> (layerSz) );
 }
 
-const SingleRowT& NLayer::getBiases()
+NLayer& NLayer::operator=(const NLayer& other)
+{
+    // Map assignment would copy values between the arenas so rebind instead
+    mLayerOutputs = other.mLayerOutputs;
+    mNumIncomingWeights = other.mNumIncomingWeights;
+    new (&mLayerWeights) LayerWeightsMapT(const_cast<NetNumT*> (other.mLayerWeights.data()), other.mLayerWeights.rows(), other.mLayerWeights.cols());
+    new (&mLayerBiases) LayerBiasesMapT(const_cast<NetNumT*> (other.mLayerBiases.data()), other.mLayerBiases.size());
+    return *this;
+}
+
+NLayer& NLayer::operator=(NLayer&& other) noexcept
+{
+    mLayerOutputs = std::move(other.mLayerOutputs);
+    mNumIncomingWeights = other.mNumIncomingWeights;
+    new (&mLayerWeights) LayerWeightsMapT(other.mLayerWeights.data(), other.mLayerWeights.rows(), other.mLayerWeights.cols());
+    new (&mLayerBiases) LayerBiasesMapT(other.mLayerBiases.data(), other.mLayerBiases.size());
+    return *this;
+}
+
+void NLayer::bindParameters(NetNumT* weights, NetNumT* biases)
+{
+    const auto rows = weights ? static_cast<Eigen::Index> (mNumIncomingWeights) : 0;
+    const auto cols = weights ? static_cast<Eigen::Index> (size()) : 0;
+    new (&mLayerWeights) LayerWeightsMapT(weights, rows, cols);
+    new (&mLayerBiases) LayerBiasesMapT(biases, biases ? static_cast<Eigen::Index> (size()) : 0);
+}
+
+const LayerBiasesMapT& NLayer::getBiases()
 {
     return mLayerBiases;
 }
 
-void NLayer::setBiases(const SingleRowT& biases)
+void NLayer::setBiases(const Eigen::Ref<const SingleRowT>& biases)
 {
     if(biases.size() != mLayerBiases.size())
     {
@@ -32,12 +61,12 @@ const SingleRowT& NLayer::getOutputs() const
     return mLayerOutputs;
 }
 
-const LayerWeightsT& NLayer::getWeights()
+const LayerWeightsMapT& NLayer::getWeights()
 {
     return mLayerWeights;
 }
 
-void NLayer::setWeights(const LayerWeightsT& weights)
+void NLayer::setWeights(const Eigen::Ref<const LayerWeightsT>& weights)
 {
     if(weights.rows() != mLayerWeights.rows() || weights.cols() != mLayerWeights.cols())
     {
@@ -52,14 +81,19 @@ size_t NLayer::size() const
     return mLayerOutputs.size();
 }
 
+size_t NLayer::numIncomingWeights() const
+{
+    return mNumIncomingWeights;
+}
+
+// resizing only changes the shape - the owning network rebuilds its arena and rebinds the layer
+
 void NLayer::resizeLayer(size_t newLayerSz)
 {
-    mLayerBiases.resize(1, static_cast<Eigen::Index>(newLayerSz) );
     mLayerOutputs.resize(1, static_cast<Eigen::Index>(newLayerSz) );
-    mLayerWeights.resize(mLayerWeights.rows(), static_cast<Eigen::Index>(newLayerSz) );
 }
 
 void NLayer::resizeNumWeightsPerNeuron(size_t newWeightsSz)
 {
-    mLayerWeights.resize(static_cast<Eigen::Index> (newWeightsSz), mLayerWeights.cols());
-}
\ No newline at end of file
+    mNumIncomingWeights = newWeightsSz;
+}
@@ -8,33 +8,39 @@
 #include "Eigen/Dense"
 
 #include "DataSpecs.h"
-
-using NetNumT = NUM_TYPE;
-using LayerWeightsT =  Eigen::Matrix<NetNumT, Eigen::Dynamic, Eigen::Dynamic>;
-using SingleRowT = Eigen::Matrix<NetNumT, 1, Eigen::Dynamic>;
+#include "ParameterArena.h"
 
 class NLayer
 {
     private:
-        SingleRowT mLayerBiases;
+        LayerBiasesMapT mLayerBiases; // views into the network's parameter arena
         SingleRowT mLayerOutputs;
-        LayerWeightsT mLayerWeights;
-        
+        LayerWeightsMapT mLayerWeights;
+        size_t mNumIncomingWeights;
+
         void resizeLayer(size_t newLayerSz);
         void resizeNumWeightsPerNeuron(size_t newWeightsSz);
+        // point the weights and biases at arena memory (nullptr to unbind)
+        void bindParameters(NetNumT* weights, NetNumT* biases);
 
     public:
         explicit NLayer(size_t layerSz, size_t numIncomingWeightsToEachNeuron);
+        // copies share the same arena memory until their network rebinds them
+        NLayer(const NLayer& other) = default;
+        NLayer(NLayer&& other) noexcept = default;
+        NLayer& operator=(const NLayer& other);
+        NLayer& operator=(NLayer&& other) noexcept;
 
-        const SingleRowT& getBiases();
-        void setBiases(const SingleRowT& biases);
+        const LayerBiasesMapT& getBiases();
+        void setBiases(const Eigen::Ref<const SingleRowT>& biases);
 
         const SingleRowT& getOutputs() const;
 
-        const LayerWeightsT& getWeights();
-        void setWeights(const LayerWeightsT& weights);
+        const LayerWeightsMapT& getWeights();
+        void setWeights(const Eigen::Ref<const LayerWeightsT>& weights);
 
         size_t size() const;
+        [[nodiscard]] size_t numIncomingWeights() const;
 
         friend class NNetwork;
 };
@@ -6,14 +6,18 @@
 #include <fstream>
 #include <random>
 #include <chrono>
-#include <cmath>
+#include <sstream>
+#include <atomic>
 
 #include "NNetwork.h"
 #include "NLayer.h"
+#include "ExecutionPlan.h"
+#include "FusedLayer.h"
+#include "PhaseTimer.h"
 //#include "Debug.h"
 
-std::default_random_engine gen ( 12345 );
-
+// unique across networks so a plan built for one network is never valid for another with a different shape
+static std::atomic<size_t> topologyVersionCounter{0};
 
 NNetwork::NNetwork(size_t inputSz, const ClassList& labels)
 {
@@ -31,6 +35,92 @@ NNetwork::NNetwork(size_t inputSz, const ClassList& labels)
     {
         mOutputClasses.emplace(*std::next(labels.begin(), static_cast<Eigen::Index>(lPos)), lPos);
     }
+    rebuildParameterArena();
+}
+
+NNetwork::NNetwork(const NNetwork& other) :
+    mNLayer(other.mNLayer),
+    mOutputClasses(other.mOutputClasses),
+    mDropOutGenerator(other.mDropOutGenerator),
+    mParameterLayout(other.mParameterLayout),
+    mParameters(other.mParameters),
+    mTopologyVersion(other.mTopologyVersion)
+{
+    bindLayerParameters(); // copied layers still view the other network's arena
+}
+
+NNetwork& NNetwork::operator=(const NNetwork& other)
+{
+    if(this != &other)
+    {
+        mNLayer = other.mNLayer;
+        mOutputClasses = other.mOutputClasses;
+        mDropOutGenerator = other.mDropOutGenerator;
+        mParameterLayout = other.mParameterLayout;
+        mParameters = other.mParameters;
+        mTopologyVersion = other.mTopologyVersion;
+        bindLayerParameters();
+    }
+    return *this;
+}
+
+void NNetwork::rebuildParameterArena()
+{
+    std::vector<std::pair<Eigen::Index, Eigen::Index>> weightShapes;
+    for(size_t layerPos = INPUT_LAYER_OFFSET; layerPos < mNLayer.size(); ++layerPos)
+    {
+        weightShapes.emplace_back(static_cast<Eigen::Index> (mNLayer[layerPos].numIncomingWeights()), static_cast<Eigen::Index> (mNLayer[layerPos].size()));
+    }
+    ParameterLayout newLayout(weightShapes);
+    AlignedParameterBuffer newParameters(newLayout.totalSz());
+
+    // layers still view the old arena so copy across any whose shape has not changed (others start at zero)
+    for(size_t layerPos = 0; layerPos < newLayout.numLayers(); ++layerPos)
+    {
+        NLayer& l = mNLayer[layerPos + INPUT_LAYER_OFFSET];
+        const ParameterLayout::LayerSlot& slot = newLayout.slot(layerPos);
+        if(l.mLayerWeights.data() == nullptr || l.mLayerWeights.rows() != slot.rows || l.mLayerWeights.cols() != slot.cols)
+        {
+            continue;
+        }
+        newParameters.region(slot.weightsOffset, static_cast<size_t> (slot.rows * slot.cols)) = l.mLayerWeights.reshaped();
+        newParameters.region(newLayout.weightsSz() + slot.biasesOffset, static_cast<size_t> (slot.cols)) = l.mLayerBiases.transpose();
+    }
+    mParameterLayout = std::move(newLayout);
+    mParameters = std::move(newParameters);
+    mTopologyVersion = ++topologyVersionCounter;
+    bindLayerParameters();
+}
+
+void NNetwork::bindLayerParameters()
+{
+    mNLayer[0].bindParameters(nullptr, nullptr); // the input layer has no parameters
+    for(size_t layerPos = 0; layerPos < mParameterLayout.numLayers(); ++layerPos)
+    {
+        const ParameterLayout::LayerSlot& slot = mParameterLayout.slot(layerPos);
+        mNLayer[layerPos + INPUT_LAYER_OFFSET].bindParameters(mParameters.data() + slot.weightsOffset,
+                                                              mParameters.data() + mParameterLayout.weightsSz() + slot.biasesOffset);
+    }
+}
+
+const ParameterLayout& NNetwork::parameterLayout() const
+{
+    return mParameterLayout;
+}
+
+FlatParametersT NNetwork::weightParameters()
+{
+    return mParameters.region(0, mParameterLayout.weightsSz());
+}
+
+FlatParametersT NNetwork::biasParameters()
+{
+    return mParameters.region(mParameterLayout.weightsSz(), mParameterLayout.biasesSz());
+}
+
+size_t NNetwork::topologyVersion() const
+{
+    return mTopologyVersion;
 }
 
 NLayer& NNetwork::layer(size_t layer)
@@ -71,6 +161,7 @@ bool NNetwork::addLayer(size_t layerSz, size_t insertLayerBefore)
     const auto prevLayerPos = newLayerPos - 1, nextLayerPos = newLayerPos + 1;
     newLayerPos->resizeNumWeightsPerNeuron(prevLayerPos->size());
     nextLayerPos->resizeNumWeightsPerNeuron(newLayerPos->size());
+    rebuildParameterArena();
     return true;
 }
 
@@ -82,6 +173,7 @@ void NNetwork::changeLayerSz(size_t layerPos, size_t newLayerSz)
     {
         nextLayer->resizeNumWeightsPerNeuron(newLayerSz);
     }
+    rebuildParameterArena();
 }
 
 NLayer& NNetwork::outputLayer()  {
@@ -105,79 +197,90 @@ const std::map<ClassT, size_t>& NNetwork::classes() const
 
 void NNetwork::feedforward(const ActFuncList& actFuncs, NetNumT dropOutRate)
 {
-    std::bernoulli_distribution distribution(1 - dropOutRate);
-    if (actFuncs.size() != numLayers())
+    SingleRowT dropOutMask;
+    if (dropOutRate > 0)
     {
-        throw std::logic_error("Number of activation functions does not match layers in network");
+        // Find the maximum layer size for dropout mask allocation
+        Eigen::Index maxSize = 0;
+        for (const auto& layer : mNLayer)
+        {
+            maxSize = std::max(maxSize, static_cast<Eigen::Index>(layer.size()));
+        }
+        dropOutMask.resize(1, maxSize);
     }
+    feedforwardWithMask(actFuncs, dropOutRate, dropOutMask.data(), nullptr);
+}
 
-    // Find the maximum layer size for dropout mask pre-allocation
-    Eigen::Index maxSize = 0;
-    for (const auto& layer : mNLayer)
+void NNetwork::feedforward(const ActFuncList& actFuncs, NetNumT dropOutRate, ExecutionPlan& plan)
+{
+    if (!plan.isValidFor(*this))
     {
-        maxSize = std::max(maxSize, static_cast<Eigen::Index>(layer.size()));
+        throw std::logic_error("Execution plan was built for a different topology");
+    }
+    feedforwardWithMask(actFuncs, dropOutRate, plan.dropOutMask().data(), &plan);
+}
+
+void NNetwork::feedforwardWithMask(const ActFuncList& actFuncs, NetNumT dropOutRate, NetNumT* dropOutMaskData, const ExecutionPlan* plan)
+{
+    if (actFuncs.size() != numLayers())
+    {
+        throw std::logic_error("Number of activation functions does not match layers in network");
     }
-    SingleRowT dropOutMask(1, maxSize);
 
     // starting at the first hidden layer and then moving to the output layer...
     for(size_t layerPos = 0 + INPUT_LAYER_OFFSET; layerPos < mNLayer.size(); ++layerPos)
     {
+        PhaseTimer layerTimer(ProfiledPhase::FORWARD, layerPos - INPUT_LAYER_OFFSET);
         auto& layer = mNLayer[layerPos]; // current layer
         const SingleRowT& prevLayerOutput = mNLayer[layerPos - 1].getOutputs(); // outputs from previous layer
-        layer.mLayerOutputs.noalias() = (prevLayerOutput * layer.getWeights()) +  layer.getBiases().row(0); // calculate matrix multiplication and add biases
-
-        // apply drop out
-        if (layerPos < mNLayer.size() - 1 && dropOutRate > 0) // Except the output layer
+        // drop out mask for the layer (except the output layer)
+        const bool applyDropOut = layerPos < mNLayer.size() - 1 && dropOutRate > 0;
+        if(applyDropOut)
         {
-            dropOutMask.leftCols(layer.size()).setZero();
-            for(Eigen::Index maskPos = 0; maskPos < layer.size(); ++maskPos)
-            {
-                dropOutMask(0, maskPos) = distribution(gen);
-            }
-            layer.mLayerOutputs.array() *= dropOutMask.leftCols(layer.size()).array();
-            layer.mLayerOutputs.array() /= (1 - dropOutRate);
+            drawDropOutMask(dropOutRate, Eigen::Map<SingleRowT>(dropOutMaskData, static_cast<Eigen::Index> (layer.size())));
         }
-        // apply activation function
-        applyActFuncToLayer(layer.mLayerOutputs, actFuncs[layerPos - 1]);
 
-        if (!layer.mLayerOutputs.allFinite())
+        // calculate matrix multiplication...
+        const LayerParallelism parallelism = plan ? plan->sampleParallelism(layerPos - INPUT_LAYER_OFFSET) : LayerParallelism::GEMM;
+        if(parallelism == LayerParallelism::GEMM)
+        {
+            layer.mLayerOutputs.noalias() = prevLayerOutput * layer.getWeights();
+        }
+        else
+        {
+            multiplyLayer(prevLayerOutput, layer.getWeights(), layer.mLayerOutputs, parallelism); // wide layers split over threads
+        }
+        // ...then biases, drop out and the activation function in one pass
+        if (!fusedLayerEpilogue(layer.mLayerOutputs, layer.getBiases(), actFuncs[layerPos - 1], applyDropOut ? dropOutMaskData : nullptr, 1 / (1 - dropOutRate)))
         {
             throw std::logic_error("(5) INF or NaN");
         }
     }
 }
 
-void NNetwork::applyActFuncToLayer(SingleRowT& netInputs, ActFunc actFunc)
+void NNetwork::drawDropOutMask(NetNumT dropOutRate, Eigen::Ref<SingleRowT> mask)
 {
-    if (netInputs.size() < 1) {
-        throw std::logic_error("Size of netinputs is 0");
+    std::bernoulli_distribution distribution(1 - dropOutRate);
+    for(Eigen::Index maskPos = 0; maskPos < mask.size(); ++maskPos)
+    {
+        mask(0, maskPos) = distribution(mDropOutGenerator);
     }
+}
 
-    switch (actFunc) {
-        case ActFunc::SIGMOID: {
-            netInputs = 1.0 / (1.0 + (-netInputs.array()).exp());
-            break;
-        }
-
-        case ActFunc::RELU: {
-            netInputs = netInputs.cwiseMax(0);
-            break;
-        }
-
-        case ActFunc::SOFTMAX: {
-            // compute normalised e^x
-            const auto maxCoeff = netInputs.maxCoeff();
-            if (std::isnan(maxCoeff) || std::isinf(maxCoeff)) {
-                throw std::logic_error("Max coefficient is NaN or INF");
-            }
-            const auto inputsAsNormExp = (netInputs.array() - maxCoeff).exp();
-            const double expSum = inputsAsNormExp.sum();
-            netInputs = inputsAsNormExp / expSum ;
-            break;
-        }
+std::string NNetwork::dropOutGeneratorState() const
+{
+    std::ostringstream state;
+    state << mDropOutGenerator;
+    return state.str();
+}
 
-        default:
-            throw std::runtime_error("Unsupported activation function");
+void NNetwork::setDropOutGeneratorState(const std::string& state)
+{
+    std::istringstream stateStream(state);
+    stateStream >> mDropOutGenerator;
+    if(stateStream.fail())
+    {
+        throw std::logic_error("Invalid drop out generator state");
     }
 }
 
@@ -11,6 +11,8 @@
 #include <functional>
 #include <map>
 #include <set>
+#include <random>
+#include <string>
 #include "Eigen/Dense"
 
 #include "DataSpecs.h"
@@ -18,6 +20,7 @@
 using ClassT = std::string;
 using ClassList = std::set<ClassT>;
 using InputList = Eigen::Matrix<NUM_TYPE, 1, Eigen::Dynamic>;
+using BatchActivationsT = Eigen::Matrix<NetNumT, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>; // one row per sample
 
 enum class ActFunc
 {
@@ -28,18 +31,31 @@ enum class ActFunc
 
 using ActFuncList = std::vector<ActFunc>;
 
+class ExecutionPlan;
+
 class NNetwork
 {
     private:
         std::vector<NLayer> mNLayer;
         std::map<ClassT, size_t> mOutputClasses; // ordered list of classes
+        std::default_random_engine mDropOutGenerator{12345}; // per network so networks can be trained concurrently
+        ParameterLayout mParameterLayout;
+        AlignedParameterBuffer mParameters; // every layer's weights and biases, see ParameterLayout
+        size_t mTopologyVersion = 0; // changes whenever the layers change shape (invalidates execution plans)
 
-        const size_t INPUT_LAYER_OFFSET = 1;
+        static constexpr size_t INPUT_LAYER_OFFSET = 1;
 
-        static  void applyActFuncToLayer(SingleRowT& netInputs, ActFunc actFunc);
+        // lay out a new arena for the current topology (keeping the values of layers whose shape is unchanged)
+        void rebuildParameterArena();
+        void bindLayerParameters();
+        void feedforwardWithMask(const ActFuncList& actFuncs, NetNumT dropOutRate, NetNumT* dropOutMask, const ExecutionPlan* plan);
 
     public:
         NNetwork(size_t inputSz, const ClassList& labels);
+        NNetwork(const NNetwork& other);
+        NNetwork& operator=(const NNetwork& other);
+        NNetwork(NNetwork&& other) noexcept = default; // the arena moves with its layers' views
+        NNetwork& operator=(NNetwork&& other) noexcept = default;
 
         NLayer& layer(size_t layer);
         NLayer& outputLayer() ;
@@ -54,7 +70,20 @@ class NNetwork
 
         [[nodiscard]] const std::map<ClassT, size_t>& classes() const;
 
+        // the flat parameter arena (layer views alias it)
+        [[nodiscard]] const ParameterLayout& parameterLayout() const;
+        FlatParametersT weightParameters();
+        FlatParametersT biasParameters();
+        [[nodiscard]] size_t topologyVersion() const;
+
         void feedforward(const ActFuncList& actFuncs, NetNumT dropOutRate);
+        void feedforward(const ActFuncList& actFuncs, NetNumT dropOutRate, ExecutionPlan& plan); // no allocations
+
+        // the next drop out mask from this network's generator (1 keeps a neuron), in the order feedforward draws them
+        void drawDropOutMask(NetNumT dropOutRate, Eigen::Ref<SingleRowT> mask);
+        // state of the drop out random number generator (saved in checkpoints)
+        [[nodiscard]] std::string dropOutGeneratorState() const;
+        void setDropOutGeneratorState(const std::string& state);
 
         std::ostream& summarise(std::ostream& printer);
 
@@ -0,0 +1,393 @@
+//
+// Created by Lenovo on 20/07/2023.
+//
+
+#include "ParallelPolicy.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+#include <omp.h>
+
+namespace
+{
+    ParallelismPolicy& activePolicy()
+    {
+        static ParallelismPolicy policy;
+        return policy;
+    }
+
+    // best of a few rounds, each repeating the product for long enough to time
+    double secondsPerProduct(const BatchActivationsT& inputs, const LayerWeightsT& weights, BatchActivationsT& outputs, LayerParallelism parallelism)
+    {
+        constexpr double MIN_ROUND_SECONDS = 0.002;
+        multiplyLayer(inputs, weights, outputs, parallelism); // warm up
+        double best = std::numeric_limits<double>::max();
+        for(int round = 0; round < 3; ++round)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            size_t reps = 0;
+            double seconds;
+            do
+            {
+                multiplyLayer(inputs, weights, outputs, parallelism);
+                ++reps;
+                seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } while(seconds < MIN_ROUND_SECONDS);
+            best = std::min(best, seconds / static_cast<double> (reps));
+        }
+        return best;
+    }
+
+    // whether the strategy beats a single product (by a margin, so noise does not flip the decision) for each square layer size
+    std::vector<bool> measureWins(Eigen::Index rows, const std::vector<Eigen::Index>& layerSzs, LayerParallelism parallelism)
+    {
+        std::vector<bool> wins;
+        for(const Eigen::Index layerSz : layerSzs)
+        {
+            const BatchActivationsT inputs = BatchActivationsT::Random(rows, layerSz);
+            const LayerWeightsT weights = LayerWeightsT::Random(layerSz, layerSz);
+            BatchActivationsT outputs(rows, layerSz);
+            const double gemmSeconds = secondsPerProduct(inputs, weights, outputs, LayerParallelism::GEMM);
+            wins.push_back(secondsPerProduct(inputs, weights, outputs, parallelism) < 0.95 * gemmSeconds);
+        }
+        return wins;
+    }
+
+    double multiplyAdds(Eigen::Index rows, Eigen::Index inputs, Eigen::Index neurons)
+    {
+        return static_cast<double> (rows) * static_cast<double> (inputs) * static_cast<double> (neurons);
+    }
+
+    // rounds packed blocks up to whole cache lines so each starts aligned
+    Eigen::Index paddedPackingSz(Eigen::Index numElements)
+    {
+        constexpr Eigen::Index elementsPerLine = 64 / sizeof(NetNumT);
+        return (numElements + elementsPerLine - 1) / elementsPerLine * elementsPerLine;
+    }
+
+    // Eigen's blocking with its packed blocks already in place, so the product does not allocate them
+    class PreallocatedBlocking : public Eigen::internal::level3_blocking<NetNumT, NetNumT>
+    {
+        public:
+            PreallocatedBlocking(const GemmBlocking& blocking, NetNumT* packing)
+            {
+                m_kc = blocking.kc;
+                m_mc = blocking.mc;
+                m_nc = blocking.nc;
+                m_blockA = packing;
+                m_blockB = packing + paddedPackingSz(blocking.kc * blocking.mc);
+            }
+    };
+
+    // res += lhs * rhs (rows x depth times depth x cols) as a single threaded product packed into the thread's buffers
+    template<int LhsOrder, int RhsOrder, int ResOrder>
+    void packedProduct(Eigen::Index rows, Eigen::Index cols, Eigen::Index depth, const NetNumT* lhs, Eigen::Index lhsStride,
+                       const NetNumT* rhs, Eigen::Index rhsStride, NetNumT* res, Eigen::Index resStride, const GemmPacking& packing, int thread)
+    {
+        if(rows == 0 || cols == 0 || depth == 0)
+        {
+            return;
+        }
+        PreallocatedBlocking blocking(packing.blocking, packing.buffers + static_cast<size_t> (thread) * packing.blocking.packingSz());
+        Eigen::internal::general_matrix_matrix_product<Eigen::Index, NetNumT, LhsOrder, false, NetNumT, RhsOrder, false, ResOrder, 1>::run(
+            rows, cols, depth, lhs, lhsStride, rhs, rhsStride, res, 1, resStride, 1, blocking);
+    }
+
+    // vector results go to Eigen's matrix-vector products, which do not pack
+    bool isPacked(const GemmPacking* packing, Eigen::Index resultRows, Eigen::Index resultCols)
+    {
+        return packing && resultRows > 1 && resultCols > 1;
+    }
+
+    // outputs = errors * weights^T
+    void multiplyTransposedBlock(const Eigen::Ref<const BatchActivationsT>& errors, const Eigen::Ref<const LayerWeightsT>& weights,
+                                 Eigen::Ref<BatchActivationsT> outputs, const GemmPacking* packing, int thread)
+    {
+        if(!isPacked(packing, outputs.rows(), outputs.cols()))
+        {
+            outputs.noalias() = errors * weights.transpose();
+            return;
+        }
+        // the transposed column major weights are row major
+        outputs.setZero();
+        packedProduct<Eigen::RowMajor, Eigen::RowMajor, Eigen::RowMajor>(outputs.rows(), outputs.cols(), errors.cols(), errors.data(), errors.outerStride(),
+                                                                         weights.data(), weights.outerStride(), outputs.data(), outputs.outerStride(), *packing, thread);
+    }
+
+    // weightGrads += prevOutputs^T * errors
+    void accumulateWeightGradientsBlock(const Eigen::Ref<const BatchActivationsT>& prevOutputs, const Eigen::Ref<const BatchActivationsT>& errors,
+                                        Eigen::Ref<LayerWeightsT> weightGrads, const GemmPacking* packing, int thread)
+    {
+        if(!isPacked(packing, weightGrads.rows(), weightGrads.cols()))
+        {
+            weightGrads.noalias() += prevOutputs.transpose() * errors;
+            return;
+        }
+        // the transposed row major outputs are column major
+        packedProduct<Eigen::ColMajor, Eigen::RowMajor, Eigen::ColMajor>(weightGrads.rows(), weightGrads.cols(), errors.rows(), prevOutputs.data(), prevOutputs.outerStride(),
+                                                                         errors.data(), errors.outerStride(), weightGrads.data(), weightGrads.outerStride(), *packing, thread);
+    }
+
+    // the threads a product may use - no more than its packing has buffers for
+    int productThreads(const GemmPacking* packing)
+    {
+        return packing ? std::min(Eigen::nbThreads(), packing->threads) : Eigen::nbThreads();
+    }
+
+    std::string describeThreshold(double value, double scale, const char* unit, const char* unlimited)
+    {
+        return value == ParallelismPolicy::NEVER ? std::string(unlimited) : std::to_string(static_cast<long long> (value / scale)) + unit;
+    }
+}
+
+const char* layerParallelismName(LayerParallelism parallelism)
+{
+    switch(parallelism)
+    {
+        case LayerParallelism::GEMM: return "gemm";
+        case LayerParallelism::SAMPLES: return "samples";
+        case LayerParallelism::COLUMNS: return "columns";
+    }
+    return "unknown";
+}
+
+ParallelismPolicy ParallelismPolicy::calibrate(size_t threads, Eigen::Index maxLayerSz)
+{
+    ParallelismPolicy policy;
+    policy.mCalibratedThreads = threads;
+    if(threads <= 1)
+    {
+        policy.mMinSamplesWork = policy.mMinColumnsWork = NEVER;
+        return policy;
+    }
+    // the products are timed with the thread count being calibrated
+    const int prevThreads = Eigen::nbThreads();
+    Eigen::setNbThreads(static_cast<int> (threads));
+    std::vector<Eigen::Index> layerSzs;
+    for(Eigen::Index layerSz = 32; layerSz <= maxLayerSz; layerSz *= 2)
+    {
+        layerSzs.push_back(layerSz);
+    }
+
+    // batches: splitting rows loses on small layers (fork / join overhead) and on large ones (every thread streams all the weights)
+    const Eigen::Index batchRows = std::max<Eigen::Index>(64, static_cast<Eigen::Index> (threads) * MIN_ROWS_PER_THREAD * 4);
+    const std::vector<bool> samplesWins = measureWins(batchRows, layerSzs, LayerParallelism::SAMPLES);
+    const auto firstWin = std::find(samplesWins.begin(), samplesWins.end(), true);
+    if(firstWin == samplesWins.end())
+    {
+        policy.mMinSamplesWork = NEVER;
+    }
+    else
+    {
+        const auto winPos = static_cast<size_t> (firstWin - samplesWins.begin());
+        policy.mMinSamplesWork = multiplyAdds(batchRows, layerSzs[winPos], layerSzs[winPos]);
+        const auto firstLoss = std::find(firstWin, samplesWins.end(), false);
+        const Eigen::Index lastWinSz = layerSzs[static_cast<size_t> (firstLoss - samplesWins.begin()) - 1];
+        policy.mMaxSampleWeightBytes = firstLoss == samplesWins.end() ? NEVER : static_cast<double> (lastWinSz * lastWinSz * static_cast<Eigen::Index> (sizeof(NetNumT)));
+    }
+
+    // single samples: splitting columns wins from some layer size on
+    const std::vector<bool> columnsWins = measureWins(1, layerSzs, LayerParallelism::COLUMNS);
+    const auto lastLoss = std::find(columnsWins.rbegin(), columnsWins.rend(), false);
+    const auto winsFrom = static_cast<size_t> (columnsWins.rend() - lastLoss); // the run of wins up to the largest size
+    policy.mMinColumnsWork = winsFrom == layerSzs.size() ? NEVER : multiplyAdds(1, layerSzs[winsFrom], layerSzs[winsFrom]);
+
+    Eigen::setNbThreads(prevThreads);
+    return policy;
+}
+
+ParallelismPolicy ParallelismPolicy::fromEnvironment(size_t threads)
+{
+    const char* calibrateValue = std::getenv("NNETWORK_CALIBRATE_PARALLELISM");
+    return calibrateValue && std::string(calibrateValue) != "0" ? calibrate(threads) : ParallelismPolicy();
+}
+
+LayerParallelism ParallelismPolicy::choose(Eigen::Index rows, Eigen::Index inputs, Eigen::Index neurons, size_t threads) const
+{
+    if(threads <= 1)
+    {
+        return LayerParallelism::GEMM;
+    }
+    const auto numThreads = static_cast<Eigen::Index> (threads);
+    const double work = multiplyAdds(rows, inputs, neurons);
+    if(rows >= numThreads * MIN_ROWS_PER_THREAD)
+    {
+        const auto weightBytes = static_cast<double> (inputs * neurons * static_cast<Eigen::Index> (sizeof(NetNumT)));
+        return work >= mMinSamplesWork && weightBytes <= mMaxSampleWeightBytes ? LayerParallelism::SAMPLES : LayerParallelism::GEMM;
+    }
+    return work >= mMinColumnsWork && neurons >= numThreads * MIN_COLUMNS_PER_THREAD ? LayerParallelism::COLUMNS : LayerParallelism::GEMM;
+}
+
+void ParallelismPolicy::summarise(std::ostream& out) const
+{
+    out << "Parallelism policy (" << (mCalibratedThreads > 0 ? "calibrated for " + std::to_string(mCalibratedThreads) + " threads" : std::string("heuristic"))
+        << "): split samples from " << describeThreshold(mMinSamplesWork, 1e3, "K multiply-adds", "never") << " with weights up to "
+        << describeThreshold(mMaxSampleWeightBytes, 1024, "KB", "any size") << ", split columns from "
+        << describeThreshold(mMinColumnsWork, 1e3, "K multiply-adds", "never") << "\n";
+}
+
+const ParallelismPolicy& activeParallelismPolicy()
+{
+    return activePolicy();
+}
+
+void setParallelismPolicy(const ParallelismPolicy& policy)
+{
+    activePolicy() = policy;
+}
+
+//***********//
+
+std::pair<Eigen::Index, Eigen::Index> splitRange(Eigen::Index total, int part, int parts, Eigen::Index alignTo)
+{
+    const Eigen::Index units = (total + alignTo - 1) / alignTo;
+    const Eigen::Index start = std::min(total, units * part / parts * alignTo);
+    const Eigen::Index end = std::min(total, units * (part + 1) / parts * alignTo);
+    return {start, end - start};
+}
+
+GemmBlocking GemmBlocking::forProduct(Eigen::Index rows, Eigen::Index depth, Eigen::Index cols, bool rowMajorResult)
+{
+    GemmBlocking blocking;
+    blocking.kc = depth;
+    blocking.mc = rowMajorResult ? cols : rows;
+    blocking.nc = rowMajorResult ? rows : cols;
+    Eigen::internal::computeProductBlockingSizes<NetNumT, NetNumT>(blocking.kc, blocking.mc, blocking.nc);
+    return blocking;
+}
+
+size_t GemmBlocking::packingSz() const
+{
+    return static_cast<size_t> (paddedPackingSz(kc * mc) + paddedPackingSz(kc * nc));
+}
+
+void multiplyLayerBlock(const Eigen::Ref<const BatchActivationsT>& inputs, const Eigen::Ref<const LayerWeightsT>& weights,
+                        Eigen::Ref<BatchActivationsT> outputs, const GemmPacking* packing, int thread)
+{
+    if(!isPacked(packing, outputs.rows(), outputs.cols()))
+    {
+        outputs.noalias() = inputs * weights;
+        return;
+    }
+    outputs.setZero();
+    packedProduct<Eigen::RowMajor, Eigen::ColMajor, Eigen::RowMajor>(outputs.rows(), outputs.cols(), inputs.cols(), inputs.data(), inputs.outerStride(),
+                                                                     weights.data(), weights.outerStride(), outputs.data(), outputs.outerStride(), *packing, thread);
+}
+
+void multiplyLayer(const Eigen::Ref<const BatchActivationsT>& inputs, const Eigen::Ref<const LayerWeightsT>& weights,
+                   Eigen::Ref<BatchActivationsT> outputs, LayerParallelism parallelism, const GemmPacking* packing)
+{
+    const int threads = productThreads(packing);
+    // inside the parallel regions Eigen sees a team already running so each product stays single threaded
+    if(parallelism == LayerParallelism::SAMPLES && threads > 1 && inputs.rows() > 1)
+    {
+#pragma omp parallel num_threads(threads)
+        {
+            const auto [start, count] = splitRange(inputs.rows(), omp_get_thread_num(), omp_get_num_threads(), 1);
+            if(count > 0)
+            {
+                multiplyLayerBlock(inputs.middleRows(start, count), weights, outputs.middleRows(start, count), packing, omp_get_thread_num());
+            }
+        }
+        return;
+    }
+    if(parallelism == LayerParallelism::COLUMNS && threads > 1 && weights.cols() > 1)
+    {
+        // whole cache lines of outputs per thread
+#pragma omp parallel num_threads(threads)
+        {
+            const auto [start, count] = splitRange(weights.cols(), omp_get_thread_num(), omp_get_num_threads(), ParallelismPolicy::MIN_COLUMNS_PER_THREAD);
+            if(count > 0)
+            {
+                multiplyLayerBlock(inputs, weights.middleCols(start, count), outputs.middleCols(start, count), packing, omp_get_thread_num());
+            }
+        }
+        return;
+    }
+    multiplyLayerBlock(inputs, weights, outputs, packing, 0);
+}
+
+void multiplyLayerTransposed(const Eigen::Ref<const BatchActivationsT>& errors, const Eigen::Ref<const LayerWeightsT>& weights,
+                             Eigen::Ref<BatchActivationsT> outputs, LayerParallelism parallelism, const GemmPacking* packing)
+{
+    const int threads = productThreads(packing);
+    if(parallelism == LayerParallelism::SAMPLES && threads > 1 && errors.rows() > 1)
+    {
+#pragma omp parallel num_threads(threads)
+        {
+            const auto [start, count] = splitRange(errors.rows(), omp_get_thread_num(), omp_get_num_threads());
+            if(count > 0)
+            {
+                multiplyTransposedBlock(errors.middleRows(start, count), weights, outputs.middleRows(start, count), packing, omp_get_thread_num());
+            }
+        }
+        return;
+    }
+    if(parallelism == LayerParallelism::COLUMNS && threads > 1 && weights.rows() > 1)
+    {
+#pragma omp parallel num_threads(threads)
+        {
+            const auto [start, count] = splitRange(weights.rows(), omp_get_thread_num(), omp_get_num_threads(), ParallelismPolicy::MIN_COLUMNS_PER_THREAD);
+            if(count > 0)
+            {
+                multiplyTransposedBlock(errors, weights.middleRows(start, count), outputs.middleCols(start, count), packing, omp_get_thread_num());
+            }
+        }
+        return;
+    }
+    multiplyTransposedBlock(errors, weights, outputs, packing, 0);
+}
+
+void accumulateWeightGradients(const Eigen::Ref<const BatchActivationsT>& prevOutputs, const Eigen::Ref<const BatchActivationsT>& errors,
+                               Eigen::Ref<LayerWeightsT> weightGrads, LayerParallelism parallelism, NetNumT* partials, size_t numPartials,
+                               const GemmPacking* packing)
+{
+    const int threads = std::min(productThreads(packing), static_cast<int> (numPartials) + 1);
+    if(parallelism == LayerParallelism::SAMPLES && threads > 1 && partials && errors.rows() > 1)
+    {
+#pragma omp parallel num_threads(threads)
+        {
+            const int thread = omp_get_thread_num(), numThreads = omp_get_num_threads();
+            const auto [start, count] = splitRange(errors.rows(), thread, numThreads);
+            const auto prevRows = prevOutputs.middleRows(start, count);
+            const auto errorRows = errors.middleRows(start, count);
+            if(thread == 0)
+            {
+                accumulateWeightGradientsBlock(prevRows, errorRows, weightGrads, packing, thread);
+            }
+            else
+            {
+                Eigen::Map<LayerWeightsT> partial(partials + static_cast<Eigen::Index> (thread - 1) * weightGrads.size(), weightGrads.rows(), weightGrads.cols());
+                partial.setZero(); // empty rows leave zeros
+                accumulateWeightGradientsBlock(prevRows, errorRows, partial, packing, thread);
+            }
+#pragma omp barrier
+            // then each thread sums its own columns of the partials
+            const auto [firstCol, numCols] = splitRange(weightGrads.cols(), thread, numThreads);
+            for(int part = 0; part < numThreads - 1; ++part)
+            {
+                Eigen::Map<const LayerWeightsT> partial(partials + static_cast<Eigen::Index> (part) * weightGrads.size(), weightGrads.rows(), weightGrads.cols());
+                weightGrads.middleCols(firstCol, numCols) += partial.middleCols(firstCol, numCols);
+            }
+        }
+        return;
+    }
+    if(parallelism == LayerParallelism::COLUMNS && productThreads(packing) > 1 && errors.cols() > 1)
+    {
+        // each thread owns some neurons' gradients so nothing needs reducing
+#pragma omp parallel num_threads(productThreads(packing))
+        {
+            const auto [start, count] = splitRange(errors.cols(), omp_get_thread_num(), omp_get_num_threads(), ParallelismPolicy::MIN_COLUMNS_PER_THREAD);
+            if(count > 0)
+            {
+                accumulateWeightGradientsBlock(prevOutputs, errors.middleCols(start, count), weightGrads.middleCols(start, count), packing, omp_get_thread_num());
+            }
+        }
+        return;
+    }
+    accumulateWeightGradientsBlock(prevOutputs, errors, weightGrads, packing, 0);
+}
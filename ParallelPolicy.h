@@ -0,0 +1,97 @@
+//
+// Created by Lenovo on 20/07/2023.
+//
+
+#ifndef NNETWORK2_PARALLELPOLICY_H
+#define NNETWORK2_PARALLELPOLICY_H
+
+#include <limits>
+#include <ostream>
+#include <utility>
+
+#include "NNetwork.h"
+
+// how one layer's (rows x inputs) * (inputs x neurons) product uses the intra-op threads (Eigen::nbThreads())
+enum class LayerParallelism
+{
+        GEMM, // a single product - Eigen threads it when it is large enough to pay off
+        SAMPLES, // the batch's rows split across threads, a single threaded product each
+        COLUMNS // the output neurons split across threads - for few rows and wide layers
+};
+
+const char* layerParallelismName(LayerParallelism parallelism);
+
+// Decides per layer shape which LayerParallelism to use. Eigen only threads large GEMMs so per sample products leave its
+// threads idle, while very large products are better left to Eigen's shared packing. The crossovers default to
+// heuristics or can be measured on this machine with calibrate()
+class ParallelismPolicy
+{
+    private:
+        double mMinSamplesWork = 1 << 18; // multiply-adds from which splitting rows beats one product
+        double mMinColumnsWork = 1 << 18; // multiply-adds from which splitting columns beats one product
+        double mMaxSampleWeightBytes = 1 << 20; // beyond this each thread streaming all the weights loses to Eigen's GEMM
+        size_t mCalibratedThreads = 0; // 0 when using the heuristics
+
+    public:
+        static constexpr Eigen::Index MIN_ROWS_PER_THREAD = 4;
+        static constexpr Eigen::Index MIN_COLUMNS_PER_THREAD = 16;
+        static constexpr double NEVER = std::numeric_limits<double>::infinity();
+
+        ParallelismPolicy() = default;
+        // times each strategy for batched and single sample shapes of up to maxLayerSz neurons (takes a few seconds)
+        static ParallelismPolicy calibrate(size_t threads, Eigen::Index maxLayerSz = 2048);
+        // the heuristics, or calibrate(threads) when NNETWORK_CALIBRATE_PARALLELISM is set (other than to 0)
+        static ParallelismPolicy fromEnvironment(size_t threads);
+
+        [[nodiscard]] LayerParallelism choose(Eigen::Index rows, Eigen::Index inputs, Eigen::Index neurons, size_t threads) const;
+        void summarise(std::ostream& out) const;
+};
+
+// used by execution plans built from now on
+const ParallelismPolicy& activeParallelismPolicy();
+void setParallelismPolicy(const ParallelismPolicy& policy);
+
+// Eigen's cache blocking of one product, in its column major frame (an m x depth times depth x n product), and the packing
+// space a thread needs to run it. Blocking for the largest shape also fits any product with fewer rows, columns or depth
+struct GemmBlocking
+{
+    Eigen::Index kc = 0;
+    Eigen::Index mc = 0;
+    Eigen::Index nc = 0;
+
+    // for a (rows x depth) * (depth x cols) product - row major results are transposed into Eigen's frame
+    static GemmBlocking forProduct(Eigen::Index rows, Eigen::Index depth, Eigen::Index cols, bool rowMajorResult);
+    [[nodiscard]] size_t packingSz() const; // in NetNumT, a multiple of the cache line
+};
+
+// A product's blocking plus preallocated packing, so it runs without allocating: thread t packs into
+// buffers + t * blocking.packingSz(). Eigen's own threaded GEMM allocates its packing, so products given a packing are
+// single threaded unless split by samples or columns (over at most threads threads)
+struct GemmPacking
+{
+    GemmBlocking blocking;
+    NetNumT* buffers = nullptr;
+    int threads = 0;
+};
+
+// (start, count) of the part'th of parts near equal pieces of [0, total), each starting on a multiple of alignTo
+std::pair<Eigen::Index, Eigen::Index> splitRange(Eigen::Index total, int part, int parts, Eigen::Index alignTo = 1);
+
+// outputs = inputs * weights, parallelised as decided (over Eigen::nbThreads() threads). The products below use packing
+// when given (e.g. by an ExecutionPlan), else Eigen's products
+void multiplyLayer(const Eigen::Ref<const BatchActivationsT>& inputs, const Eigen::Ref<const LayerWeightsT>& weights,
+                   Eigen::Ref<BatchActivationsT> outputs, LayerParallelism parallelism, const GemmPacking* packing = nullptr);
+// back propagation: outputs = errors * weights^T (COLUMNS splits the weights' rows)
+void multiplyLayerTransposed(const Eigen::Ref<const BatchActivationsT>& errors, const Eigen::Ref<const LayerWeightsT>& weights,
+                             Eigen::Ref<BatchActivationsT> outputs, LayerParallelism parallelism, const GemmPacking* packing = nullptr);
+// weightGrads += prevOutputs^T * errors, summed over the rows (samples). SAMPLES gives each thread its own rows: thread 0
+// adds straight into weightGrads and thread t > 0 into partials + (t - 1) * weightGrads.size(), which are then reduced.
+// numPartials limits the threads to numPartials + 1
+void accumulateWeightGradients(const Eigen::Ref<const BatchActivationsT>& prevOutputs, const Eigen::Ref<const BatchActivationsT>& errors,
+                               Eigen::Ref<LayerWeightsT> weightGrads, LayerParallelism parallelism, NetNumT* partials, size_t numPartials,
+                               const GemmPacking* packing = nullptr);
+// outputs = inputs * weights as one product, packed into the given thread's buffers of packing (else Eigen's product)
+void multiplyLayerBlock(const Eigen::Ref<const BatchActivationsT>& inputs, const Eigen::Ref<const LayerWeightsT>& weights,
+                        Eigen::Ref<BatchActivationsT> outputs, const GemmPacking* packing, int thread);
+
+#endif //NNETWORK2_PARALLELPOLICY_H
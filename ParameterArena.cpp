@@ -0,0 +1,169 @@
+//
+// Created by Lenovo on 14/06/2023.
+//
+
+#include "ParameterArena.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+// number of elements in a block rounded up so the next block stays aligned
+static size_t paddedSz(size_t numElements)
+{
+    constexpr size_t elementsPerBlock = PARAMETER_ALIGNMENT / sizeof(NetNumT);
+    return (numElements + elementsPerBlock - 1) / elementsPerBlock * elementsPerBlock;
+}
+
+ParameterLayout::ParameterLayout(const std::vector<std::pair<Eigen::Index, Eigen::Index>>& weightShapes)
+{
+    for(const auto& [rows, cols] : weightShapes)
+    {
+        if(rows < 0 || cols < 0)
+        {
+            throw std::logic_error("Negative layer dimensions");
+        }
+        LayerSlot slot;
+        slot.rows = rows;
+        slot.cols = cols;
+        slot.weightsOffset = mWeightsSz;
+        slot.biasesOffset = mBiasesSz;
+        mWeightsSz += paddedSz(static_cast<size_t> (rows * cols));
+        mBiasesSz += paddedSz(static_cast<size_t> (cols));
+        mSlots.push_back(slot);
+    }
+}
+
+size_t ParameterLayout::numLayers() const
+{
+    return mSlots.size();
+}
+
+const ParameterLayout::LayerSlot& ParameterLayout::slot(size_t layer) const
+{
+    if(layer >= mSlots.size())
+    {
+        throw std::out_of_range("Layer does not exist");
+    }
+    return mSlots[layer];
+}
+
+size_t ParameterLayout::weightsSz() const
+{
+    return mWeightsSz;
+}
+
+size_t ParameterLayout::biasesSz() const
+{
+    return mBiasesSz;
+}
+
+size_t ParameterLayout::totalSz() const
+{
+    return mWeightsSz + mBiasesSz;
+}
+
+bool ParameterLayout::operator==(const ParameterLayout& other) const
+{
+    if(mSlots.size() != other.mSlots.size())
+    {
+        return false;
+    }
+    for(size_t layer = 0; layer < mSlots.size(); ++layer)
+    {
+        if(mSlots[layer].rows != other.mSlots[layer].rows || mSlots[layer].cols != other.mSlots[layer].cols)
+        {
+            return false;
+        }
+    }
+    return true; // offsets follow from the shapes
+}
+
+bool ParameterLayout::operator!=(const ParameterLayout& other) const
+{
+    return !(*this == other);
+}
+
+//***********//
+
+void AlignedParameterBuffer::FreeDeleter::operator()(NetNumT* ptr) const
+{
+    std::free(ptr);
+}
+
+AlignedParameterBuffer::AlignedParameterBuffer(size_t size) : mSize(size)
+{
+    if(size == 0)
+    {
+        return;
+    }
+    // aligned_alloc needs a multiple of the alignment
+    const size_t bytes = (size * sizeof(NetNumT) + PARAMETER_ALIGNMENT - 1) / PARAMETER_ALIGNMENT * PARAMETER_ALIGNMENT;
+    mData.reset(static_cast<NetNumT*> (std::aligned_alloc(PARAMETER_ALIGNMENT, bytes)));
+    if(!mData)
+    {
+        throw std::bad_alloc();
+    }
+    std::memset(mData.get(), 0, bytes);
+}
+
+AlignedParameterBuffer::AlignedParameterBuffer(const AlignedParameterBuffer& other) : AlignedParameterBuffer(other.mSize)
+{
+    if(mSize > 0)
+    {
+        std::memcpy(mData.get(), other.mData.get(), mSize * sizeof(NetNumT));
+    }
+}
+
+AlignedParameterBuffer& AlignedParameterBuffer::operator=(const AlignedParameterBuffer& other)
+{
+    if(this != &other)
+    {
+        if(mSize == other.mSize)
+        {
+            if(mSize > 0)
+            {
+                std::memcpy(mData.get(), other.mData.get(), mSize * sizeof(NetNumT)); // reuse the allocation
+            }
+        }
+        else
+        {
+            *this = AlignedParameterBuffer(other);
+        }
+    }
+    return *this;
+}
+
+NetNumT* AlignedParameterBuffer::data()
+{
+    return mData.get();
+}
+
+const NetNumT* AlignedParameterBuffer::data() const
+{
+    return mData.get();
+}
+
+size_t AlignedParameterBuffer::size() const
+{
+    return mSize;
+}
+
+FlatParametersT AlignedParameterBuffer::region(size_t offset, size_t size)
+{
+    if(offset + size > mSize)
+    {
+        throw std::out_of_range("Region exceeds parameter buffer");
+    }
+    return {mData.get() + offset, static_cast<Eigen::Index> (size)};
+}
+
+ConstFlatParametersT AlignedParameterBuffer::region(size_t offset, size_t size) const
+{
+    if(offset + size > mSize)
+    {
+        throw std::out_of_range("Region exceeds parameter buffer");
+    }
+    return {mData.get() + offset, static_cast<Eigen::Index> (size)};
+}
@@ -0,0 +1,92 @@
+//
+// Created by Lenovo on 14/06/2023.
+//
+
+#ifndef NNETWORK2_PARAMETERARENA_H
+#define NNETWORK2_PARAMETERARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Eigen/Dense"
+
+#include "DataSpecs.h"
+
+using NetNumT = NUM_TYPE;
+using LayerWeightsT =  Eigen::Matrix<NetNumT, Eigen::Dynamic, Eigen::Dynamic>;
+using SingleRowT = Eigen::Matrix<NetNumT, 1, Eigen::Dynamic>;
+
+// every block in an arena starts on a 64 byte boundary (a cache line / an AVX-512 register)
+constexpr size_t PARAMETER_ALIGNMENT = 64;
+
+// per layer views into a flat arena
+using LayerWeightsMapT = Eigen::Map<LayerWeightsT, Eigen::Aligned64>;
+using LayerBiasesMapT = Eigen::Map<SingleRowT, Eigen::Aligned64>;
+// a whole region of an arena (padding between layers included, it is always zero)
+using FlatParametersT = Eigen::Map<Eigen::Matrix<NetNumT, Eigen::Dynamic, 1>, Eigen::Aligned64>;
+using ConstFlatParametersT = Eigen::Map<const Eigen::Matrix<NetNumT, Eigen::Dynamic, 1>, Eigen::Aligned64>;
+
+// where each layer's weights and biases live in a flat arena - all weights first then all biases:
+// [ W0 | W1 | ... | Wn | b0 | b1 | ... | bn ]
+// gradient and optimizer state buffers use the same offsets so they can be updated in single passes
+class ParameterLayout
+{
+    public:
+        struct LayerSlot
+        {
+            Eigen::Index rows = 0; // incoming weights to each neuron
+            Eigen::Index cols = 0; // neurons in the layer
+            size_t weightsOffset = 0; // from the start of the weights region
+            size_t biasesOffset = 0; // from the start of the biases region
+        };
+
+    private:
+        std::vector<LayerSlot> mSlots;
+        size_t mWeightsSz = 0;
+        size_t mBiasesSz = 0;
+
+    public:
+        ParameterLayout() = default;
+        // one (rows, cols) weight shape per layer
+        explicit ParameterLayout(const std::vector<std::pair<Eigen::Index, Eigen::Index>>& weightShapes);
+
+        [[nodiscard]] size_t numLayers() const;
+        [[nodiscard]] const LayerSlot& slot(size_t layer) const;
+        [[nodiscard]] size_t weightsSz() const; // including padding
+        [[nodiscard]] size_t biasesSz() const; // including padding
+        [[nodiscard]] size_t totalSz() const;
+
+        bool operator==(const ParameterLayout& other) const;
+        bool operator!=(const ParameterLayout& other) const;
+};
+
+// zero initialised, 64 byte aligned flat buffer of NetNumT (deep copied)
+class AlignedParameterBuffer
+{
+    private:
+        struct FreeDeleter
+        {
+            void operator()(NetNumT* ptr) const;
+        };
+        std::unique_ptr<NetNumT[], FreeDeleter> mData;
+        size_t mSize = 0;
+
+    public:
+        AlignedParameterBuffer() = default;
+        explicit AlignedParameterBuffer(size_t size);
+        AlignedParameterBuffer(const AlignedParameterBuffer& other);
+        AlignedParameterBuffer& operator=(const AlignedParameterBuffer& other);
+        AlignedParameterBuffer(AlignedParameterBuffer&& other) noexcept = default;
+        AlignedParameterBuffer& operator=(AlignedParameterBuffer&& other) noexcept = default;
+
+        [[nodiscard]] NetNumT* data();
+        [[nodiscard]] const NetNumT* data() const;
+        [[nodiscard]] size_t size() const;
+
+        [[nodiscard]] FlatParametersT region(size_t offset, size_t size);
+        [[nodiscard]] ConstFlatParametersT region(size_t offset, size_t size) const;
+};
+
+#endif //NNETWORK2_PARAMETERARENA_H
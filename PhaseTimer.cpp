@@ -0,0 +1,174 @@
+//
+// Created by Lenovo on 26/06/2023.
+//
+
+#include "PhaseTimer.h"
+#include "Trace.h"
+
+#include <iomanip>
+
+static thread_local EpochStats* timerTarget = nullptr;
+
+const char* profiledPhaseName(ProfiledPhase phase)
+{
+    switch (phase)
+    {
+        case ProfiledPhase::SHUFFLE: return "shuffle";
+        case ProfiledPhase::GATHER: return "gather";
+        case ProfiledPhase::FORWARD: return "forward";
+        case ProfiledPhase::BACKWARD: return "backward";
+        case ProfiledPhase::WEIGHT_GRADIENTS: return "weight_gradients";
+        case ProfiledPhase::UPDATE: return "update";
+        case ProfiledPhase::EVALUATION: return "evaluation";
+    }
+    return "unknown";
+}
+
+double EpochStats::otherSeconds() const
+{
+    double phaseSeconds = 0;
+    for(size_t phase = 0; phase < NUM_PROFILED_PHASES; ++phase)
+    {
+        if(static_cast<ProfiledPhase> (phase) != ProfiledPhase::EVALUATION)
+        {
+            phaseSeconds += phases[phase].seconds;
+        }
+    }
+    return wallSeconds - phaseSeconds;
+}
+
+void EpochStats::finalise()
+{
+    samplesPerSecond = wallSeconds > 0 ? static_cast<double> (samples) / wallSeconds : 0;
+    trainingFlops = 0;
+    for(size_t layerPos = 0; layerPos < layers.size(); ++layerPos)
+    {
+        LayerStats& layer = layers[layerPos];
+        // a multiply and an add per weight for each of: the forward product, the weight gradient outer product and
+        // (except for the first layer) propagating the error back through the weights
+        const double layerFlops = 2.0 * static_cast<double> (layer.inputs * layer.neurons) * static_cast<double> (samples);
+        trainingFlops += layerFlops * (layerPos > 0 ? 3 : 2);
+        layer.forwardGflops = layer.forwardSeconds > 0 ? layerFlops / layer.forwardSeconds / 1e9 : 0;
+        layer.weightGradientGflops = layer.weightGradientSeconds > 0 ? layerFlops / layer.weightGradientSeconds / 1e9 : 0;
+    }
+    const double computeSeconds = phaseTimersEnabled() ? phases[static_cast<size_t> (ProfiledPhase::FORWARD)].seconds +
+                                                         phases[static_cast<size_t> (ProfiledPhase::BACKWARD)].seconds +
+                                                         phases[static_cast<size_t> (ProfiledPhase::WEIGHT_GRADIENTS)].seconds
+                                                       : wallSeconds;
+    gflops = computeSeconds > 0 ? trainingFlops / computeSeconds / 1e9 : 0;
+}
+
+void TrainingStats::writeJson(std::ostream& out) const
+{
+    out << std::setprecision(6) << std::defaultfloat;
+    out << "{\n  \"phaseTimers\": " << (phaseTimersEnabled() ? "true" : "false") << ",\n  \"epochs\": [\n";
+    for(size_t epochPos = 0; epochPos < epochs.size(); ++epochPos)
+    {
+        const EpochStats& stats = epochs[epochPos];
+        out << "    {\"epoch\": " << stats.epoch << ", \"samples\": " << stats.samples << ", \"wallSeconds\": " << stats.wallSeconds
+            << ", \"samplesPerSecond\": " << stats.samplesPerSecond << ", \"gflops\": " << stats.gflops
+            << ", \"otherSeconds\": " << stats.otherSeconds() << ",\n     \"phases\": {";
+        for(size_t phase = 0; phase < NUM_PROFILED_PHASES; ++phase)
+        {
+            out << (phase > 0 ? ", " : "") << "\"" << profiledPhaseName(static_cast<ProfiledPhase> (phase)) << "\": {\"seconds\": "
+                << stats.phases[phase].seconds << ", \"calls\": " << stats.phases[phase].calls << "}";
+        }
+        out << "},\n     \"layers\": [";
+        for(size_t layerPos = 0; layerPos < stats.layers.size(); ++layerPos)
+        {
+            const LayerStats& layer = stats.layers[layerPos];
+            out << (layerPos > 0 ? ", " : "") << "{\"inputs\": " << layer.inputs << ", \"neurons\": " << layer.neurons
+                << ", \"forwardSeconds\": " << layer.forwardSeconds << ", \"backwardSeconds\": " << layer.backwardSeconds
+                << ", \"weightGradientSeconds\": " << layer.weightGradientSeconds << ", \"forwardGflops\": " << layer.forwardGflops
+                << ", \"weightGradientGflops\": " << layer.weightGradientGflops << "}";
+        }
+        out << "]}" << (epochPos + 1 < epochs.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+std::ostream& printEpochStats(std::ostream& out, const EpochStats& stats)
+{
+    const std::streamsize prevPrecision = out.precision();
+    const std::ios_base::fmtflags prevFlags = out.flags();
+    out << " -> Throughput: " << std::fixed << std::setprecision(0) << stats.samplesPerSecond << " samples/s, "
+        << std::setprecision(2) << stats.gflops << " GFLOP/s" << std::endl;
+    if(phaseTimersEnabled())
+    {
+        out << " -> Phases (ms):";
+        for(size_t phase = 0; phase < NUM_PROFILED_PHASES; ++phase)
+        {
+            out << " " << profiledPhaseName(static_cast<ProfiledPhase> (phase)) << " " << stats.phases[phase].seconds * 1000;
+        }
+        out << " other " << stats.otherSeconds() * 1000 << std::endl;
+        for(size_t layerPos = 0; layerPos < stats.layers.size(); ++layerPos)
+        {
+            const LayerStats& layer = stats.layers[layerPos];
+            out << "   --> Layer " << layerPos << " (" << layer.inputs << "x" << layer.neurons << "): forward " << layer.forwardSeconds * 1000
+                << " ms (" << layer.forwardGflops << " GFLOP/s), backward " << layer.backwardSeconds * 1000 << " ms, weight gradients "
+                << layer.weightGradientSeconds * 1000 << " ms (" << layer.weightGradientGflops << " GFLOP/s)" << std::endl;
+        }
+    }
+    out.precision(prevPrecision);
+    out.flags(prevFlags);
+    return out;
+}
+
+PhaseTimerTarget::PhaseTimerTarget(EpochStats& stats) : mPrevTarget(timerTarget)
+{
+    timerTarget = &stats;
+}
+
+PhaseTimerTarget::~PhaseTimerTarget()
+{
+    timerTarget = mPrevTarget;
+}
+
+#ifdef NNETWORK_PHASE_TIMERS
+
+PhaseTimer::PhaseTimer(ProfiledPhase phase, size_t layer) :
+    mTarget(timerTarget),
+    mTracing(tracingActive()),
+    mPhase(phase),
+    mLayer(layer)
+{
+    if(mTarget != nullptr || mTracing)
+    {
+        mStart = std::chrono::steady_clock::now();
+    }
+}
+
+PhaseTimer::~PhaseTimer()
+{
+    if(mTarget == nullptr && !mTracing)
+    {
+        return;
+    }
+    const auto end = std::chrono::steady_clock::now();
+    if(mTracing)
+    {
+        recordTraceEvent(profiledPhaseName(mPhase), mLayer == NO_LAYER ? nullptr : "layer", static_cast<int64_t> (mLayer), mStart, end);
+    }
+    if(mTarget == nullptr)
+    {
+        return;
+    }
+    const double seconds = std::chrono::duration<double>(end - mStart).count();
+    if(mLayer == NO_LAYER)
+    {
+        PhaseStats& stats = mTarget->phases[static_cast<size_t> (mPhase)];
+        stats.seconds += seconds;
+        stats.calls++;
+        return;
+    }
+    if(mLayer >= mTarget->layers.size())
+    {
+        return; // the target was not sized for this network
+    }
+    LayerStats& layer = mTarget->layers[mLayer];
+    if(mPhase == ProfiledPhase::FORWARD) layer.forwardSeconds += seconds;
+    else if(mPhase == ProfiledPhase::BACKWARD) layer.backwardSeconds += seconds;
+    else if(mPhase == ProfiledPhase::WEIGHT_GRADIENTS) layer.weightGradientSeconds += seconds;
+}
+
+#endif
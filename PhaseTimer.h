@@ -0,0 +1,121 @@
+//
+// Created by Lenovo on 26/06/2023.
+//
+
+#ifndef NNETWORK2_PHASETIMER_H
+#define NNETWORK2_PHASETIMER_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+// Per phase / per layer timers for training. Built in unless configured with -DNNETWORK_PHASE_TIMERS=OFF, in which
+// case the timers compile to nothing (epoch totals and throughput are still recorded).
+// Timers record into the EpochStats targeted on the calling thread (see PhaseTimerTarget), and emit a trace event while
+// tracing (see Trace.h). Otherwise they are ignored.
+
+enum class ProfiledPhase
+{
+        SHUFFLE = 0, // start of an epoch
+        GATHER = 1, // fetching each batch
+        FORWARD = 2,
+        BACKWARD = 3, // layer (bias) gradients
+        WEIGHT_GRADIENTS = 4,
+        UPDATE = 5, // optimizer step
+        EVALUATION = 6
+};
+constexpr size_t NUM_PROFILED_PHASES = 7;
+constexpr size_t NO_LAYER = std::numeric_limits<size_t>::max();
+
+const char* profiledPhaseName(ProfiledPhase phase);
+
+struct PhaseStats
+{
+    double seconds = 0;
+    size_t calls = 0;
+};
+
+struct LayerStats
+{
+    size_t inputs = 0;
+    size_t neurons = 0;
+    double forwardSeconds = 0;
+    double backwardSeconds = 0;
+    double weightGradientSeconds = 0;
+    double forwardGflops = 0; // GFLOP/s
+    double weightGradientGflops = 0;
+};
+
+struct EpochStats
+{
+    size_t epoch = 0;
+    size_t samples = 0; // trained on
+    double wallSeconds = 0; // training only (evaluation is timed separately)
+    std::array<PhaseStats, NUM_PROFILED_PHASES> phases{};
+    std::vector<LayerStats> layers;
+    double samplesPerSecond = 0;
+    double trainingFlops = 0; // forward + backward + weight gradients over the epoch
+    double gflops = 0; // GFLOP/s over the time spent in those phases (wall time if timers are compiled out)
+
+    [[nodiscard]] double otherSeconds() const; // training time not covered by a phase
+    // fills in throughput / flop counts from the layer shapes once the epoch is over
+    void finalise();
+};
+
+struct TrainingStats
+{
+    std::vector<EpochStats> epochs;
+
+    void writeJson(std::ostream& out) const;
+};
+
+std::ostream& printEpochStats(std::ostream& out, const EpochStats& stats);
+
+constexpr bool phaseTimersEnabled()
+{
+#ifdef NNETWORK_PHASE_TIMERS
+    return true;
+#else
+    return false;
+#endif
+}
+
+// timers on this thread record into stats while in scope
+class PhaseTimerTarget
+{
+    private:
+        EpochStats* mPrevTarget;
+
+    public:
+        explicit PhaseTimerTarget(EpochStats& stats);
+        ~PhaseTimerTarget();
+        PhaseTimerTarget(const PhaseTimerTarget&) = delete;
+        PhaseTimerTarget& operator=(const PhaseTimerTarget&) = delete;
+};
+
+// adds the time in scope to a phase, or with a layer to that layer's breakdown only
+class PhaseTimer
+{
+#ifdef NNETWORK_PHASE_TIMERS
+    private:
+        EpochStats* mTarget;
+        bool mTracing;
+        ProfiledPhase mPhase;
+        size_t mLayer;
+        std::chrono::steady_clock::time_point mStart;
+
+    public:
+        explicit PhaseTimer(ProfiledPhase phase, size_t layer = NO_LAYER);
+        ~PhaseTimer();
+#else
+    public:
+        explicit PhaseTimer(ProfiledPhase, size_t = NO_LAYER) {}
+#endif
+        PhaseTimer(const PhaseTimer&) = delete;
+        PhaseTimer& operator=(const PhaseTimer&) = delete;
+};
+
+#endif //NNETWORK2_PHASETIMER_H
@@ -0,0 +1,68 @@
+//
+// Created by Lenovo on 06/08/2023.
+//
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+#include "Sampler.h"
+
+Sampler::Sampler(SamplingMethod method, unsigned int seed, size_t blockSz) : mMethod(method), mSeed(seed), mBlockSz(blockSz)
+{
+    if(mBlockSz == 0)
+    {
+        throw std::logic_error("Sampler block size must be greater than 0");
+    }
+}
+
+std::default_random_engine Sampler::generatorForEpoch(size_t epoch) const
+{
+    std::seed_seq seedSequence{mSeed, static_cast<unsigned int>(epoch), static_cast<unsigned int>(epoch >> 32)};
+    return std::default_random_engine(seedSequence);
+}
+
+void Sampler::order(size_t numItems, size_t epoch, std::vector<size_t>& orderOut) const
+{
+    orderOut.resize(numItems);
+    if(mMethod != SamplingMethod::BLOCK_SHUFFLE)
+    {
+        std::iota(orderOut.begin(), orderOut.end(), 0);
+        if(mMethod == SamplingMethod::SHUFFLE)
+        {
+            auto generator = generatorForEpoch(epoch);
+            std::shuffle(orderOut.begin(), orderOut.end(), generator);
+        }
+        return;
+    }
+    auto generator = generatorForEpoch(epoch);
+    // visit the blocks in a random order
+    const size_t numBlocks = (numItems + mBlockSz - 1) / mBlockSz;
+    std::vector<size_t> blockOrder(numBlocks);
+    std::iota(blockOrder.begin(), blockOrder.end(), 0);
+    std::shuffle(blockOrder.begin(), blockOrder.end(), generator);
+    // then shuffle the items within each block
+    auto outIt = orderOut.begin();
+    for(size_t block : blockOrder)
+    {
+        const size_t blockStart = block * mBlockSz, blockEnd = std::min(blockStart + mBlockSz, numItems);
+        const auto blockOutStart = outIt;
+        outIt = std::generate_n(outIt, blockEnd - blockStart, [pos = blockStart]() mutable { return pos++; });
+        std::shuffle(blockOutStart, outIt, generator);
+    }
+}
+
+SamplingMethod Sampler::method() const
+{
+    return mMethod;
+}
+
+unsigned int Sampler::seed() const
+{
+    return mSeed;
+}
+
+size_t Sampler::blockSz() const
+{
+    return mBlockSz;
+}
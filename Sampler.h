@@ -0,0 +1,37 @@
+//
+// Created by Lenovo on 06/08/2023.
+//
+
+#ifndef NNETWORK2_SAMPLER_H
+#define NNETWORK2_SAMPLER_H
+
+#include <random>
+#include <vector>
+
+enum class SamplingMethod
+{
+        SEQUENTIAL,
+        SHUFFLE, // new permutation every epoch
+        BLOCK_SHUFFLE // shuffle blocks of consecutive items, then items within each block (keeps accesses mostly sequential)
+};
+
+// produces the order in which items are visited each epoch. the order depends only on (seed, epoch) so it is reproducible
+class Sampler
+{
+    private:
+        SamplingMethod mMethod;
+        unsigned int mSeed;
+        size_t mBlockSz;
+
+    public:
+        explicit Sampler(SamplingMethod method = SamplingMethod::SHUFFLE, unsigned int seed = 12345, size_t blockSz = 4096);
+
+        void order(size_t numItems, size_t epoch, std::vector<size_t>& orderOut) const;
+        [[nodiscard]] std::default_random_engine generatorForEpoch(size_t epoch) const;
+
+        [[nodiscard]] SamplingMethod method() const;
+        [[nodiscard]] unsigned int seed() const;
+        [[nodiscard]] size_t blockSz() const;
+};
+
+#endif //NNETWORK2_SAMPLER_H
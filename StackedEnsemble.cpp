@@ -0,0 +1,386 @@
+//
+// Created by Lenovo on 14/07/2023.
+//
+
+#include "StackedEnsemble.h"
+
+#include <algorithm>
+
+#include "BatchSource.h"
+#include "FusedLayer.h"
+
+// items evaluated at a time by accuracy()
+constexpr Eigen::Index ENSEMBLE_EVALUATION_BATCH_SZ = 256;
+
+static Eigen::Index highestElementPos(const Eigen::Ref<const SingleRowT>& row)
+{
+    Eigen::Index pos;
+    row.maxCoeff(&pos);
+    return pos;
+}
+
+static std::vector<NNetwork> makeMembers(size_t numModels, NNetwork& prototype, InitMethod initMethod, unsigned int seed)
+{
+    std::vector<NNetwork> networks(numModels, prototype);
+    for(size_t model = 0; model < numModels; ++model)
+    {
+        initialiseWeightsBiases(networks[model], initMethod, seed + static_cast<unsigned int> (model));
+    }
+    return networks;
+}
+
+StackedEnsemble::StackedEnsemble(std::vector<NNetwork> networks, ActFuncList actFuncs) :
+    mNumModels(networks.size()),
+    mActFuncs(std::move(actFuncs))
+{
+    if(networks.empty())
+    {
+        throw std::logic_error("Ensemble needs at least one network");
+    }
+    NNetwork& first = networks.front();
+    if(mActFuncs.size() != first.numLayers())
+    {
+        throw std::logic_error("Number of activation functions does not match layers in network");
+    }
+    for(NNetwork& network : networks)
+    {
+        if(network.parameterLayout() != first.parameterLayout() || network.getInputs().size() != first.getInputs().size())
+        {
+            throw std::logic_error("Ensemble networks must have the same layers");
+        }
+    }
+    mInputSz = first.getInputs().size();
+
+    const auto numModels = static_cast<Eigen::Index> (mNumModels);
+    for(size_t layerPos = 0; layerPos < first.numLayers(); ++layerPos)
+    {
+        const Eigen::Index rows = first.layer(layerPos).getWeights().rows(), neurons = first.layer(layerPos).getWeights().cols();
+        mLayerSizes.push_back(neurons);
+        mWeights.emplace_back(rows, numModels * neurons);
+        mBiases.emplace_back(1, numModels * neurons);
+        for(size_t model = 0; model < mNumModels; ++model)
+        {
+            mWeights.back().middleCols(blockStart(layerPos, model), neurons) = networks[model].layer(layerPos).getWeights();
+            mBiases.back().segment(blockStart(layerPos, model), neurons) = networks[model].layer(layerPos).getBiases();
+        }
+        mWeightDeltas.push_back(LayerWeightsT::Zero(rows, numModels * neurons));
+        mBiasDeltas.push_back(SingleRowT::Zero(numModels * neurons));
+        mWeightGrads.emplace_back(rows, numModels * neurons);
+    }
+    mActivations.resize(mLayerSizes.size());
+    mErrors.resize(mLayerSizes.size());
+    mBatchLosses.assign(mNumModels, 0);
+}
+
+StackedEnsemble::StackedEnsemble(size_t numModels, NNetwork& prototype, ActFuncList actFuncs, InitMethod initMethod, unsigned int seed) :
+    StackedEnsemble(makeMembers(numModels, prototype, initMethod, seed), std::move(actFuncs))
+{
+}
+
+size_t StackedEnsemble::numModels() const
+{
+    return mNumModels;
+}
+
+size_t StackedEnsemble::numLayers() const
+{
+    return mLayerSizes.size();
+}
+
+Eigen::Index StackedEnsemble::blockStart(size_t layer, size_t model) const
+{
+    return static_cast<Eigen::Index> (model) * mLayerSizes[layer];
+}
+
+void StackedEnsemble::copyModelTo(size_t model, NNetwork& network) const
+{
+    if(model >= mNumModels)
+    {
+        throw std::out_of_range("Model does not exist");
+    }
+    if(network.numLayers() != numLayers())
+    {
+        throw std::logic_error("Network does not have the ensemble's layers");
+    }
+    for(size_t layerPos = 0; layerPos < numLayers(); ++layerPos)
+    {
+        const Eigen::Index neurons = mLayerSizes[layerPos];
+        if(network.layer(layerPos).getWeights().rows() != mWeights[layerPos].rows() || network.layer(layerPos).getWeights().cols() != neurons)
+        {
+            throw std::logic_error("Network does not have the ensemble's layers");
+        }
+        network.layer(layerPos).setWeights(mWeights[layerPos].middleCols(blockStart(layerPos, model), neurons));
+        network.layer(layerPos).setBiases(mBiases[layerPos].segment(blockStart(layerPos, model), neurons));
+    }
+}
+
+void StackedEnsemble::ensureBatchCapacity(Eigen::Index batchSz)
+{
+    if(mInputs.rows() >= batchSz)
+    {
+        return;
+    }
+    mInputs.resize(batchSz, mInputSz);
+    mTargets.resize(batchSz, mLayerSizes.back());
+    for(size_t layerPos = 0; layerPos < numLayers(); ++layerPos)
+    {
+        mActivations[layerPos].resize(batchSz, mWeights[layerPos].cols());
+        mErrors[layerPos].resize(batchSz, mWeights[layerPos].cols());
+    }
+}
+
+Eigen::Index StackedEnsemble::gatherBatch(ExampleBatchIterator batchStart, ExampleBatchIterator batchEnd, bool gatherTargets)
+{
+    const auto numItems = static_cast<Eigen::Index> (std::distance(batchStart, batchEnd));
+    if(numItems <= 0)
+    {
+        throw std::logic_error("Batch is empty");
+    }
+    ensureBatchCapacity(numItems);
+    for(Eigen::Index row = 0; row < numItems; ++row)
+    {
+        const ExampleItem& item = *(batchStart + row);
+        if(item.inputs.size() != mInputSz || (gatherTargets && item.labels.size() != mLayerSizes.back()))
+        {
+            throw std::out_of_range("Item does not match the ensemble's inputs / outputs");
+        }
+        mInputs.row(row) = item.inputs;
+        if(gatherTargets)
+        {
+            mTargets.row(row) = item.labels;
+        }
+    }
+    return numItems;
+}
+
+void StackedEnsemble::feedforwardRows(Eigen::Index numItems, bool outputLogits)
+{
+    for(size_t layerPos = 0; layerPos < numLayers(); ++layerPos)
+    {
+        auto outputs = mActivations[layerPos].topRows(numItems);
+        const Eigen::Index neurons = mLayerSizes[layerPos];
+        if(layerPos == 0)
+        {
+            // every member sees the same inputs - one product for all of them
+            outputs.noalias() = mInputs.topRows(numItems) * mWeights[0];
+        }
+        else
+        {
+            const Eigen::Index prevNeurons = mLayerSizes[layerPos - 1];
+            auto prevOutputs = mActivations[layerPos - 1].topRows(numItems);
+            for(size_t model = 0; model < mNumModels; ++model)
+            {
+                outputs.middleCols(blockStart(layerPos, model), neurons).noalias() =
+                    prevOutputs.middleCols(blockStart(layerPos - 1, model), prevNeurons) * mWeights[layerPos].middleCols(blockStart(layerPos, model), neurons);
+            }
+        }
+        if(outputLogits && layerPos == numLayers() - 1)
+        {
+            outputs.rowwise() += mBiases[layerPos];
+            continue;
+        }
+        // biases and activation per member block (softmax is normalised over each member's outputs)
+        for(size_t model = 0; model < mNumModels; ++model)
+        {
+            if(!fusedBatchEpilogue(outputs.middleCols(blockStart(layerPos, model), neurons), mBiases[layerPos].segment(blockStart(layerPos, model), neurons), mActFuncs[layerPos]))
+            {
+                throw std::logic_error("Ensemble outputs contain INF or NaN");
+            }
+        }
+    }
+}
+
+StackedEnsemble::BatchT StackedEnsemble::combineOutputs(Eigen::Index numItems, EnsembleCombine combine) const
+{
+    const size_t outputLayerPos = numLayers() - 1;
+    const Eigen::Index numClasses = mLayerSizes[outputLayerPos];
+    const auto outputs = mActivations[outputLayerPos].topRows(numItems);
+    BatchT combined = BatchT::Zero(numItems, numClasses);
+    const NetNumT share = 1 / static_cast<NetNumT> (mNumModels);
+    for(size_t model = 0; model < mNumModels; ++model)
+    {
+        const auto modelOutputs = outputs.middleCols(blockStart(outputLayerPos, model), numClasses);
+        if(combine == EnsembleCombine::AVERAGE)
+        {
+            combined += share * modelOutputs;
+            continue;
+        }
+        for(Eigen::Index row = 0; row < numItems; ++row)
+        {
+            combined(row, highestElementPos(modelOutputs.row(row))) += share;
+        }
+    }
+    return combined;
+}
+
+const std::vector<NetNumT>& StackedEnsemble::trainOnBatch(ExampleBatchIterator batchStart, ExampleBatchIterator batchEnd, LossFunc lossFunc, const LearningRateList& lrList, NetNumT momentum)
+{
+    if(lrList.size() != numLayers())
+    {
+        throw std::logic_error("Number of learning rate layers does not match number of network layers");
+    }
+    const size_t outputLayerPos = numLayers() - 1;
+    if(lossFunc == LossFunc::CROSS_ENTROPY && mActFuncs[outputLayerPos] != ActFunc::SOFTMAX)
+    {
+        throw std::logic_error("If cross entropy loss function then final hidden layer must use softmax activation function");
+    }
+    const Eigen::Index numItems = gatherBatch(batchStart, batchEnd, true);
+    feedforwardRows(numItems, lossFunc == LossFunc::CROSS_ENTROPY);
+    const auto items = static_cast<NetNumT> (numItems);
+
+    // each member's loss and output layer errors against the same targets
+    const Eigen::Index numClasses = mLayerSizes[outputLayerPos];
+    const auto targets = mTargets.topRows(numItems);
+    for(size_t model = 0; model < mNumModels; ++model)
+    {
+        auto outputs = mActivations[outputLayerPos].topRows(numItems).middleCols(blockStart(outputLayerPos, model), numClasses);
+        auto errors = mErrors[outputLayerPos].topRows(numItems).middleCols(blockStart(outputLayerPos, model), numClasses);
+        if(lossFunc == LossFunc::CROSS_ENTROPY)
+        {
+            // softmax, loss and errors fused on the member's net inputs
+            mBatchLosses[model] = fusedSoftmaxCrossEntropy(outputs, targets, errors) / items;
+        }
+        else if(lossFunc == LossFunc::MSE)
+        {
+            mBatchLosses[model] = (outputs - targets).array().square().sum() / static_cast<NetNumT> (numClasses) / items;
+            errors = outputs - targets;
+            multiplyByActivationGradients(errors, outputs, mActFuncs[outputLayerPos]);
+        }
+        else
+        {
+            throw std::runtime_error("Unsupported loss function.");
+        }
+    }
+    if(std::any_of(mBatchLosses.begin(), mBatchLosses.end(), [](NetNumT loss){ return !std::isfinite(loss); }))
+    {
+        throw std::logic_error("Ensemble loss is INF or NaN");
+    }
+
+    // back propagate through each member's block
+    for(size_t layerPos = outputLayerPos; layerPos-- > 0;)
+    {
+        const Eigen::Index neurons = mLayerSizes[layerPos], nextNeurons = mLayerSizes[layerPos + 1];
+        auto errors = mErrors[layerPos].topRows(numItems);
+        const auto nextErrors = mErrors[layerPos + 1].topRows(numItems);
+        for(size_t model = 0; model < mNumModels; ++model)
+        {
+            errors.middleCols(blockStart(layerPos, model), neurons).noalias() =
+                nextErrors.middleCols(blockStart(layerPos + 1, model), nextNeurons) * mWeights[layerPos + 1].middleCols(blockStart(layerPos + 1, model), nextNeurons).transpose();
+        }
+        multiplyByActivationGradients(errors, mActivations[layerPos].topRows(numItems), mActFuncs[layerPos]);
+    }
+
+    // gradients averaged over the batch then the momentum update (as updateNetworkUsingGradients)
+    for(size_t layerPos = 0; layerPos < numLayers(); ++layerPos)
+    {
+        const Eigen::Index neurons = mLayerSizes[layerPos];
+        const auto errors = mErrors[layerPos].topRows(numItems);
+        if(layerPos == 0)
+        {
+            mWeightGrads[0].noalias() = mInputs.topRows(numItems).transpose() * errors;
+        }
+        else
+        {
+            const Eigen::Index prevNeurons = mLayerSizes[layerPos - 1];
+            const auto prevOutputs = mActivations[layerPos - 1].topRows(numItems);
+            for(size_t model = 0; model < mNumModels; ++model)
+            {
+                mWeightGrads[layerPos].middleCols(blockStart(layerPos, model), neurons).noalias() =
+                    prevOutputs.middleCols(blockStart(layerPos - 1, model), prevNeurons).transpose() * errors.middleCols(blockStart(layerPos, model), neurons);
+            }
+        }
+        mWeightDeltas[layerPos] = ((1 - momentum) / items) * mWeightGrads[layerPos] + momentum * mWeightDeltas[layerPos];
+        mBiasDeltas[layerPos] = ((1 - momentum) / items) * errors.colwise().sum() + momentum * mBiasDeltas[layerPos];
+        mWeights[layerPos].noalias() -= lrList[layerPos] * mWeightDeltas[layerPos];
+        mBiases[layerPos].noalias() -= lrList[layerPos] * mBiasDeltas[layerPos];
+    }
+    return mBatchLosses;
+}
+
+std::vector<NetNumT> StackedEnsemble::trainEpoch(BatchSource& source, size_t epoch, size_t batchSz, LossFunc lossFunc, const LearningRateList& lrList, NetNumT momentum)
+{
+    std::vector<double> lossTotals(mNumModels, 0);
+    size_t items = 0;
+    ExampleBatchIterator batchStart, batchEnd;
+    source.startEpoch(epoch);
+    while(source.nextBatch(batchSz, batchStart, batchEnd))
+    {
+        const std::vector<NetNumT>& losses = trainOnBatch(batchStart, batchEnd, lossFunc, lrList, momentum);
+        const auto batchItems = static_cast<size_t> (std::distance(batchStart, batchEnd));
+        for(size_t model = 0; model < mNumModels; ++model)
+        {
+            lossTotals[model] += static_cast<double> (losses[model]) * static_cast<double> (batchItems);
+        }
+        items += batchItems;
+    }
+    std::vector<NetNumT> averageLosses(mNumModels, 0);
+    for(size_t model = 0; model < mNumModels && items > 0; ++model)
+    {
+        averageLosses[model] = static_cast<NetNumT> (lossTotals[model] / static_cast<double> (items));
+    }
+    return averageLosses;
+}
+
+StackedEnsemble::BatchT StackedEnsemble::predictBatch(ExampleBatchIterator batchStart, ExampleBatchIterator batchEnd, EnsembleCombine combine)
+{
+    const Eigen::Index numItems = gatherBatch(batchStart, batchEnd, false);
+    feedforwardRows(numItems);
+    return combineOutputs(numItems, combine);
+}
+
+SingleRowT StackedEnsemble::predict(const SingleRowT& inputs, EnsembleCombine combine)
+{
+    if(inputs.size() != mInputSz)
+    {
+        throw std::out_of_range("Num inputs does not match ensemble input size");
+    }
+    ensureBatchCapacity(1);
+    mInputs.row(0) = inputs;
+    feedforwardRows(1);
+    return combineOutputs(1, combine).row(0);
+}
+
+NetNumT StackedEnsemble::accuracy(const ExampleData& data, EnsembleCombine combine)
+{
+    size_t correct = 0;
+    for(auto batchStart = data.begin(); batchStart != data.end();)
+    {
+        const auto batchEnd = batchStart + std::min<Eigen::Index>(ENSEMBLE_EVALUATION_BATCH_SZ, std::distance(batchStart, data.end()));
+        const BatchT combined = predictBatch(batchStart, batchEnd, combine);
+        for(Eigen::Index row = 0; row < combined.rows(); ++row)
+        {
+            // accurate if highest probability prediction matches the answer
+            correct += (batchStart + row)->labels.coeff(0, highestElementPos(combined.row(row))) == 1;
+        }
+        batchStart = batchEnd;
+    }
+    return data.empty() ? 0 : static_cast<NetNumT> (correct) / static_cast<NetNumT> (data.size()) * 100;
+}
+
+std::vector<NetNumT> StackedEnsemble::modelAccuracies(const ExampleData& data)
+{
+    const size_t outputLayerPos = numLayers() - 1;
+    const Eigen::Index numClasses = mLayerSizes[outputLayerPos];
+    std::vector<size_t> correct(mNumModels, 0);
+    for(auto batchStart = data.begin(); batchStart != data.end();)
+    {
+        const auto batchEnd = batchStart + std::min<Eigen::Index>(ENSEMBLE_EVALUATION_BATCH_SZ, std::distance(batchStart, data.end()));
+        const Eigen::Index numItems = gatherBatch(batchStart, batchEnd, false);
+        feedforwardRows(numItems);
+        for(size_t model = 0; model < mNumModels; ++model)
+        {
+            const auto outputs = mActivations[outputLayerPos].topRows(numItems).middleCols(blockStart(outputLayerPos, model), numClasses);
+            for(Eigen::Index row = 0; row < numItems; ++row)
+            {
+                correct[model] += (batchStart + row)->labels.coeff(0, highestElementPos(outputs.row(row))) == 1;
+            }
+        }
+        batchStart = batchEnd;
+    }
+    std::vector<NetNumT> accuracies(mNumModels, 0);
+    for(size_t model = 0; model < mNumModels && !data.empty(); ++model)
+    {
+        accuracies[model] = static_cast<NetNumT> (correct[model]) / static_cast<NetNumT> (data.size()) * 100;
+    }
+    return accuracies;
+}
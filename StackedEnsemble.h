@@ -0,0 +1,82 @@
+//
+// Created by Lenovo on 14/07/2023.
+//
+
+#ifndef NNETWORK2_STACKEDENSEMBLE_H
+#define NNETWORK2_STACKEDENSEMBLE_H
+
+#include <vector>
+
+#include "Training.h"
+
+class BatchSource;
+
+// how the members' output probabilities are combined
+enum class EnsembleCombine
+{
+        AVERAGE, // mean probability
+        VOTE // fraction of members whose top class it is
+};
+
+// K networks of the same shape trained / evaluated together over whole batches.
+// Each layer's weights are stored side by side, [W1 | W2 | ... | WK], with the activations laid out the same way:
+// - the first layer (shared inputs) is a single GEMM for all K members
+// - deeper layers are block diagonal - member k's block of activations only meets member k's block of weights, so each
+//   block is multiplied on its own instead of multiplying by zeros
+// Members are trained independently (their own loss, gradients and momentum). Drop out is not supported.
+class StackedEnsemble
+{
+    private:
+        using BatchT = BatchActivationsT; // one row per item
+
+        size_t mNumModels;
+        Eigen::Index mInputSz;
+        std::vector<Eigen::Index> mLayerSizes; // neurons per layer of one member
+        ActFuncList mActFuncs;
+        std::vector<LayerWeightsT> mWeights; // (inputs of one member) x (K * neurons)
+        std::vector<SingleRowT> mBiases; // 1 x (K * neurons)
+        std::vector<LayerWeightsT> mWeightDeltas; // momentum
+        std::vector<SingleRowT> mBiasDeltas;
+
+        // per batch scratch, grown to the largest batch seen
+        BatchT mInputs;
+        BatchT mTargets;
+        std::vector<BatchT> mActivations;
+        std::vector<BatchT> mErrors; // derivative of the loss wrt each layer's net input
+        std::vector<LayerWeightsT> mWeightGrads;
+        std::vector<NetNumT> mBatchLosses;
+
+        void ensureBatchCapacity(Eigen::Index batchSz);
+        Eigen::Index gatherBatch(ExampleBatchIterator batchStart, ExampleBatchIterator batchEnd, bool gatherTargets);
+        // feeds the first numItems rows of mInputs through every member (outputLogits leaves the output layer as net inputs)
+        void feedforwardRows(Eigen::Index numItems, bool outputLogits = false);
+        [[nodiscard]] BatchT combineOutputs(Eigen::Index numItems, EnsembleCombine combine) const;
+        // member k's columns of a layer
+        [[nodiscard]] Eigen::Index blockStart(size_t layer, size_t model) const;
+
+    public:
+        // every network must have the same layers
+        StackedEnsemble(std::vector<NNetwork> networks, ActFuncList actFuncs);
+        // numModels copies of the prototype's shape, each initialised from its own seed
+        StackedEnsemble(size_t numModels, NNetwork& prototype, ActFuncList actFuncs, InitMethod initMethod, unsigned int seed = 12345);
+
+        [[nodiscard]] size_t numModels() const;
+        [[nodiscard]] size_t numLayers() const;
+        // writes member model's weights into a network of the same shape
+        void copyModelTo(size_t model, NNetwork& network) const;
+
+        // one momentum update of every member, returns each member's average loss over the batch (before the update)
+        const std::vector<NetNumT>& trainOnBatch(ExampleBatchIterator batchStart, ExampleBatchIterator batchEnd, LossFunc lossFunc, const LearningRateList& lrList, NetNumT momentum);
+        // a pass over the source, returns each member's average training loss
+        std::vector<NetNumT> trainEpoch(BatchSource& source, size_t epoch, size_t batchSz, LossFunc lossFunc, const LearningRateList& lrList, NetNumT momentum);
+
+        // one row of combined probabilities per item
+        BatchT predictBatch(ExampleBatchIterator batchStart, ExampleBatchIterator batchEnd, EnsembleCombine combine);
+        SingleRowT predict(const SingleRowT& inputs, EnsembleCombine combine);
+        // accuracy (%) of the combined prediction
+        NetNumT accuracy(const ExampleData& data, EnsembleCombine combine);
+        // accuracy (%) of each member on its own
+        std::vector<NetNumT> modelAccuracies(const ExampleData& data);
+};
+
+#endif //NNETWORK2_STACKEDENSEMBLE_H
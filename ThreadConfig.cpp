@@ -0,0 +1,373 @@
+//
+// Created by Lenovo on 18/07/2023.
+//
+
+#include "ThreadConfig.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <omp.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "Eigen/Core"
+
+namespace
+{
+    // a positive count from the environment, e.g. NNETWORK_THREADS=8 (OMP_NUM_THREADS=8,4 reads as 8)
+    std::optional<size_t> environmentCount(const char* name)
+    {
+        const char* value = std::getenv(name);
+        if(!value || *value == '\0')
+        {
+            return std::nullopt;
+        }
+        try
+        {
+            const unsigned long count = std::stoul(value);
+            if(count > 0)
+            {
+                return static_cast<size_t> (count);
+            }
+        }
+        catch(const std::logic_error&) {}
+        throw std::runtime_error(std::string("Invalid thread count in ") + name);
+    }
+
+    int readIntFile(const std::string& fName, int fallback)
+    {
+        std::ifstream fileIn(fName);
+        int value;
+        return fileIn >> value ? value : fallback;
+    }
+
+    // a sysfs cpu list e.g. "0-3,8-11"
+    std::vector<int> parseCpuList(const std::string& list)
+    {
+        std::vector<int> cpus;
+        size_t pos = 0;
+        while(pos < list.size())
+        {
+            const size_t end = std::min(list.find(',', pos), list.size());
+            const std::string range = list.substr(pos, end - pos);
+            const size_t dash = range.find('-');
+            try
+            {
+                const int first = std::stoi(range.substr(0, dash));
+                const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                for(int cpu = first; cpu <= last; ++cpu)
+                {
+                    cpus.push_back(cpu);
+                }
+            }
+            catch(const std::logic_error&) {} // blank / malformed entries are skipped
+            pos = end + 1;
+        }
+        return cpus;
+    }
+
+#ifdef __linux__
+    // the affinity mask the process had before anything was pinned
+    const cpu_set_t& processCpuMask()
+    {
+        static const cpu_set_t mask = []()
+        {
+            cpu_set_t startMask;
+            CPU_ZERO(&startMask);
+            if(sched_getaffinity(0, sizeof(startMask), &startMask) != 0)
+            {
+                const unsigned int numCpus = std::max(1u, std::thread::hardware_concurrency());
+                for(unsigned int cpu = 0; cpu < numCpus; ++cpu)
+                {
+                    CPU_SET(cpu, &startMask);
+                }
+            }
+            return startMask;
+        }();
+        return mask;
+    }
+#endif
+
+    ThreadConfig& activeConfig()
+    {
+        static ThreadConfig config = ThreadConfig::fromEnvironment();
+        return config;
+    }
+}
+
+CpuTopology CpuTopology::detect()
+{
+    CpuTopology topology;
+#ifdef __linux__
+    std::vector<int> allowedCpus;
+    const cpu_set_t& mask = processCpuMask();
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if(CPU_ISSET(cpu, &mask))
+        {
+            allowedCpus.push_back(cpu);
+        }
+    }
+
+    // NUMA node of each cpu (no node directories means a single node)
+    std::map<int, size_t> cpuNodes;
+    std::error_code error;
+    for(std::filesystem::directory_iterator nodeIt("/sys/devices/system/node", error), end; !error && nodeIt != end; nodeIt.increment(error))
+    {
+        const std::string name = nodeIt->path().filename().string();
+        if(name.size() <= 4 || name.compare(0, 4, "node") != 0 || !std::all_of(name.begin() + 4, name.end(), [](char c){ return c >= '0' && c <= '9'; }))
+        {
+            continue;
+        }
+        const auto node = static_cast<size_t> (std::stoul(name.substr(4)));
+        std::ifstream listIn(nodeIt->path() / "cpulist");
+        std::string list;
+        std::getline(listIn, list);
+        for(const int cpu : parseCpuList(list))
+        {
+            cpuNodes[cpu] = node;
+        }
+    }
+
+    // logical cpus sharing a (package, core) are hyper-threaded siblings - keep the lowest numbered one
+    std::map<std::tuple<size_t, int, int>, int> cores;
+    for(const int cpu : allowedCpus)
+    {
+        const std::string topologyDir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+        const int package = readIntFile(topologyDir + "physical_package_id", 0);
+        const int core = readIntFile(topologyDir + "core_id", cpu);
+        const auto nodeIt = cpuNodes.find(cpu);
+        cores.emplace(std::make_tuple(nodeIt == cpuNodes.end() ? 0 : nodeIt->second, package, core), cpu);
+    }
+    std::set<size_t> nodes;
+    for(const auto& [key, cpu] : cores)
+    {
+        topology.coreCpus.push_back(cpu);
+        topology.coreNodes.push_back(std::get<0>(key));
+        nodes.insert(std::get<0>(key));
+    }
+    if(!cores.empty())
+    {
+        topology.logicalCpus = allowedCpus.size();
+        topology.physicalCores = cores.size();
+        topology.numaNodes = nodes.size();
+        return topology;
+    }
+#endif
+    // no topology information - every logical cpu counts as a core
+    topology.logicalCpus = topology.physicalCores = std::max(1u, std::thread::hardware_concurrency());
+    for(size_t cpu = 0; cpu < topology.logicalCpus; ++cpu)
+    {
+        topology.coreCpus.push_back(static_cast<int> (cpu));
+        topology.coreNodes.push_back(0);
+    }
+    return topology;
+}
+
+void CpuTopology::summarise(std::ostream& out) const
+{
+    out << "CPU topology: " << logicalCpus << " logical cpus, " << physicalCores << " physical cores, " << numaNodes << " NUMA node(s)\n";
+}
+
+//***********//
+
+ThreadConfig ThreadConfig::automatic(const CpuTopology& topology, size_t jobs, size_t jobIndex)
+{
+    if(jobs == 0 || jobIndex >= jobs)
+    {
+        throw std::logic_error("Job index must be less than the number of jobs");
+    }
+    if(topology.coreCpus.empty() || topology.coreCpus.size() != topology.coreNodes.size())
+    {
+        throw std::logic_error("Topology has no cores");
+    }
+    ThreadConfig config;
+    // this job's slice of the cores (every job gets at least one)
+    const size_t numCores = topology.coreCpus.size();
+    const size_t share = std::max<size_t>(1, numCores / jobs);
+    const size_t sliceStart = jobIndex * share % numCores;
+    for(size_t core = 0; core < share; ++core)
+    {
+        config.cpus.push_back(topology.coreCpus[(sliceStart + core) % numCores]);
+    }
+    config.threads = share;
+    // training runs a single worker so splitting the share per NUMA node would leave all but one node's cores idle
+    config.dataThreads = 1;
+    config.gemmThreads = share;
+    config.pinThreads = jobs == 1;
+    return config;
+}
+
+ThreadConfig ThreadConfig::fromEnvironment()
+{
+    const std::optional<size_t> jobs = environmentCount("NNETWORK_JOBS");
+    std::optional<size_t> jobIndex;
+    if(const char* value = std::getenv("NNETWORK_JOB_INDEX"))
+    {
+        try
+        {
+            jobIndex = static_cast<size_t> (std::stoul(value));
+        }
+        catch(const std::logic_error&)
+        {
+            throw std::runtime_error("Invalid job index in NNETWORK_JOB_INDEX");
+        }
+    }
+    ThreadConfig config = automatic(CpuTopology::detect(), jobs.value_or(1), jobIndex.value_or(0));
+    if(jobIndex)
+    {
+        config.pinThreads = true; // the slice is this job's alone
+    }
+
+    std::optional<size_t> threads = environmentCount("NNETWORK_THREADS");
+    if(!threads)
+    {
+        threads = environmentCount("OMP_NUM_THREADS");
+    }
+    const std::optional<size_t> dataThreads = environmentCount("NNETWORK_DATA_THREADS"), gemmThreads = environmentCount("NNETWORK_GEMM_THREADS");
+    config.threads = threads.value_or(config.threads);
+    if(dataThreads && gemmThreads)
+    {
+        config.dataThreads = *dataThreads;
+        config.gemmThreads = *gemmThreads;
+        config.threads = std::max(threads.value_or(0), *dataThreads * *gemmThreads);
+    }
+    else if(dataThreads)
+    {
+        config.dataThreads = std::min(*dataThreads, config.threads);
+        config.gemmThreads = config.threads / config.dataThreads;
+    }
+    else if(gemmThreads)
+    {
+        config.gemmThreads = std::min(*gemmThreads, config.threads);
+        config.dataThreads = config.threads / config.gemmThreads;
+    }
+    else if(threads)
+    {
+        // only the budget changed - it all goes to the GEMMs
+        config.gemmThreads = config.threads / config.dataThreads;
+    }
+    if(config.cpus.size() > config.threads)
+    {
+        config.cpus.resize(config.threads);
+    }
+
+    if(const char* pin = std::getenv("NNETWORK_PIN_THREADS"))
+    {
+        config.pinThreads = std::string(pin) != "0";
+    }
+    return config;
+}
+
+void ThreadConfig::apply() const
+{
+    if(threads == 0 || dataThreads == 0 || gemmThreads == 0)
+    {
+        throw std::logic_error("Thread counts must be positive");
+    }
+#ifdef __linux__
+    processCpuMask(); // captured before anything is pinned
+#endif
+    omp_set_num_threads(static_cast<int> (threads));
+    Eigen::setNbThreads(static_cast<int> (gemmThreads));
+    if(!std::getenv("OMP_PROC_BIND"))
+    {
+        // the OpenMP runtime keeps its threads between parallel regions (Eigen's GEMMs included) so this pinning sticks
+        const bool pin = pinThreads && !cpus.empty();
+#pragma omp parallel num_threads(static_cast<int> (threads))
+        {
+            if(pin)
+            {
+                pinCurrentThread(cpus[static_cast<size_t> (omp_get_thread_num()) % cpus.size()]);
+            }
+            else
+            {
+                unpinCurrentThread();
+            }
+        }
+    }
+    activeConfig() = *this;
+}
+
+void ThreadConfig::summarise(std::ostream& out) const
+{
+    out << "Threads: " << threads << " (" << dataThreads << " data x " << gemmThreads << " GEMM), ";
+    if(!pinThreads || cpus.empty())
+    {
+        out << "not pinned\n";
+        return;
+    }
+    out << "pinned to cpus";
+    for(const int cpu : cpus)
+    {
+        out << " " << cpu;
+    }
+    out << "\n";
+}
+
+const ThreadConfig& activeThreadConfig()
+{
+    return activeConfig();
+}
+
+//***********//
+
+bool pinCurrentThread(int cpu)
+{
+#ifdef __linux__
+    if(cpu < 0 || cpu >= CPU_SETSIZE)
+    {
+        return false;
+    }
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(static_cast<size_t> (cpu), &mask);
+    return sched_setaffinity(0, sizeof(mask), &mask) == 0;
+#else
+    (void) cpu;
+    return false;
+#endif
+}
+
+void unpinCurrentThread()
+{
+#ifdef __linux__
+    sched_setaffinity(0, sizeof(cpu_set_t), &processCpuMask());
+#endif
+}
+
+void pinCurrentThreadToWorkerCpus(size_t worker, size_t cpusPerWorker)
+{
+    const ThreadConfig& config = activeThreadConfig();
+    if(!config.pinThreads || config.cpus.empty())
+    {
+        return;
+    }
+#ifdef __linux__
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    cpusPerWorker = std::max<size_t>(cpusPerWorker, 1);
+    for(size_t slicePos = 0; slicePos < cpusPerWorker; ++slicePos)
+    {
+        const int cpu = config.cpus[(worker * cpusPerWorker + slicePos) % config.cpus.size()];
+        if(cpu >= 0 && cpu < CPU_SETSIZE)
+        {
+            CPU_SET(static_cast<size_t> (cpu), &mask);
+        }
+    }
+    sched_setaffinity(0, sizeof(mask), &mask);
+#else
+    (void) worker;
+#endif
+}
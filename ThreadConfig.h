@@ -0,0 +1,61 @@
+//
+// Created by Lenovo on 18/07/2023.
+//
+
+#ifndef NNETWORK2_THREADCONFIG_H
+#define NNETWORK2_THREADCONFIG_H
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+// the cpus this process may run on (its affinity mask) grouped into physical cores and NUMA nodes
+struct CpuTopology
+{
+    size_t logicalCpus = 1;
+    size_t physicalCores = 1;
+    size_t numaNodes = 1;
+    std::vector<int> coreCpus; // one logical cpu per physical core (hyper-threaded siblings left out), ordered by NUMA node
+    std::vector<size_t> coreNodes; // the NUMA node of each entry in coreCpus
+
+    // reads /sys and the affinity mask on Linux, otherwise one node of hardware_concurrency cores
+    static CpuTopology detect();
+    void summarise(std::ostream& out) const;
+};
+
+// how many threads go to data parallelism (independent workers such as concurrent trials) and to Eigen inside one GEMM.
+// dataThreads x gemmThreads never exceeds the budget (threads), which is also what plain OpenMP loops get. Training runs
+// one worker, so unless overridden dataThreads is 1 and every thread goes to the GEMMs
+struct ThreadConfig
+{
+    size_t threads = 1;
+    size_t dataThreads = 1;
+    size_t gemmThreads = 1;
+    bool pinThreads = false;
+    std::vector<int> cpus; // thread i is pinned to cpus[i % cpus.size()]
+
+    // this job's share of the physical cores (jobs sharing the machine get disjoint slices), all of them for the GEMMs.
+    // Pins only when the job has the machine to itself
+    static ThreadConfig automatic(const CpuTopology& topology, size_t jobs = 1, size_t jobIndex = 0);
+    // automatic() with overrides: NNETWORK_JOBS / NNETWORK_JOB_INDEX (jobs sharing the machine - an index also turns pinning on),
+    // NNETWORK_THREADS (else OMP_NUM_THREADS), NNETWORK_DATA_THREADS, NNETWORK_GEMM_THREADS and NNETWORK_PIN_THREADS (0 / 1)
+    static ThreadConfig fromEnvironment();
+
+    // sets the OpenMP / Eigen thread counts, pins (or unpins) the OpenMP threads and becomes the active config.
+    // Call before starting other threads. Pinning is left to the OpenMP runtime if OMP_PROC_BIND is set
+    void apply() const;
+    void summarise(std::ostream& out) const;
+};
+
+// fromEnvironment() until a config is applied
+const ThreadConfig& activeThreadConfig();
+
+// thread affinity - no-ops where unsupported
+bool pinCurrentThread(int cpu);
+// back to every cpu the process started with - for background threads spawned by a pinned thread
+void unpinCurrentThread();
+// worker threads running side by side (e.g. concurrent trials) each take their own slice of cpusPerWorker cpus of the active
+// config, when pinning. The GEMM threads a worker starts inherit its mask so they share the slice rather than one cpu
+void pinCurrentThreadToWorkerCpus(size_t worker, size_t cpusPerWorker);
+
+#endif //NNETWORK2_THREADCONFIG_H
@@ -0,0 +1,273 @@
+//
+// Created by Lenovo on 28/06/2023.
+//
+
+#include "Trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    struct TraceEvent
+    {
+        const char* name = nullptr;
+        const char* argName = nullptr;
+        int64_t arg = 0;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point end;
+    };
+
+    // written only by its thread - head is published with release so a reader sees complete events
+    struct ThreadTraceBuffer
+    {
+        size_t threadId = 0;
+        const char* threadName = nullptr; // guarded by the registry mutex
+        bool retired = false; // its thread has exited, the next new thread takes it over
+        std::vector<TraceEvent> events;
+        std::atomic<size_t> head{0}; // events recorded this session (wraps around events)
+    };
+
+    std::atomic<bool> tracing{false};
+    std::atomic<std::chrono::steady_clock::rep> sessionStart{0};
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<ThreadTraceBuffer>> registry;
+    size_t eventsPerNewThread = DEFAULT_TRACE_EVENTS_PER_THREAD;
+
+    // hands the thread's buffer back when the thread exits, so short lived threads don't grow the registry
+    struct ThreadBufferHandle
+    {
+        ThreadTraceBuffer* buffer = nullptr;
+        const char* threadName = nullptr;
+
+        ~ThreadBufferHandle()
+        {
+            if(buffer != nullptr)
+            {
+                std::lock_guard<std::mutex> lock(registryMutex);
+                buffer->retired = true;
+            }
+        }
+    };
+    thread_local ThreadBufferHandle threadHandle;
+
+    ThreadTraceBuffer& bufferForThisThread()
+    {
+        if(threadHandle.buffer == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            auto retired = std::find_if(registry.begin(), registry.end(), [](const auto& buffer){ return buffer->retired; });
+            if(retired != registry.end())
+            {
+                // its events are kept - the new thread carries on from the same ring
+                threadHandle.buffer = retired->get();
+                threadHandle.buffer->retired = false;
+            }
+            else
+            {
+                auto buffer = std::make_unique<ThreadTraceBuffer>();
+                buffer->threadId = registry.size();
+                buffer->events.resize(eventsPerNewThread);
+                threadHandle.buffer = buffer.get();
+                registry.push_back(std::move(buffer));
+            }
+            threadHandle.buffer->threadName = threadHandle.threadName;
+        }
+        return *threadHandle.buffer;
+    }
+
+    void writeJsonString(std::ostream& out, const char* str)
+    {
+        out << '"';
+        for(; *str != '\0'; ++str)
+        {
+            if(*str == '"' || *str == '\\')
+            {
+                out << '\\';
+            }
+            out << *str;
+        }
+        out << '"';
+    }
+}
+
+void startTracing(size_t eventsPerThread)
+{
+    if(eventsPerThread == 0)
+    {
+        throw std::logic_error("Trace buffers need room for at least one event");
+    }
+    std::lock_guard<std::mutex> lock(registryMutex);
+    eventsPerNewThread = eventsPerThread;
+    for(auto& buffer : registry)
+    {
+        buffer->head.store(0, std::memory_order_release);
+    }
+    sessionStart.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    tracing.store(true, std::memory_order_release);
+}
+
+void stopTracing()
+{
+    tracing.store(false, std::memory_order_release);
+}
+
+bool tracingActive()
+{
+    return tracing.load(std::memory_order_relaxed);
+}
+
+void setTraceThreadName(const char* name)
+{
+    // applied when the thread first records an event
+    threadHandle.threadName = name;
+    if(threadHandle.buffer != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        threadHandle.buffer->threadName = name;
+    }
+}
+
+void recordTraceEvent(const char* name, const char* argName, int64_t arg, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    ThreadTraceBuffer& buffer = bufferForThisThread();
+    const size_t pos = buffer.head.load(std::memory_order_relaxed);
+    buffer.events[pos % buffer.events.size()] = {name, argName, arg, start, end};
+    buffer.head.store(pos + 1, std::memory_order_release);
+}
+
+void writeChromeTrace(std::ostream& out)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    const std::chrono::steady_clock::time_point origin{std::chrono::steady_clock::duration(sessionStart.load(std::memory_order_relaxed))};
+    const auto microseconds = [](std::chrono::steady_clock::duration duration)
+    {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    };
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for(const auto& buffer : registry)
+    {
+        const size_t head = buffer->head.load(std::memory_order_acquire);
+        if(head == 0 && buffer->threadName == nullptr)
+        {
+            continue;
+        }
+        if(buffer->threadName != nullptr)
+        {
+            out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->threadId << ", \"args\": {\"name\": ";
+            writeJsonString(out, buffer->threadName);
+            out << "}}";
+            first = false;
+        }
+        // the last events.size() events are still in the ring
+        const size_t capacity = buffer->events.size();
+        for(size_t pos = head - std::min(head, capacity); pos < head; ++pos)
+        {
+            const TraceEvent& event = buffer->events[pos % capacity];
+            out << (first ? "" : ",\n") << "{\"name\": ";
+            writeJsonString(out, event.name);
+            out << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->threadId << ", \"ts\": " << microseconds(event.start - origin)
+                << ", \"dur\": " << microseconds(event.end - event.start);
+            if(event.argName != nullptr)
+            {
+                out << ", \"args\": {";
+                writeJsonString(out, event.argName);
+                out << ": " << event.arg << "}";
+            }
+            out << "}";
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+}
+
+void writeChromeTrace(const std::string& fName)
+{
+    std::ofstream fileOut(fName);
+    if(!fileOut)
+    {
+        throw std::runtime_error("Could not open trace file " + fName);
+    }
+    writeChromeTrace(fileOut);
+}
+
+//***********//
+
+TraceFileSession::TraceFileSession(std::string fName) :
+    mFileName(std::move(fName)),
+    mOwnsSession(!mFileName.empty() && !tracingActive())
+{
+    if(mOwnsSession)
+    {
+        startTracing();
+    }
+}
+
+TraceFileSession::~TraceFileSession()
+{
+    if(mFinished || mFileName.empty())
+    {
+        return;
+    }
+    stopOwnedSession();
+    try
+    {
+        writeChromeTrace(mFileName);
+    }
+    catch (const std::exception&)
+    {
+        // already unwinding from the error that matters
+    }
+}
+
+void TraceFileSession::stopOwnedSession()
+{
+    if(mOwnsSession)
+    {
+        stopTracing();
+        mOwnsSession = false;
+    }
+}
+
+void TraceFileSession::finish()
+{
+    if(mFinished || mFileName.empty())
+    {
+        return;
+    }
+    mFinished = true;
+    stopOwnedSession();
+    writeChromeTrace(mFileName);
+}
+
+//***********//
+
+TraceScope::TraceScope(const char* name, const char* argName, int64_t arg) :
+    mName(name),
+    mArgName(argName),
+    mArg(arg),
+    mActive(tracingActive())
+{
+    if(mActive)
+    {
+        mStart = std::chrono::steady_clock::now();
+    }
+}
+
+TraceScope::~TraceScope()
+{
+    if(mActive)
+    {
+        recordTraceEvent(mName, mArgName, mArg, mStart, std::chrono::steady_clock::now());
+    }
+}
@@ -0,0 +1,75 @@
+//
+// Created by Lenovo on 28/06/2023.
+//
+
+#ifndef NNETWORK2_TRACE_H
+#define NNETWORK2_TRACE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Timeline tracing - begin/end (complete) events for batches, phases, layers and I/O, dumped as Chrome trace-event
+// JSON (open in chrome://tracing or ui.perfetto.dev).
+// Each thread records into its own fixed size ring buffer without locking; when a buffer wraps the oldest events are
+// overwritten. Buffers are kept for the life of the process - a thread's buffer passes to the next new thread once it
+// exits, and buffers are reused by later tracing sessions.
+// Phase and layer events come from the PhaseTimers, so they are missing if those are compiled out.
+// Event names (and argument names) must be string literals / outlive the trace.
+
+constexpr size_t DEFAULT_TRACE_EVENTS_PER_THREAD = 1 << 16;
+
+// starts a session, clearing previously recorded events (eventsPerThread sizes buffers for threads not seen before)
+void startTracing(size_t eventsPerThread = DEFAULT_TRACE_EVENTS_PER_THREAD);
+void stopTracing();
+[[nodiscard]] bool tracingActive();
+// names the calling thread in the trace
+void setTraceThreadName(const char* name);
+
+void recordTraceEvent(const char* name, const char* argName, int64_t arg, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+// only call while traced threads are idle (or after stopTracing)
+void writeChromeTrace(std::ostream& out);
+void writeChromeTrace(const std::string& fName);
+
+// Writes a Chrome trace to fName (if not empty) for a run: starts a session unless one is already active (then stops it
+// as well) and writes the file on finish(). If the scope is left without finish(), e.g. by an exception, the session is
+// still stopped and what was recorded written, ignoring any error
+class TraceFileSession
+{
+    private:
+        std::string mFileName;
+        bool mOwnsSession;
+        bool mFinished = false;
+
+        void stopOwnedSession();
+
+    public:
+        explicit TraceFileSession(std::string fName);
+        ~TraceFileSession();
+        TraceFileSession(const TraceFileSession&) = delete;
+        TraceFileSession& operator=(const TraceFileSession&) = delete;
+
+        void finish();
+};
+
+// records an event spanning its lifetime while tracing
+class TraceScope
+{
+    private:
+        const char* mName;
+        const char* mArgName;
+        int64_t mArg;
+        bool mActive;
+        std::chrono::steady_clock::time_point mStart;
+
+    public:
+        explicit TraceScope(const char* name, const char* argName = nullptr, int64_t arg = 0);
+        ~TraceScope();
+        TraceScope(const TraceScope&) = delete;
+        TraceScope& operator=(const TraceScope&) = delete;
+};
+
+#endif //NNETWORK2_TRACE_H
@@ -7,37 +7,88 @@
 #include <algorithm>
 #include <fstream> // for serialisation
 #include <chrono> // for timing
+#include <memory>
 
 #include "Training.h"
 #include "Data.h"
+#include "BatchSource.h"
+#include "Checkpoint.h"
+#include "ExecutionPlan.h"
+#include "FusedLayer.h"
+#include "AllocationTracker.h"
+#include "PhaseTimer.h"
+#include "Trace.h"
+#include "Metrics.h"
+
+// number of items gathered at a time when evaluating a BatchSource
+constexpr size_t EVALUATION_BATCH_SZ = 256;
 
 // TYPES
 
-NetworkWeightGradients::NetworkWeightGradients(NNetwork& network)
+NetworkWeightGradients::NetworkWeightGradients(NNetwork& network) :
+    mLayout(network.parameterLayout()),
+    mGradients(mLayout.weightsSz())
 {
-    for(size_t layerPos = 0; layerPos < network.numLayers(); ++layerPos)
+    bindLayerViews();
+}
+
+NetworkWeightGradients::NetworkWeightGradients(const NetworkWeightGradients& other) :
+    mLayout(other.mLayout),
+    mGradients(other.mGradients)
+{
+    bindLayerViews();
+}
+
+NetworkWeightGradients& NetworkWeightGradients::operator=(const NetworkWeightGradients& other)
+{
+    if(this != &other)
     {
-        weightGradients.push_back(network.layer(layerPos).getWeights());
-        weightGradients[layerPos].setZero();
+        mLayout = other.mLayout;
+        mGradients = other.mGradients;
+        bindLayerViews();
     }
+    return *this;
 }
 
-void NetworkWeightGradients::setWeightGradientsForLayer(const LayerWeightsT& newWeightGrads, size_t layer)
+void NetworkWeightGradients::bindLayerViews()
 {
-    if(layer >= weightGradients.size())
+    mLayerViews.clear();
+    for(size_t layerPos = 0; layerPos < mLayout.numLayers(); ++layerPos)
+    {
+        const ParameterLayout::LayerSlot& slot = mLayout.slot(layerPos);
+        mLayerViews.emplace_back(mGradients.data() + slot.weightsOffset, slot.rows, slot.cols);
+    }
+}
+
+void NetworkWeightGradients::setWeightGradientsForLayer(const Eigen::Ref<const LayerWeightsT>& newWeightGrads, size_t layer)
+{
+    if(layer >= mLayerViews.size())
     {
         throw std::out_of_range("Layer does not exist");
     }
-    weightGradients[layer] = (newWeightGrads);
+    if(newWeightGrads.rows() != mLayerViews[layer].rows() || newWeightGrads.cols() != mLayerViews[layer].cols())
+    {
+        throw std::out_of_range("Weight dimensions do not match");
+    }
+    mLayerViews[layer] = newWeightGrads;
 }
 
-const LayerWeightsT& NetworkWeightGradients::getWeightGradientsForLayer(size_t layer) const
+const LayerWeightsMapT& NetworkWeightGradients::getWeightGradientsForLayer(size_t layer) const
 {
-    if(layer >= weightGradients.size())
+    if(layer >= mLayerViews.size())
     {
         throw std::out_of_range("Layer does not exist");
     }
-    return weightGradients[layer];
+    return mLayerViews[layer];
+}
+
+LayerWeightsMapT& NetworkWeightGradients::getWeightGradientsForLayer(size_t layer)
+{
+    if(layer >= mLayerViews.size())
+    {
+        throw std::out_of_range("Layer does not exist");
+    }
+    return mLayerViews[layer];
 }
 
 void NetworkWeightGradients::numericAddWeightGradients(const NetworkWeightGradients& weightsToAdd)
@@ -46,81 +97,122 @@ void NetworkWeightGradients::numericAddWeightGradients(const NetworkWeightGradie
     {
         throw std::logic_error("Add: Number of Weight Gradients do not match");
     }
-    for(size_t layer = 0; layer < numLayers(); ++layer)
+    if (weightsToAdd.mLayout != mLayout)
     {
-        // if weights is empty then simply assign weightsToAdd
-        if(weightGradients[layer].size() == 0)
-        {
-            weightGradients[layer] = weightsToAdd.getWeightGradientsForLayer(layer);
-            continue;
-        }
-        // if weights do not match then throw error
-        if(weightGradients[layer].rows() != weightsToAdd.getWeightGradientsForLayer(layer).rows() ||
-           weightGradients[layer].cols() != weightsToAdd.getWeightGradientsForLayer(layer).cols())
-        {
-            throw std::out_of_range("Weight dimensions do not match");
-        }
-        weightGradients[layer].noalias() += weightsToAdd.getWeightGradientsForLayer(layer); // efficient way to add
+        throw std::out_of_range("Weight dimensions do not match");
     }
+    flat().noalias() += weightsToAdd.flat(); // one pass over every layer
 }
 
 void NetworkWeightGradients::divideWeightGradients(size_t divideBy)
 {
-    for(size_t layerPos = 0; layerPos < numLayers(); ++layerPos)
-    {
-        weightGradients[layerPos] = weightGradients[layerPos].array() / divideBy;
-    }
+    flat() /= static_cast<NetNumT> (divideBy);
 }
 
 size_t NetworkWeightGradients::numLayers() const
 {
-    return weightGradients.size();
+    return mLayerViews.size();
 }
 
 void NetworkWeightGradients::setToZero() {
-    for (LayerWeightsT& lWeights: weightGradients ) {
-        lWeights.setZero();
-    }
+    flat().setZero();
+}
+
+NetNumT NetworkWeightGradients::squaredNorm() const
+{
+    return flat().squaredNorm(); // padding is zero so does not contribute
+}
+
+FlatParametersT NetworkWeightGradients::flat()
+{
+    return mGradients.region(0, mGradients.size());
+}
+
+ConstFlatParametersT NetworkWeightGradients::flat() const
+{
+    return mGradients.region(0, mGradients.size());
+}
+
+const ParameterLayout& NetworkWeightGradients::layout() const
+{
+    return mLayout;
 }
 
 //***********//
 
-NetworkLayerGradients::NetworkLayerGradients(NNetwork& network)
+NetworkLayerGradients::NetworkLayerGradients(NNetwork& network) :
+    mLayout(network.parameterLayout()),
+    mGradients(mLayout.biasesSz())
 {
-    for(size_t layerPos = 0; layerPos < network.numLayers(); ++layerPos)
+    bindLayerViews();
+}
+
+NetworkLayerGradients::NetworkLayerGradients(const NetworkLayerGradients& other) :
+    mLayout(other.mLayout),
+    mGradients(other.mGradients)
+{
+    bindLayerViews();
+}
+
+NetworkLayerGradients& NetworkLayerGradients::operator=(const NetworkLayerGradients& other)
+{
+    if(this != &other)
     {
-        layerGradients.push_back(network.layer(layerPos).getBiases());
-        layerGradients[layerPos].setZero();
+        mLayout = other.mLayout;
+        mGradients = other.mGradients;
+        bindLayerViews();
     }
+    return *this;
 }
 
-void NetworkLayerGradients::setLayerGradients(const SingleRowT& newLayerGrads, size_t layer)
+void NetworkLayerGradients::bindLayerViews()
 {
-    if(layer >= layerGradients.size())
+    mLayerViews.clear();
+    for(size_t layerPos = 0; layerPos < mLayout.numLayers(); ++layerPos)
+    {
+        const ParameterLayout::LayerSlot& slot = mLayout.slot(layerPos);
+        mLayerViews.emplace_back(mGradients.data() + slot.biasesOffset, slot.cols);
+    }
+}
+
+void NetworkLayerGradients::setLayerGradients(const Eigen::Ref<const SingleRowT>& newLayerGrads, size_t layer)
+{
+    if(layer >= mLayerViews.size())
     {
         throw std::out_of_range("Layer does not exist");
     }
-    layerGradients[layer] = (newLayerGrads);
+    if(newLayerGrads.size() != mLayerViews[layer].size())
+    {
+        throw std::out_of_range("Layer dimensions do not match");
+    }
+    mLayerViews[layer] = newLayerGrads;
 }
 
-const SingleRowT& NetworkLayerGradients::getLayerGradients(size_t layer) const
+const LayerBiasesMapT& NetworkLayerGradients::getLayerGradients(size_t layer) const
 {
-    if(layer >= layerGradients.size())
+    if(layer >= mLayerViews.size())
     {
         throw std::out_of_range("Layer does not exist");
     }
-    return layerGradients[layer];
+    return mLayerViews[layer];
+}
+
+LayerBiasesMapT& NetworkLayerGradients::getLayerGradients(size_t layer)
+{
+    if(layer >= mLayerViews.size())
+    {
+        throw std::out_of_range("Layer does not exist");
+    }
+    return mLayerViews[layer];
 }
 
 size_t NetworkLayerGradients::numLayers() const
 {
-    return layerGradients.size();
+    return mLayerViews.size();
 }
 
 void NetworkLayerGradients::setToZero() {
-    for(SingleRowT& layer: layerGradients) {
-        layer.setZero();
-    }
+    flat().setZero();
 }
 
 void NetworkLayerGradients::numericAddLayerGradients(const NetworkLayerGradients& layerGradsToAdd)
@@ -130,35 +222,41 @@ void NetworkLayerGradients::numericAddLayerGradients(const NetworkLayerGradients
     {
         throw std::out_of_range("Add: Number of layers do not match");
     }
-    for(size_t layerPos = 0; layerPos < numLayers(); ++layerPos)
+    if(layerGradsToAdd.mLayout != mLayout)
     {
-        // if layer is empty then simply assign layerGradsToAdd
-        if(layerGradients[layerPos].size() == 0)
-        {
-            layerGradients[layerPos] = layerGradsToAdd.getLayerGradients(layerPos);
-            continue;
-        }
-        // throw error if layers of different size
-        if ( layerGradients[layerPos].size() != layerGradsToAdd.getLayerGradients(layerPos).size() )
-        {
-            throw std::out_of_range("Layer dimensions do not match");
-        }
-        // add
-        layerGradients[layerPos].noalias() += layerGradsToAdd.getLayerGradients(layerPos); // efficient way to add
+        throw std::out_of_range("Layer dimensions do not match");
     }
+    flat().noalias() += layerGradsToAdd.flat(); // one pass over every layer
 }
 
 void NetworkLayerGradients::divideLayerGradients(size_t divideBy)
 {
-    for(size_t layerPos = 0; layerPos < numLayers(); ++layerPos)
-    {
-        layerGradients[layerPos] = layerGradients[layerPos].array() / divideBy;
-    }
+    flat() /= static_cast<NetNumT> (divideBy);
+}
+
+NetNumT NetworkLayerGradients::squaredNorm() const
+{
+    return flat().squaredNorm();
+}
+
+FlatParametersT NetworkLayerGradients::flat()
+{
+    return mGradients.region(0, mGradients.size());
+}
+
+ConstFlatParametersT NetworkLayerGradients::flat() const
+{
+    return mGradients.region(0, mGradients.size());
+}
+
+const ParameterLayout& NetworkLayerGradients::layout() const
+{
+    return mLayout;
 }
 
 // LOSS FUNCTIONS
 
-NetNumT calculateLossForExampleItem(const Labels& labels, LossFunc lossFunc, const SingleRowT& networkOut)
+NetNumT calculateLossForExampleItem(const Labels& labels, LossFunc lossFunc, const Eigen::Ref<const SingleRowT>& networkOut)
 {
     if (lossFunc == LossFunc::MSE)
     {
@@ -166,8 +264,17 @@ NetNumT calculateLossForExampleItem(const Labels& labels, LossFunc lossFunc, con
     }
     else if (lossFunc == LossFunc::CROSS_ENTROPY)
     {
-        constexpr NetNumT VERY_SMALL_NUMBER = 0.0000001f; // add this to output values so as to ensure no log(0)
-        return -( (networkOut.array() + VERY_SMALL_NUMBER).log() * labels.array()).sum();
+        // only the outputs with a target are logged. From probabilities the loss is infinite once the target's output
+        // underflows to 0, the batched losses use fusedSoftmaxCrossEntropy on the net inputs instead
+        NetNumT loss = 0;
+        for(Eigen::Index pos = 0; pos < labels.size(); ++pos)
+        {
+            if(labels(0, pos) != 0)
+            {
+                loss -= labels(0, pos) * std::log(networkOut(0, pos));
+            }
+        }
+        return loss;
     }
     else
     {
@@ -187,40 +294,172 @@ NetNumT calculateLossForExampleData(NNetwork& network, const ExampleData& trData
     return trainingError / static_cast<NetNumT> (trData.size()); // return average
 }
 
+static bool isPredictionCorrect(NNetwork& network, const ExampleItem& item, const ActFuncList &actFuncs)
+{
+    network.setInputs(item.inputs);
+    network.feedforward(actFuncs, 0);
+    if(actFuncs[actFuncs.size() - 1] == ActFunc::SOFTMAX)
+    {
+        const SingleRowT& output = network.outputLayer().getOutputs();
+        // find highest probability in output
+        const auto highestElementIt = std::max_element(output.begin(), output.end());
+        const Eigen::Index posOfHighestElement = std::distance(output.begin(), highestElementIt);
+        // accurate if highest probability prediction matches the answer
+        return item.labels.coeff(0, posOfHighestElement) == 1;
+    }
+    // how is accuracy calculated for mse? not sure it makes sense and how it would differ from loss
+    return false;
+}
+
 NetNumT calculateAccuracyForExampleData(NNetwork& network, const ExampleData& data, const ActFuncList &actFuncs)
 {
     double correct = 0;
     for(const auto& item : data)
     {
-        network.setInputs(item.inputs);
-        network.feedforward(actFuncs, 0);
-        if(actFuncs[actFuncs.size() - 1] == ActFunc::SOFTMAX)
+        if(isPredictionCorrect(network, item, actFuncs))
         {
-            const SingleRowT& output = network.outputLayer().getOutputs();
-            // find highest probability in output
-            const auto highestElementIt = std::max_element(output.begin(), output.end());
-            const Eigen::Index posOfHighestElement = std::distance(output.begin(), highestElementIt);
-            // accurate if highest probability prediction matches the answer
-            if(item.labels.coeff(0, posOfHighestElement) == 1)
+            correct++;
+        }
+    }
+    return (correct / static_cast<NetNumT> (data.size()) * 100);
+}
+
+Eigen::Index feedforwardBatch(NNetwork& network, ExampleBatchIterator batchStart, ExampleBatchIterator batchEnd, const ActFuncList& actFuncs, ExecutionPlan& plan, bool outputLogits)
+{
+    const Eigen::Index numItems = std::distance(batchStart, batchEnd);
+    if(!plan.isValidFor(network, static_cast<size_t> (numItems)))
+    {
+        throw std::logic_error("Execution plan does not fit the network or batch");
+    }
+    if(actFuncs.size() != network.numLayers())
+    {
+        throw std::logic_error("Number of activation functions does not match layers in network");
+    }
+    // gather the inputs one row per item
+    auto inputs = plan.batchInputs().topRows(numItems);
+    for(Eigen::Index row = 0; row < numItems; ++row)
+    {
+        inputs.row(row) = (batchStart + row)->inputs;
+    }
+    // then each layer is a single matrix multiplication over the batch
+    for(size_t layerPos = 0; layerPos < network.numLayers(); ++layerPos)
+    {
+        auto prevOutputs = (layerPos == 0 ? plan.batchInputs() : plan.batchOutputs(layerPos - 1)).topRows(numItems);
+        TraceScope layerTrace("forward_batch", "layer", static_cast<int64_t> (layerPos));
+        auto outputs = plan.batchOutputs(layerPos).topRows(numItems);
+        if(outputLogits && layerPos == network.numLayers() - 1)
+        {
+            multiplyLayer(prevOutputs, network.layer(layerPos).getWeights(), outputs, plan.batchParallelism(layerPos), &plan.forwardPacking(layerPos));
+            outputs.rowwise() += network.layer(layerPos).getBiases();
+            continue;
+        }
+        if(!fusedLayerForward(prevOutputs, network.layer(layerPos).getWeights(), network.layer(layerPos).getBiases(), actFuncs[layerPos], outputs, plan.batchParallelism(layerPos),
+                              nullptr, 1, &plan.forwardPacking(layerPos)))
+        {
+            throw std::logic_error("Batch outputs contain INF or NaN");
+        }
+    }
+    return numItems;
+}
+
+// rebuilds the plan if it no longer fits the network
+static void ensurePlanIsValid(NNetwork& network, ExecutionPlan& plan)
+{
+    if(!plan.isValidFor(network))
+    {
+        plan.rebuild(network);
+    }
+}
+
+NetNumT calculateLossForBatchSource(NNetwork& network, BatchSource& source, const ActFuncList& actFuncs, LossFunc lossFunc)
+{
+    ExecutionPlan plan(network, EVALUATION_BATCH_SZ);
+    return calculateLossForBatchSource(network, source, actFuncs, lossFunc, plan);
+}
+
+NetNumT calculateAccuracyForBatchSource(NNetwork& network, BatchSource& source, const ActFuncList &actFuncs)
+{
+    ExecutionPlan plan(network, EVALUATION_BATCH_SZ);
+    return calculateAccuracyForBatchSource(network, source, actFuncs, plan);
+}
+
+NetNumT calculateLossForBatchSource(NNetwork& network, BatchSource& source, const ActFuncList& actFuncs, LossFunc lossFunc, ExecutionPlan& plan)
+{
+    ensurePlanIsValid(network, plan);
+    NetNumT totalError = 0;
+    size_t numItems = 0; // counted as streamed sources do not know their size in advance
+    ExampleBatchIterator batchStart, batchEnd;
+    source.rewind();
+    const bool crossEntropy = lossFunc == LossFunc::CROSS_ENTROPY;
+    if(crossEntropy && actFuncs.back() != ActFunc::SOFTMAX)
+    {
+        throw std::logic_error("If cross entropy loss function then final hidden layer must use softmax activation function");
+    }
+    while(source.nextBatch(plan.batchSz(), batchStart, batchEnd))
+    {
+        const Eigen::Index batchItems = feedforwardBatch(network, batchStart, batchEnd, actFuncs, plan, crossEntropy);
+        auto outputs = plan.batchOutputs(network.numLayers() - 1).topRows(batchItems);
+        if(crossEntropy)
+        {
+            // softmax and the loss of the whole batch in one pass from the net inputs
+            auto targets = plan.batchTargets().topRows(batchItems);
+            for(Eigen::Index row = 0; row < batchItems; ++row)
             {
-                correct++;
+                targets.row(row) = (batchStart + row)->labels;
             }
+            totalError += fusedSoftmaxCrossEntropy(outputs, targets);
         }
-        // how is accuracy calculated for mse? not sure it makes sense and how it would differ from loss
+        else
+        {
+            for(Eigen::Index row = 0; row < batchItems; ++row)
+            {
+                totalError += calculateLossForExampleItem((batchStart + row)->labels, lossFunc, outputs.row(row));
+            }
+        }
+        numItems += static_cast<size_t> (batchItems);
+    }
+    return totalError / static_cast<NetNumT> (numItems); // return average
+}
 
+NetNumT calculateAccuracyForBatchSource(NNetwork& network, BatchSource& source, const ActFuncList &actFuncs, ExecutionPlan& plan)
+{
+    ensurePlanIsValid(network, plan);
+    double correct = 0;
+    size_t numItems = 0;
+    ExampleBatchIterator batchStart, batchEnd;
+    source.rewind();
+    while(source.nextBatch(plan.batchSz(), batchStart, batchEnd))
+    {
+        const Eigen::Index batchItems = feedforwardBatch(network, batchStart, batchEnd, actFuncs, plan);
+        // how is accuracy calculated for mse? not sure it makes sense and how it would differ from loss
+        if(actFuncs[actFuncs.size() - 1] == ActFunc::SOFTMAX)
+        {
+            const BatchActivationsMapT& outputs = plan.batchOutputs(network.numLayers() - 1);
+            for(Eigen::Index row = 0; row < batchItems; ++row)
+            {
+                // accurate if highest probability prediction matches the answer
+                Eigen::Index posOfHighestElement;
+                outputs.row(row).maxCoeff(&posOfHighestElement);
+                if((batchStart + row)->labels.coeff(0, posOfHighestElement) == 1)
+                {
+                    correct++;
+                }
+            }
+        }
+        numItems += static_cast<size_t> (batchItems);
     }
-    return (correct / static_cast<NetNumT> (data.size()) * 100);
+    return static_cast<NetNumT> (correct / static_cast<double> (numItems) * 100);
 }
 
 // GRADIENT CALCULATION ALGORITHMS
-void initialiseWeightsBiases(NNetwork& network, InitMethod method)
+void initialiseWeightsBiases(NNetwork& network, InitMethod method, unsigned int seed)
 {
     if(method == InitMethod::NO_INIT)
     {
         // if no init then leave weights and biases
         return;
     }
-    std::default_random_engine generator(12345);
+    std::default_random_engine generator(seed);
     for(size_t layerPos = 0; layerPos < network.numLayers(); ++layerPos)
     {
         LayerWeightsT lWeights = network.layer(layerPos).getWeights();
@@ -265,94 +504,154 @@ void initialiseWeightsBiases(NNetwork& network, InitMethod method)
     }
 }
 
-SingleRowT calculateActivationFunctionGradients(const NLayer& layer, ActFunc actFunc)
+void multiplyByActivationGradients(Eigen::Ref<BatchActivationsT> values, const Eigen::Ref<const BatchActivationsT>& outputs, ActFunc actFunc)
 {
-    // this function calculates the derivative of the output of a layer wrt to the net input (the derivative thus depends upon the activation function)
-
     if(actFunc == ActFunc::SIGMOID)
     {
-        return layer.getOutputs().array() * (1 - layer.getOutputs().array());
+        values.array() *= outputs.array() * (1 - outputs.array());
     }
     else if(actFunc == ActFunc::RELU)
     {
-        // Heaviside step function (derivative undefined at input 0 so set at 0)
-        return (layer.getOutputs().array() > 0).template cast<NetNumT>();
+        values.array() *= (outputs.array() > 0).template cast<NetNumT>();
     }
     // no softmax derivative as always combined with cross entropy loss
-    else {
-        throw std::runtime_error("Unsupported loss function.");
+    else
+    {
+        throw std::runtime_error("Unsupported activation function for back propagation.");
     }
 }
 
-SingleRowT calculateOutputLayerGradientsForExampleItem(const NLayer& outputLayer, ActFunc actFuncForOutputLayer, LossFunc lossFunc, const Labels& targets)
+void updateNetworkUsingGradients(NNetwork& network, const NetworkLayerGradients& layerGrads, const NetworkWeightGradients& weightGrads, const LearningRateList& learningRatesPerLayer, NetNumT momentumFactor, NetworkLayerGradients& prevUpdateBiasDelta, NetworkWeightGradients& prevUpdateWeightDelta)
 {
-    // This function calculates the derivative of the error wrt to the net input to the final layer
+    if(learningRatesPerLayer.size() != network.numLayers())
+    {
+        throw std::logic_error("Number of learning rate layers does not match number of network layers");
+    }
 
-    if (lossFunc == LossFunc::CROSS_ENTROPY)
+    if(weightGrads.layout() != network.parameterLayout() || layerGrads.layout() != network.parameterLayout() ||
+       prevUpdateWeightDelta.layout() != network.parameterLayout() || prevUpdateBiasDelta.layout() != network.parameterLayout())
     {
-        // simplified calculation of derivative for cross entropy loss and softmax activation (this is just the actual output - ground truth)
-        return outputLayer.getOutputs() - targets;
+        throw std::logic_error("Gradients do not match the network topology");
     }
-    if (lossFunc == LossFunc::MSE)
+
+    // momentum based calculation of the deltas - a single pass over every layer's gradients
+    const auto momentum = static_cast<NetNumT> (momentumFactor);
+    FlatParametersT weightsDelta = prevUpdateWeightDelta.flat(), biasDelta = prevUpdateBiasDelta.flat();
+    weightsDelta = ((1 - momentum) * weightGrads.flat()) + (momentum * weightsDelta);
+    biasDelta = ((1 - momentum) * layerGrads.flat()) + (momentum * biasDelta);
+
+    // update by learning rate * delta (the padding between layers stays zero)
+    FlatParametersT weights = network.weightParameters(), biases = network.biasParameters();
+    const bool sameLearningRate = std::all_of(learningRatesPerLayer.begin(), learningRatesPerLayer.end(),
+                                              [&](NetNumT lr){ return lr == learningRatesPerLayer[0]; });
+    if(sameLearningRate)
     {
-        // first calculate the derivative of the error wrt to the output of the final layer
-        SingleRowT gradientOfMse = outputLayer.getOutputs() - targets;
-        // then calculate the derivative of the output of the final layer wrt to the net input (i.e the derivative of the activation function)
-        SingleRowT gradientOfActFunc = calculateActivationFunctionGradients(outputLayer, actFuncForOutputLayer);
-        // then calculate the derivative of the error wrt to the net input
-        return gradientOfMse.array() * gradientOfActFunc.array();
+        weights.noalias() -= learningRatesPerLayer[0] * weightsDelta;
+        biases.noalias() -= learningRatesPerLayer[0] * biasDelta;
+        return;
     }
-    else {
-        throw std::runtime_error("Unsupported loss function.");
+    // otherwise each layer has its own learning rate so update its contiguous segment
+    const ParameterLayout& layout = network.parameterLayout();
+    for(size_t layerPos = 0; layerPos < layout.numLayers(); ++layerPos)
+    {
+        const ParameterLayout::LayerSlot& slot = layout.slot(layerPos);
+        const auto numWeights = slot.rows * slot.cols;
+        const auto weightsOffset = static_cast<Eigen::Index> (slot.weightsOffset), biasesOffset = static_cast<Eigen::Index> (slot.biasesOffset);
+        weights.segment(weightsOffset, numWeights).noalias() -= learningRatesPerLayer[layerPos] * weightsDelta.segment(weightsOffset, numWeights);
+        biases.segment(biasesOffset, slot.cols).noalias() -= learningRatesPerLayer[layerPos] * biasDelta.segment(biasesOffset, slot.cols);
     }
 }
 
-void calculateHiddenLayerGradientsForExampleItem(NNetwork& network, const ActFuncList& actFuncs, NetworkLayerGradients& layerGrads)
+// forward and back propagates numItems items together (at most plan.batchSz()), adding their gradients to layerGrads and weightGrads
+static void accumulateGradientsOverChunk(NNetwork& network, ExampleBatchIterator chunkStart, Eigen::Index numItems, const ActFuncList& actFuncs, LossFunc lossFunc, NetworkLayerGradients& layerGrads, NetworkWeightGradients& weightGrads, NetNumT dropOutRate, ExecutionPlan& plan)
 {
-    const size_t lastHiddenLayer = network.numLayers() - 2; // -1 is the output layer so -2 is last hidden layer
-    // reverse backwards through each layer
-    for (size_t layerPos = lastHiddenLayer; layerPos != (size_t) - 1;--layerPos)
+    const size_t outputLayerPos = network.numLayers() - 1;
+    // the products pack into the plan's buffers so nothing here allocates
     {
-        const LayerWeightsT& weightsOfSubsequentLayer = network.layer(layerPos + 1).getWeights();
-        const SingleRowT& subsequentLayerGrads = layerGrads.getLayerGradients(layerPos + 1);
-        //
-        SingleRowT errorWrtOutput = subsequentLayerGrads * weightsOfSubsequentLayer.transpose();
-        // calculate the derivative of the output of the layer wrt to the net input
-        SingleRowT activationFunctionGradient = calculateActivationFunctionGradients(network.layer(layerPos), actFuncs[layerPos]);
-        // calculate the derivative of the error wrt to the net input
-        SingleRowT errorWrtNetInput = errorWrtOutput.array() * activationFunctionGradient.array();
-
-        if (!errorWrtNetInput.allFinite())
+        AllocationScope forwardScope(TrainingPhase::FORWARD, true);
+        PhaseTimer forwardTimer(ProfiledPhase::FORWARD);
+        auto inputs = plan.batchInputs().topRows(numItems);
+        auto targets = plan.batchTargets().topRows(numItems);
+        for(Eigen::Index row = 0; row < numItems; ++row)
         {
-            throw std::logic_error("(1) Contains INF or NaN");
+            inputs.row(row) = (chunkStart + row)->inputs;
+            targets.row(row) = (chunkStart + row)->labels;
+        }
+        // drawn item by item, layer by layer, as feedforward draws them for one item
+        for(Eigen::Index row = 0; dropOutRate > 0 && row < numItems; ++row)
+        {
+            for(size_t layerPos = 0; layerPos < outputLayerPos; ++layerPos)
+            {
+                network.drawDropOutMask(dropOutRate, plan.batchDropOutMasks(layerPos).row(row));
+            }
+        }
+        for(size_t layerPos = 0; layerPos < network.numLayers(); ++layerPos)
+        {
+            PhaseTimer layerTimer(ProfiledPhase::FORWARD, layerPos);
+            NLayer& layer = network.layer(layerPos);
+            auto prevOutputs = (layerPos == 0 ? plan.batchInputs() : plan.batchOutputs(layerPos - 1)).topRows(numItems);
+            auto outputs = plan.batchOutputs(layerPos).topRows(numItems);
+            if(layerPos == outputLayerPos && lossFunc == LossFunc::CROSS_ENTROPY)
+            {
+                // the FINAL LAYER gradients come out of the fused softmax and cross entropy
+                multiplyLayer(prevOutputs, layer.getWeights(), outputs, plan.batchParallelism(layerPos), &plan.forwardPacking(layerPos));
+                outputs.rowwise() += layer.getBiases();
+                fusedSoftmaxCrossEntropy(outputs, targets, plan.batchErrors(layerPos).topRows(numItems));
+                continue;
+            }
+            const bool applyDropOut = layerPos < outputLayerPos && dropOutRate > 0;
+            if(!fusedLayerForward(prevOutputs, layer.getWeights(), layer.getBiases(), actFuncs[layerPos], outputs, plan.batchParallelism(layerPos),
+                                  applyDropOut ? plan.batchDropOutMasks(layerPos).data() : nullptr, 1 / (1 - dropOutRate), &plan.forwardPacking(layerPos)))
+            {
+                throw std::logic_error("(5) INF or NaN");
+            }
         }
-        layerGrads.setLayerGradients(errorWrtNetInput, layerPos);
     }
-}
-
-void calculateWeightGradientsForExampleItem(NNetwork& network, const NetworkLayerGradients& layerGrads, NetworkWeightGradients& weightGrads)
-{
-    // move from the weights for the output layer back through the weights for hidden layers of the network
-    for(size_t layerPos = network.numLayers() - 1; layerPos != (size_t) - 1 ; --layerPos)
+    AllocationScope backwardScope(TrainingPhase::BACKWARD, true);
     {
-        SingleRowT prevLayerOutput;
-        if(layerPos > 0)
+        PhaseTimer backwardTimer(ProfiledPhase::BACKWARD);
+        // calculate the FINAL LAYER gradients
+        if(lossFunc != LossFunc::CROSS_ENTROPY)
         {
-            prevLayerOutput = network.layer(layerPos - 1).getOutputs();
+            PhaseTimer layerTimer(ProfiledPhase::BACKWARD, outputLayerPos);
+            auto outputs = plan.batchOutputs(outputLayerPos).topRows(numItems);
+            auto outputErrors = plan.batchErrors(outputLayerPos).topRows(numItems);
+            outputErrors = outputs - plan.batchTargets().topRows(numItems);
+            multiplyByActivationGradients(outputErrors, outputs, actFuncs[outputLayerPos]);
+            if(!outputErrors.allFinite())
+            {
+                throw std::logic_error("(3) Contains INF or NaN");
+            }
         }
-        else
+        // then the HIDDEN LAYER gradients, one product with the subsequent layer's weights per layer
+        for(size_t layerPos = outputLayerPos - 1; layerPos != (size_t) - 1; --layerPos)
         {
-            prevLayerOutput = network.getInputs(); // if layer is first hidden layer (layer 0) then output of previous layer is input
+            PhaseTimer layerTimer(ProfiledPhase::BACKWARD, layerPos);
+            auto errors = plan.batchErrors(layerPos).topRows(numItems);
+            multiplyLayerTransposed(plan.batchErrors(layerPos + 1).topRows(numItems), network.layer(layerPos + 1).getWeights(), errors, plan.backwardParallelism(layerPos + 1),
+                                    &plan.backwardPacking(layerPos + 1));
+            multiplyByActivationGradients(errors, plan.batchOutputs(layerPos).topRows(numItems), actFuncs[layerPos]);
+            if(!errors.allFinite())
+            {
+                throw std::logic_error("(1) Contains INF or NaN");
+            }
         }
-        const SingleRowT& currentLayerGrad = layerGrads.getLayerGradients(layerPos);
-        // the gradients of weights can be calculated as the matrix multiplication of the transpose of the output of the  layer preceding the weights
-        // multiplied by the gradients of the layer succeeding the weights (already calculated).
-        LayerWeightsT weightGradsForLayer = prevLayerOutput.transpose() * currentLayerGrad;
-        weightGrads.setWeightGradientsForLayer(weightGradsForLayer, layerPos);
+    }
+
+    // calculate the WEIGHT gradients (summed over the items by the product) and the layer gradients
+    PhaseTimer weightGradientTimer(ProfiledPhase::WEIGHT_GRADIENTS);
+    for(size_t layerPos = outputLayerPos; layerPos != (size_t) - 1; --layerPos)
+    {
+        PhaseTimer layerTimer(ProfiledPhase::WEIGHT_GRADIENTS, layerPos);
+        auto errors = plan.batchErrors(layerPos).topRows(numItems);
+        auto prevOutputs = (layerPos == 0 ? plan.batchInputs() : plan.batchOutputs(layerPos - 1)).topRows(numItems);
+        accumulateWeightGradients(prevOutputs, errors, weightGrads.getWeightGradientsForLayer(layerPos), plan.batchParallelism(layerPos),
+                                  plan.weightGradientPartials(layerPos), plan.numWeightGradientPartials(), &plan.weightGradientPacking(layerPos));
+        layerGrads.getLayerGradients(layerPos).noalias() += errors.colwise().sum();
     }
 }
 
-void calculateGradientsForExampleItem(NNetwork& network, const ActFuncList& actFuncs, LossFunc lossFunc, const ExampleItem& trItem, NetworkLayerGradients& layerGrads, NetworkWeightGradients& weightGrads, NetNumT dropOutRate)
+void calculateGradientsOverBatch(NNetwork& network, ExampleBatchIterator batchStart, ExampleBatchIterator batchEnd, const ActFuncList& actFuncs, LossFunc lossFunc, NetworkLayerGradients& averagedLayerGrads, NetworkWeightGradients& averagedWeightGrads, NetNumT dropOutRate, ExecutionPlan& plan)
 {
     if(actFuncs.size() != network.numLayers())
     {
@@ -362,131 +661,345 @@ void calculateGradientsForExampleItem(NNetwork& network, const ActFuncList& actF
     {
         throw std::logic_error("If cross entropy loss function then final hidden layer must use softmax activation function");
     }
-    // load inputs and feedforward
-    network.setInputs(trItem.inputs.cast<NetNumT>());
-    network.feedforward(actFuncs, dropOutRate);
-
-    // calculate the FINAL LAYER gradients
-    const size_t outputLayerPos = network.numLayers() - 1;
-    const SingleRowT outputLayerGradients = calculateOutputLayerGradientsForExampleItem(network.outputLayer(), actFuncs[outputLayerPos], lossFunc, trItem.labels);
-    if(!outputLayerGradients.allFinite())
+    if(!plan.isValidFor(network) || plan.batchSz() == 0)
     {
-        throw std::logic_error("(3) Contains INF or NaN");
+        throw std::logic_error("Execution plan was built for a different topology");
     }
-    layerGrads.setLayerGradients(outputLayerGradients, outputLayerPos);
-
-    // calculate the HIDDEN LAYER gradients
-    calculateHiddenLayerGradientsForExampleItem(network, actFuncs,layerGrads);
-
-    // calculate the WEIGHT gradients
-    calculateWeightGradientsForExampleItem(network, layerGrads, weightGrads);
+    // running totals, divided at the end to find the average
+    const auto numItems = std::distance(batchStart, batchEnd);
+    const auto chunkSz = static_cast<Eigen::Index> (plan.batchSz());
+    for(Eigen::Index chunkStart = 0; chunkStart < numItems; chunkStart += chunkSz)
+    {
+        accumulateGradientsOverChunk(network, batchStart + chunkStart, std::min(chunkSz, numItems - chunkStart), actFuncs, lossFunc,
+                                     averagedLayerGrads, averagedWeightGrads, dropOutRate, plan);
+    }
+    averagedLayerGrads.divideLayerGradients(static_cast<size_t> (numItems));
+    averagedWeightGrads.divideWeightGradients(static_cast<size_t> (numItems));
 }
 
-void updateNetworkUsingGradients(NNetwork& network, const NetworkLayerGradients& layerGrads, const NetworkWeightGradients& weightGrads, const LearningRateList& learningRatesPerLayer, NetNumT momentumFactor, NetworkLayerGradients& prevUpdateBiasDelta, NetworkWeightGradients& prevUpdateWeightDelta)
+TrainingResult train(NNetwork& network, ExampleData& trainingData, const ActFuncList& actFuncs, LossFunc lossFunc, const LearningRateList& lrList, NetNumT momentum, InitMethod initMethod, size_t epochsToRun, size_t batchSz, const ExampleData& testData, NetNumT dropOutRate, const TrainingOptions& options)
 {
-    if(learningRatesPerLayer.size() != network.numLayers())
+    if (!isTrainingDataValid(network.classes(), trainingData, network.getInputs().size()))
     {
-        throw std::logic_error("Number of learning rate layers does not match number of network layers");
+        throw std::logic_error("Training data invalid");
     }
+    ExampleDataSource trainingSource(trainingData, true);
+    ExampleDataSource testSource(testData, false);
+    return train(network, trainingSource, actFuncs, lossFunc, lrList, momentum, initMethod, epochsToRun, batchSz, testSource, dropOutRate, options);
+}
 
-    //  go backwards through the network starting at the output layer
-    size_t layerPos = network.numLayers() - 1;
-    do
+static bool isCheckpointDue(const CheckpointOptions& checkpointOptions, size_t batchesSinceCheckpoint, std::chrono::steady_clock::time_point lastCheckpoint)
+{
+    if(checkpointOptions.everyNBatches > 0 && batchesSinceCheckpoint >= checkpointOptions.everyNBatches)
     {
-        // each layer has its own learning rate
-        const NetNumT learningRateForLayer = learningRatesPerLayer[layerPos];
-
-        // update weights
-
-        const LayerWeightsT& layerWeights = network.layer(layerPos).getWeights(); // the weights for this layer
-        const LayerWeightsT& layerWeightGrads = weightGrads.getWeightGradientsForLayer(layerPos); // the gradients for the weights of this layer
-        const LayerWeightsT& layerWeightsDelta = ((1.0 - momentumFactor) * layerWeightGrads) + // momentum based calculation
-                                                    (momentumFactor * prevUpdateWeightDelta.getWeightGradientsForLayer(layerPos));
-        network.layer(layerPos).setWeights(layerWeights - (learningRateForLayer * layerWeightsDelta)); // update by learning rate * gradients
-        prevUpdateWeightDelta.setWeightGradientsForLayer(layerWeightsDelta, layerPos);
-
-        // update biases
-
-        const SingleRowT& layerBiases = network.layer(layerPos).getBiases();
-        const SingleRowT& layerBiasGrads = layerGrads.getLayerGradients(layerPos);
-        const SingleRowT& layerBiasDelta = ((1 - momentumFactor) * layerBiasGrads) + (momentumFactor * prevUpdateBiasDelta.getLayerGradients(layerPos));
-        network.layer(layerPos).setBiases(layerBiases - (learningRateForLayer * layerBiasDelta));
-        prevUpdateBiasDelta.setLayerGradients(layerBiasDelta, layerPos);
-    } while (layerPos-- != 0);
+        return true;
+    }
+    return checkpointOptions.everyNMinutes > 0 &&
+           std::chrono::duration<double, std::ratio<60>>(std::chrono::steady_clock::now() - lastCheckpoint).count() >= checkpointOptions.everyNMinutes;
 }
 
-void calculateGradientsOverBatch(NNetwork& network, ExampleData::iterator batchStart, ExampleData::iterator batchEnd, const ActFuncList& actFuncs, LossFunc lossFunc, NetworkLayerGradients& averagedLayerGrads, NetworkWeightGradients& averagedWeightGrads, NetNumT dropOutRate)
+// lower is better for losses
+static bool isImprovement(StoppingMetric metric, NetNumT value, NetNumT best, NetNumT minDelta)
 {
-    // these are the gradients for each item in the batch (used to calculate the average gradients passed as a parameter to this method)
-    NetworkLayerGradients layerGradientsForItem(network);
-    NetworkWeightGradients weightGradientsForItem(network);
-
-    for(auto trItemIt = batchStart; trItemIt != batchEnd; ++trItemIt)
+    if(metric == StoppingMetric::TEST_LOSS || metric == StoppingMetric::TRAINING_LOSS)
     {
-        // calculate gradients for the item in the minibatch
-        calculateGradientsForExampleItem(network, actFuncs, lossFunc, *trItemIt, layerGradientsForItem, weightGradientsForItem, dropOutRate);
-        // add calculated gradients for item to running total
-        averagedLayerGrads.numericAddLayerGradients(layerGradientsForItem);
-        averagedWeightGrads.numericAddWeightGradients(weightGradientsForItem);
+        return value < best - minDelta;
     }
-    // divide running total of gradients to find average
-    averagedLayerGrads.divideLayerGradients(std::distance(batchStart, batchEnd));
-    averagedWeightGrads.divideWeightGradients(std::distance(batchStart, batchEnd));
+    return value > best + minDelta;
 }
 
-void train(NNetwork& network, ExampleData& trainingData, const ActFuncList& actFuncs, LossFunc lossFunc, const LearningRateList& lrList, NetNumT momentum, InitMethod initMethod, size_t epochsToRun, size_t batchSz, const ExampleData& testData, NetNumT dropOutRate)
+static NetNumT stoppingMetricValue(StoppingMetric metric, const EvaluationMetrics& evaluation)
 {
-    if (!isTrainingDataValid(network.classes(), trainingData, network.getInputs().size()))
+    switch (metric)
     {
-        throw std::logic_error("Training data invalid");
+        case StoppingMetric::TEST_LOSS: return evaluation.testLoss;
+        case StoppingMetric::TEST_ACCURACY: return evaluation.testAccuracy;
+        case StoppingMetric::TRAINING_LOSS: return evaluation.trainingLoss;
+        case StoppingMetric::TRAINING_ACCURACY: return evaluation.trainingAccuracy;
     }
-    initialiseWeightsBiases(network, initMethod);
+    throw std::logic_error("Unsupported stopping metric");
+}
 
-    // prev weight updates for momentum - set to 0 for first update
-    NetworkWeightGradients prevWeightDelta(network);
-    NetworkLayerGradients prevBiasDelta(network);
+// the training loop shared by train() and resumeTraining(), starting after startBatch batches of startEpoch
+static TrainingResult runTraining(NNetwork& network, BatchSource& trainingSource, const ActFuncList& actFuncs, LossFunc lossFunc, const LearningRateList& lrList, NetNumT momentum, size_t epochsToRun, size_t batchSz, BatchSource& testSource, NetNumT dropOutRate, const TrainingOptions& options,
+                        NetworkWeightGradients& prevWeightDelta, NetworkLayerGradients& prevBiasDelta, size_t startEpoch, size_t startBatch)
+{
+    const EarlyStoppingOptions& earlyStopping = options.earlyStopping;
+    if(earlyStopping.patience > 0 && options.evaluateEveryNEpochs == 0)
+    {
+        throw std::logic_error("Early stopping needs evaluations");
+    }
+    if(!options.evaluateTrainingData && (earlyStopping.metric == StoppingMetric::TRAINING_LOSS || earlyStopping.metric == StoppingMetric::TRAINING_ACCURACY))
+    {
+        throw std::logic_error("Stopping on a training metric needs the training data to be evaluated");
+    }
+    if(lrList.size() != network.numLayers())
+    {
+        throw std::logic_error("Number of learning rate layers does not match number of network layers");
+    }
 
     // these contain the gradients for each (mini) batch - declared here to save time from reinitialising in each loop
     NetworkLayerGradients lGradsOverBatch(network);
     NetworkWeightGradients wGradsOverBatch(network);
+    // every buffer a training step / evaluation needs, allocated once
+    ExecutionPlan trainingPlan(network, batchSz);
+    ExecutionPlan evaluationPlan(network, EVALUATION_BATCH_SZ);
+
+    std::unique_ptr<CheckpointWriter> checkpointWriter;
+    if(!options.checkpoint.fileName.empty())
+    {
+        checkpointWriter = std::make_unique<CheckpointWriter>(options.checkpoint.fileName);
+    }
+    size_t batchesSinceCheckpoint = 0;
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+
+    // progress goes to the caller's callbacks plus sinks for the console / stats file - sinks write on their own threads
+    std::vector<TrainingCallback*> callbacks = options.callbacks;
+    std::unique_ptr<MetricsSink> consoleSink, statsFileSink;
+    if(options.consoleOutput)
+    {
+        consoleSink = std::make_unique<MetricsSink>(std::make_unique<ConsoleMetricsWriter>(std::cout));
+        callbacks.push_back(consoleSink.get());
+    }
+    if(!options.statsFile.empty())
+    {
+        statsFileSink = std::make_unique<MetricsSink>(std::make_unique<StatsJsonMetricsWriter>(options.statsFile));
+        callbacks.push_back(statsFileSink.get());
+    }
+
+    // a trace file traces this run unless the caller is already tracing - it is written even if training throws
+    TraceFileSession traceSession(options.traceFile);
 
-    for(size_t epoch = 0; epoch < epochsToRun; ++epoch)
+    // the schedule is a function of the batch's position in the whole run. steps are counted as batches are trained rather
+    // than derived from the source's size, which a streaming source only knows after its first pass
+    const size_t stepsPerEpoch = (trainingSource.size() + batchSz - 1) / batchSz;
+    const size_t totalSteps = stepsPerEpoch * std::max(epochsToRun, options.scheduleEpochs);
+    if(stepsPerEpoch == 0 && options.schedule.needsRunLength())
+    {
+        throw std::logic_error("Cosine and one cycle schedules need the size of the training data");
+    }
+    if(stepsPerEpoch == 0 && startEpoch > 0 && options.schedule.warmupSteps() > 0)
     {
+        throw std::logic_error("Resuming a warmup needs the size of the training data");
+    }
+    size_t step = startEpoch * stepsPerEpoch + startBatch;
+    LearningRateList scheduledLrList = lrList;
+    double learningRateFactor = 1;
+
+    TrainingResult result;
+    result.epochsRun = startEpoch;
+    size_t evaluationsWithoutImprovement = 0;
+    bool bestIsCurrent = false; // the network still has the best weights
+    Eigen::Matrix<NetNumT, Eigen::Dynamic, 1> bestWeights, bestBiases;
+
+    ExampleBatchIterator batchStart, batchEnd;
+    auto nextTrainingBatch = [&]()
+    {
+        AllocationScope dataLoadScope(TrainingPhase::DATA_LOAD);
+        PhaseTimer gatherTimer(ProfiledPhase::GATHER);
+        return trainingSource.nextBatch(batchSz, batchStart, batchEnd);
+    };
+    for(size_t epoch = startEpoch; epoch < epochsToRun; ++epoch)
+    {
+        EpochStats epochStats;
+        epochStats.epoch = epoch;
+        for(size_t layerPos = 0; layerPos < network.numLayers(); ++layerPos)
+        {
+            const ParameterLayout::LayerSlot& slot = network.parameterLayout().slot(layerPos);
+            epochStats.layers.push_back({static_cast<size_t> (slot.rows), static_cast<size_t> (slot.cols)});
+        }
+        PhaseTimerTarget timerTarget(epochStats);
+        TraceScope epochTrace("epoch", "epoch", static_cast<int64_t> (epoch));
+
         auto start = std::chrono::steady_clock::now();
         // random shuffle and then update for each minibatch
-        std::shuffle(trainingData.begin(), trainingData.end(), std::default_random_engine(12345));
+        {
+            PhaseTimer shuffleTimer(ProfiledPhase::SHUFFLE);
+            trainingSource.startEpoch(epoch);
+        }
+        size_t batchInEpoch = 0;
+        // when resuming, skip the batches that were applied before the checkpoint
+        while(epoch == startEpoch && batchInEpoch < startBatch && nextTrainingBatch())
+        {
+            batchInEpoch++;
+        }
         // loop through the training data in the batch size
-        for(auto trItemIt = trainingData.begin(); trItemIt < trainingData.end(); trItemIt += static_cast<std::vector<ExampleItem>::difference_type>(batchSz))
+        size_t batchesTrained = 0;
+        while(nextTrainingBatch())
         {
-            auto batchEnd = trItemIt + static_cast<std::vector<ExampleItem>::difference_type>(batchSz);
-            if(batchEnd > trainingData.end())
+            TraceScope batchTrace("batch", "batch", static_cast<int64_t> (batchInEpoch));
+            const auto batchTimerStart = std::chrono::steady_clock::now();
+            if(!options.schedule.isConstant())
             {
-                batchEnd = trainingData.end();
+                learningRateFactor = options.schedule.factor(step, epoch, totalSteps);
+                for(size_t layerPos = 0; layerPos < lrList.size(); ++layerPos)
+                {
+                    scheduledLrList[layerPos] = static_cast<NetNumT> (lrList[layerPos] * learningRateFactor);
+                }
             }
+            bestIsCurrent = false;
             // calculate the average gradients over the batch
-            calculateGradientsOverBatch(network, trItemIt, batchEnd, actFuncs, lossFunc, lGradsOverBatch, wGradsOverBatch, dropOutRate);
-            // update the network with the averaged gradients
-            updateNetworkUsingGradients(network, lGradsOverBatch, wGradsOverBatch, lrList, momentum, prevBiasDelta, prevWeightDelta);
-            // clear averaged  gradients - is this necessary?
-            wGradsOverBatch.setToZero();
-            lGradsOverBatch.setToZero();
+            calculateGradientsOverBatch(network, batchStart, batchEnd, actFuncs, lossFunc, lGradsOverBatch, wGradsOverBatch, dropOutRate, trainingPlan);
+            epochStats.samples += static_cast<size_t> (std::distance(batchStart, batchEnd));
+            {
+                AllocationScope optimizerScope(TrainingPhase::OPTIMIZER, true);
+                PhaseTimer updateTimer(ProfiledPhase::UPDATE);
+                // update the network with the averaged gradients
+                updateNetworkUsingGradients(network, lGradsOverBatch, wGradsOverBatch, scheduledLrList, momentum, prevBiasDelta, prevWeightDelta);
+                // clear averaged  gradients - is this necessary?
+                wGradsOverBatch.setToZero();
+                lGradsOverBatch.setToZero();
+            }
+            if(!callbacks.empty())
+            {
+                BatchMetrics batchMetrics;
+                batchMetrics.epoch = epoch;
+                batchMetrics.batch = batchInEpoch;
+                batchMetrics.samples = static_cast<size_t> (std::distance(batchStart, batchEnd));
+                batchMetrics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchTimerStart).count();
+                for(TrainingCallback* callback : callbacks)
+                {
+                    callback->onBatchEnd(batchMetrics);
+                }
+            }
+
+            batchInEpoch++;
+            batchesTrained++;
+            step++;
+            batchesSinceCheckpoint++;
+            if(checkpointWriter && isCheckpointDue(options.checkpoint, batchesSinceCheckpoint, lastCheckpoint))
+            {
+                // only the snapshot copy happens on this thread - the write is in the background
+                checkpointWriter->submit(snapshotTraining(network, prevWeightDelta, prevBiasDelta, epoch, batchInEpoch, options.checkpoint.normaliser));
+                batchesSinceCheckpoint = 0;
+                lastCheckpoint = std::chrono::steady_clock::now();
+            }
         }
 
         auto end = std::chrono::steady_clock::now();
+        epochStats.wallSeconds = std::chrono::duration<double>(end - start).count();
 
-        // Print
+        // evaluate every N epochs (and after the last)
+        if(options.evaluateEveryNEpochs > 0 && ((epoch + 1) % options.evaluateEveryNEpochs == 0 || epoch + 1 == epochsToRun))
+        {
+            EvaluationMetrics evaluation;
+            evaluation.epoch = epoch;
+            const auto evaluationStart = std::chrono::steady_clock::now();
+            {
+                // Eigen's matrix products may allocate blocking buffers for large batches so this phase is only counted
+                AllocationScope evaluationScope(TrainingPhase::EVALUATION);
+                PhaseTimer evaluationTimer(ProfiledPhase::EVALUATION);
+                if(options.evaluateTrainingData)
+                {
+                    evaluation.trainingEvaluated = true;
+                    evaluation.trainingItems = trainingSource.size();
+                    evaluation.trainingLoss = calculateLossForBatchSource(network, trainingSource, actFuncs, lossFunc, evaluationPlan);
+                    evaluation.trainingAccuracy = calculateAccuracyForBatchSource(network, trainingSource, actFuncs, evaluationPlan);
+                }
+                evaluation.testItems = testSource.size();
+                evaluation.testLoss = calculateLossForBatchSource(network, testSource, actFuncs, lossFunc, evaluationPlan);
+                evaluation.testAccuracy = calculateAccuracyForBatchSource(network, testSource, actFuncs, evaluationPlan);
+            }
+            evaluation.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - evaluationStart).count();
+            for(TrainingCallback* callback : callbacks)
+            {
+                callback->onEvaluation(evaluation);
+            }
 
-        std::cout << "Threads: " << Eigen::nbThreads() << std::endl;
-        std::cout << "Epoch: " << epoch << std::endl;
-        std::cout << "Time: " << std::chrono::duration <double, std::milli> (end - start).count() << " ms" << std::endl;
-        std::cout << " -> Training Data (" << trainingData.size() << " items):\n";
-        std::cout << "   --> Average Loss: " << std::fixed << calculateLossForExampleData(network, trainingData, actFuncs, lossFunc) << std::endl;
-        std::cout << "   --> Accuracy: " << std::fixed << calculateAccuracyForExampleData(network, trainingData, actFuncs) << "%" << std::endl;
+            const NetNumT metricValue = stoppingMetricValue(earlyStopping.metric, evaluation);
+            if(!result.evaluated || isImprovement(earlyStopping.metric, metricValue, result.bestMetric, earlyStopping.minDelta))
+            {
+                result.evaluated = true;
+                result.bestEpoch = epoch;
+                result.bestMetric = metricValue;
+                evaluationsWithoutImprovement = 0;
+                if(earlyStopping.patience > 0 && earlyStopping.restoreBestWeights)
+                {
+                    bestWeights = network.weightParameters();
+                    bestBiases = network.biasParameters();
+                    bestIsCurrent = true;
+                }
+            }
+            else
+            {
+                evaluationsWithoutImprovement++;
+                result.stoppedEarly = earlyStopping.patience > 0 && evaluationsWithoutImprovement >= earlyStopping.patience;
+            }
+        }
+        result.epochsRun = epoch + 1;
+
+        epochStats.finalise();
+        if(options.stats)
+        {
+            options.stats->epochs.push_back(epochStats);
+        }
+        if(!callbacks.empty())
+        {
+            EpochMetrics epochMetrics;
+            epochMetrics.epoch = epoch;
+            epochMetrics.threads = Eigen::nbThreads();
+            epochMetrics.seconds = epochStats.wallSeconds;
+            epochMetrics.batches = batchesTrained;
+            epochMetrics.learningRateFactor = learningRateFactor;
+            epochMetrics.stoppingEarly = result.stoppedEarly;
+            epochMetrics.bestEpoch = result.bestEpoch;
+            epochMetrics.stats = epochStats;
+            epochMetrics.allocationsTracked = allocationTrackingEnabled();
+            epochMetrics.allocations = allocationReport();
+            for(TrainingCallback* callback : callbacks)
+            {
+                callback->onEpochEnd(epochMetrics);
+            }
+        }
+        if(allocationTrackingEnabled())
+        {
+            resetAllocationReport();
+        }
+        if(result.stoppedEarly)
+        {
+            break;
+        }
+    }
+    if(bestWeights.size() > 0 && !bestIsCurrent)
+    {
+        network.weightParameters() = bestWeights;
+        network.biasParameters() = bestBiases;
+    }
+    if(checkpointWriter)
+    {
+        checkpointWriter->submit(snapshotTraining(network, prevWeightDelta, prevBiasDelta, epochsToRun, 0, options.checkpoint.normaliser));
+    }
+    traceSession.finish();
+    return result;
+}
+
+TrainingResult train(NNetwork& network, BatchSource& trainingSource, const ActFuncList& actFuncs, LossFunc lossFunc, const LearningRateList& lrList, NetNumT momentum, InitMethod initMethod, size_t epochsToRun, size_t batchSz, BatchSource& testSource, NetNumT dropOutRate, const TrainingOptions& options)
+{
+    initialiseWeightsBiases(network, initMethod);
+
+    // prev weight updates for momentum - set to 0 for first update
+    NetworkWeightGradients prevWeightDelta(network);
+    NetworkLayerGradients prevBiasDelta(network);
+
+    return runTraining(network, trainingSource, actFuncs, lossFunc, lrList, momentum, epochsToRun, batchSz, testSource, dropOutRate, options, prevWeightDelta, prevBiasDelta, 0, 0);
+}
 
-        std::cout << " -> Test Data (" << testData.size() << " items):\n";
-        std::cout << "   --> Average Loss: " << std::fixed << calculateLossForExampleData(network, testData, actFuncs, lossFunc) << std::endl;
-        std::cout << "   --> Accuracy: " << std::fixed << calculateAccuracyForExampleData(network, testData, actFuncs) << "%" << std::endl;
-        std::cout << "********************\n";
+TrainingResult resumeTraining(const std::string& checkpointFile, NNetwork& network, BatchSource& trainingSource, const ActFuncList& actFuncs, LossFunc lossFunc, const LearningRateList& lrList, NetNumT momentum, size_t epochsToRun, size_t batchSz, BatchSource& testSource, NetNumT dropOutRate, const TrainingOptions& options)
+{
+    const TrainingCheckpoint checkpoint = loadCheckpoint(checkpointFile);
+    NetworkWeightGradients prevWeightDelta(network);
+    NetworkLayerGradients prevBiasDelta(network);
+    restoreTraining(checkpoint, network, prevWeightDelta, prevBiasDelta);
 
+    return runTraining(network, trainingSource, actFuncs, lossFunc, lrList, momentum, epochsToRun, batchSz, testSource, dropOutRate, options, prevWeightDelta, prevBiasDelta, checkpoint.epoch, checkpoint.batchInEpoch);
+}
+
+TrainingResult continueTraining(NNetwork& network, BatchSource& trainingSource, const ActFuncList& actFuncs, LossFunc lossFunc, const LearningRateList& lrList, NetNumT momentum, size_t startEpoch, size_t epochsToRun, size_t batchSz, BatchSource& testSource, NetNumT dropOutRate,
+                                NetworkWeightGradients& prevWeightDelta, NetworkLayerGradients& prevBiasDelta, const TrainingOptions& options)
+{
+    if(prevWeightDelta.layout() != network.parameterLayout() || prevBiasDelta.layout() != network.parameterLayout())
+    {
+        throw std::logic_error("Momentum state does not match the network topology");
     }
-}
\ No newline at end of file
+    return runTraining(network, trainingSource, actFuncs, lossFunc, lrList, momentum, epochsToRun, batchSz, testSource, dropOutRate, options, prevWeightDelta, prevBiasDelta, startEpoch, 0);
+}
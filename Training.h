@@ -6,7 +6,11 @@
 #define NNETWORK2_TRAINING_H
 
 #include "NNetwork.h"
+#include "LearningRateSchedule.h"
 
+#include <cstddef>
+#include <iterator>
+#include <string>
 #include <vector>
 
 // types
@@ -20,49 +24,186 @@ struct ExampleItem
 };
 using ExampleData = std::vector<ExampleItem>;
 
+// walks a batch of items where they are stored - either a contiguous run of an ExampleData or the items an order
+// (positions into one) picks out, so a shuffled batch is read in place rather than copied
+class ExampleBatchIterator
+{
+    private:
+        ExampleData::const_iterator mItems;
+        const size_t* mOrder = nullptr;
+        std::ptrdiff_t mPos = 0;
+
+        [[nodiscard]] ExampleData::const_iterator item() const { return mItems + (mOrder == nullptr ? mPos : static_cast<std::ptrdiff_t>(mOrder[mPos])); }
+
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = ExampleItem;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const ExampleItem*;
+        using reference = const ExampleItem&;
+
+        ExampleBatchIterator() = default;
+        // contiguous items (implicit so ExampleData iterators can be passed as they are)
+        ExampleBatchIterator(ExampleData::const_iterator items) : mItems(items) {}
+        ExampleBatchIterator(ExampleData::iterator items) : mItems(items) {}
+        // the item at items[order[pos]]
+        ExampleBatchIterator(ExampleData::const_iterator items, const size_t* order, std::ptrdiff_t pos) : mItems(items), mOrder(order), mPos(pos) {}
+
+        reference operator*() const { return *item(); }
+        pointer operator->() const { return &*item(); }
+        reference operator[](difference_type offset) const { return *(*this + offset); }
+
+        ExampleBatchIterator& operator+=(difference_type offset) { mPos += offset; return *this; }
+        ExampleBatchIterator& operator-=(difference_type offset) { mPos -= offset; return *this; }
+        ExampleBatchIterator& operator++() { ++mPos; return *this; }
+        ExampleBatchIterator& operator--() { --mPos; return *this; }
+        ExampleBatchIterator operator++(int) { ExampleBatchIterator prev = *this; ++mPos; return prev; }
+        ExampleBatchIterator operator--(int) { ExampleBatchIterator prev = *this; --mPos; return prev; }
+        friend ExampleBatchIterator operator+(ExampleBatchIterator it, difference_type offset) { return it += offset; }
+        friend ExampleBatchIterator operator+(difference_type offset, ExampleBatchIterator it) { return it += offset; }
+        friend ExampleBatchIterator operator-(ExampleBatchIterator it, difference_type offset) { return it -= offset; }
+
+        // only iterators over the same items (and order) compare
+        friend difference_type operator-(const ExampleBatchIterator& a, const ExampleBatchIterator& b)
+        {
+            return a.mOrder == nullptr ? (a.mItems + a.mPos) - (b.mItems + b.mPos) : a.mPos - b.mPos;
+        }
+        friend bool operator==(const ExampleBatchIterator& a, const ExampleBatchIterator& b) { return a - b == 0; }
+        friend bool operator!=(const ExampleBatchIterator& a, const ExampleBatchIterator& b) { return a - b != 0; }
+        friend bool operator<(const ExampleBatchIterator& a, const ExampleBatchIterator& b) { return a - b < 0; }
+        friend bool operator>(const ExampleBatchIterator& a, const ExampleBatchIterator& b) { return a - b > 0; }
+        friend bool operator<=(const ExampleBatchIterator& a, const ExampleBatchIterator& b) { return a - b <= 0; }
+        friend bool operator>=(const ExampleBatchIterator& a, const ExampleBatchIterator& b) { return a - b >= 0; }
+};
+
 enum class LossFunc
 {
         MSE,
         CROSS_ENTROPY
 };
 
-// gradients for each weight in the network
+// gradients for each weight in the network - one flat buffer laid out like the network's weights region
 class NetworkWeightGradients
 {
     private:
-        std::vector< LayerWeightsT > weightGradients;
+        ParameterLayout mLayout;
+        AlignedParameterBuffer mGradients;
+        std::vector<LayerWeightsMapT> mLayerViews;
+
+        void bindLayerViews();
 
     public:
         explicit NetworkWeightGradients(NNetwork& network);
+        NetworkWeightGradients(const NetworkWeightGradients& other);
+        NetworkWeightGradients& operator=(const NetworkWeightGradients& other);
+        NetworkWeightGradients(NetworkWeightGradients&& other) noexcept = default;
+        NetworkWeightGradients& operator=(NetworkWeightGradients&& other) noexcept = default;
 
-        void setWeightGradientsForLayer(const LayerWeightsT& newWeightGrads, size_t layer);
-        [[nodiscard]] const LayerWeightsT& getWeightGradientsForLayer(size_t layer) const;
+        void setWeightGradientsForLayer(const Eigen::Ref<const LayerWeightsT>& newWeightGrads, size_t layer);
+        [[nodiscard]] const LayerWeightsMapT& getWeightGradientsForLayer(size_t layer) const;
+        LayerWeightsMapT& getWeightGradientsForLayer(size_t layer);
         void numericAddWeightGradients(const NetworkWeightGradients& weightsToAdd);
         void divideWeightGradients(size_t divideBy);
         [[nodiscard]] size_t numLayers() const;
         void setToZero();
+        [[nodiscard]] NetNumT squaredNorm() const;
+
+        // every layer's gradients as one array (matches NNetwork::weightParameters())
+        FlatParametersT flat();
+        [[nodiscard]] ConstFlatParametersT flat() const;
+        [[nodiscard]] const ParameterLayout& layout() const;
 };
 
 
-// Gradients for each neuron in the network (i.e. gradients for the bias)
+// Gradients for each neuron in the network (i.e. gradients for the bias) - one flat buffer laid out like the network's biases region
 class NetworkLayerGradients
 {
     private:
-        std::vector<SingleRowT> layerGradients;
+        ParameterLayout mLayout;
+        AlignedParameterBuffer mGradients;
+        std::vector<LayerBiasesMapT> mLayerViews;
+
+        void bindLayerViews();
 
     public:
         explicit NetworkLayerGradients(NNetwork& network);
+        NetworkLayerGradients(const NetworkLayerGradients& other);
+        NetworkLayerGradients& operator=(const NetworkLayerGradients& other);
+        NetworkLayerGradients(NetworkLayerGradients&& other) noexcept = default;
+        NetworkLayerGradients& operator=(NetworkLayerGradients&& other) noexcept = default;
 
-        void setLayerGradients(const SingleRowT& newLayerGrads, size_t layer);
-        [[nodiscard]] const SingleRowT& getLayerGradients(size_t layer) const;
+        void setLayerGradients(const Eigen::Ref<const SingleRowT>& newLayerGrads, size_t layer);
+        [[nodiscard]] const LayerBiasesMapT& getLayerGradients(size_t layer) const;
+        LayerBiasesMapT& getLayerGradients(size_t layer);
         void numericAddLayerGradients(const NetworkLayerGradients& layerGradsToAdd);
         void divideLayerGradients(size_t divideBy);
         [[nodiscard]] size_t numLayers() const;
         void setToZero();
+        [[nodiscard]] NetNumT squaredNorm() const;
+
+        // every layer's gradients as one array (matches NNetwork::biasParameters())
+        FlatParametersT flat();
+        [[nodiscard]] ConstFlatParametersT flat() const;
+        [[nodiscard]] const ParameterLayout& layout() const;
 };
 
 using LearningRateList = std::vector<NetNumT>;
 
+class BatchSource;
+struct DataNormaliser;
+struct TrainingStats;
+class TrainingCallback;
+
+struct CheckpointOptions
+{
+    std::string fileName; // checkpointing is disabled when empty
+    size_t everyNBatches = 0; // 0 to disable
+    double everyNMinutes = 0; // 0 to disable
+    const DataNormaliser* normaliser = nullptr; // stored in each checkpoint if set
+};
+
+// the evaluation result early stopping watches (training metrics need evaluateTrainingData)
+enum class StoppingMetric
+{
+        TEST_LOSS,
+        TEST_ACCURACY,
+        TRAINING_LOSS,
+        TRAINING_ACCURACY
+};
+
+struct EarlyStoppingOptions
+{
+    size_t patience = 0; // evaluations without improvement before stopping (0 to disable)
+    StoppingMetric metric = StoppingMetric::TEST_LOSS;
+    NetNumT minDelta = 0; // smaller changes don't count as an improvement
+    bool restoreBestWeights = true; // when training ends, go back to the weights of the best evaluation
+};
+
+// optional behaviour for train()
+struct TrainingOptions
+{
+    CheckpointOptions checkpoint;
+    LearningRateSchedule schedule; // scales the LearningRateList
+    size_t scheduleEpochs = 0; // length of the schedule if the run is trained in stages (0 for epochsToRun)
+    EarlyStoppingOptions earlyStopping;
+    TrainingStats* stats = nullptr; // per epoch timings / throughput are appended if set
+    std::string statsFile; // and written as json after each epoch if set
+    std::string traceFile; // Chrome trace of the run written here at the end if set (see Trace.h)
+    size_t evaluateEveryNEpochs = 1; // loss / accuracy after every N epochs and the last one (0 to never evaluate)
+    bool evaluateTrainingData = true; // as well as the test data
+    bool consoleOutput = true; // print progress each epoch (from a background thread)
+    std::vector<TrainingCallback*> callbacks; // not owned (see Metrics.h for sinks)
+};
+
+struct TrainingResult
+{
+    size_t epochsRun = 0; // including any before a resumed checkpoint
+    bool stoppedEarly = false;
+    bool evaluated = false; // best* are only set if so
+    size_t bestEpoch = 0; // by the early stopping metric
+    NetNumT bestMetric = 0;
+};
+
 // TRAINING ALGORITHMS
 
 // wieght initialisation functions
@@ -75,27 +216,43 @@ enum class InitMethod
         UNIFORM_XAVIER,
         NO_INIT
 };
-void initialiseWeightsBiases(NNetwork& network, InitMethod method);
+void initialiseWeightsBiases(NNetwork& network, InitMethod method, unsigned int seed = 12345);
 
 // loss functions / accuracy calculations
-NetNumT calculateLossForExampleItem(const Labels& labels, LossFunc lossFunc, const SingleRowT& networkOut);
+NetNumT calculateLossForExampleItem(const Labels& labels, LossFunc lossFunc, const Eigen::Ref<const SingleRowT>& networkOut);
 NetNumT calculateLossForExampleData(NNetwork& network, const ExampleData& trData, const ActFuncList& actFuncs, LossFunc lossFunc);
 
 NetNumT calculateAccuracyForExampleData(NNetwork& network, const ExampleData& data, const ActFuncList &actFuncList);
 
-// Gradient calculation
+NetNumT calculateLossForBatchSource(NNetwork& network, BatchSource& source, const ActFuncList& actFuncs, LossFunc lossFunc);
+NetNumT calculateAccuracyForBatchSource(NNetwork& network, BatchSource& source, const ActFuncList &actFuncs);
+// batched evaluation using a plan's pre-sized buffers (the plan is rebuilt if the network has changed shape)
+NetNumT calculateLossForBatchSource(NNetwork& network, BatchSource& source, const ActFuncList& actFuncs, LossFunc lossFunc, ExecutionPlan& plan);
+NetNumT calculateAccuracyForBatchSource(NNetwork& network, BatchSource& source, const ActFuncList &actFuncs, ExecutionPlan& plan);
 
-SingleRowT calculateActivationFunctionGradients(const NLayer& layer, ActFunc actFunc);
+// feeds [batchStart, batchEnd) forward together - row i of plan.batchOutputs(numLayers() - 1) is the output for item i
+// (or its net inputs if outputLogits, leaving the output layer's activation to a fused loss)
+Eigen::Index feedforwardBatch(NNetwork& network, ExampleBatchIterator batchStart, ExampleBatchIterator batchEnd, const ActFuncList& actFuncs, ExecutionPlan& plan, bool outputLogits = false);
+
+// Gradient calculation
 
-SingleRowT calculateOutputLayerGradientsForExampleItem(const NLayer& outputLayer, ActFunc actFuncForOutputLayer, LossFunc lossFunc, const Labels& targets);
-void calculateHiddenLayerGradientsForExampleItem(NNetwork& network, const ActFuncList& actFuncs, NetworkLayerGradients& layerGrads);
-void calculateWeightGradientsForExampleItem(NNetwork& network, const NetworkLayerGradients& layerGrads, NetworkWeightGradients& weightGrads);
+// multiplies values by the derivative of each output wrt its net input, a batch of rows at a time
+void multiplyByActivationGradients(Eigen::Ref<BatchActivationsT> values, const Eigen::Ref<const BatchActivationsT>& outputs, ActFunc actFunc);
 
-void calculateGradientsForExampleItem(NNetwork& network, const ActFuncList& actFuncs, LossFunc lossFunc, const ExampleItem& trItem, NetworkLayerGradients& layerGrads, NetworkWeightGradients& weightGrads, NetNumT dropOutRate);
-void calculateGradientsOverBatch(NNetwork& network, ExampleData::iterator batchStart, ExampleData::iterator batchEnd, const ActFuncList& actFuncs, LossFunc lossFunc, NetworkLayerGradients& averagedLayerGrads, NetworkWeightGradients& averagedWeightGrads, NetNumT dropOutRate);
+// adds the batch's averaged gradients to averagedLayerGrads and averagedWeightGrads. The batch is propagated plan.batchSz()
+// items at a time as matrix products, each parallelised as the plan decided (splitting the items over threads with
+// per thread weight gradients, or the neurons). The products pack into the plan's buffers so a step does not allocate
+void calculateGradientsOverBatch(NNetwork& network, ExampleBatchIterator batchStart, ExampleBatchIterator batchEnd, const ActFuncList& actFuncs, LossFunc lossFunc, NetworkLayerGradients& averagedLayerGrads, NetworkWeightGradients& averagedWeightGrads, NetNumT dropOutRate, ExecutionPlan& plan);
 
 // TRAIN
 void updateNetworkUsingGradients(NNetwork& network, const NetworkLayerGradients& layerGrads, const NetworkWeightGradients& weightGrads, const LearningRateList& learningRatesPerLayer, NetNumT momentumFactor, NetworkLayerGradients& prevUpdateBiasDelta, NetworkWeightGradients& prevUpdateWeightDelta);
-void train(NNetwork& network, ExampleData& trainingData, const ActFuncList& actFuncs, LossFunc lossFunc, const LearningRateList& lrList, NetNumT momentum, InitMethod initMethod, size_t epochsToRun, size_t batchSz, const ExampleData& testData, NetNumT dropOutRate);
+TrainingResult train(NNetwork& network, ExampleData& trainingData, const ActFuncList& actFuncs, LossFunc lossFunc, const LearningRateList& lrList, NetNumT momentum, InitMethod initMethod, size_t epochsToRun, size_t batchSz, const ExampleData& testData, NetNumT dropOutRate, const TrainingOptions& options = TrainingOptions());
+TrainingResult train(NNetwork& network, BatchSource& trainingSource, const ActFuncList& actFuncs, LossFunc lossFunc, const LearningRateList& lrList, NetNumT momentum, InitMethod initMethod, size_t epochsToRun, size_t batchSz, BatchSource& testSource, NetNumT dropOutRate, const TrainingOptions& options = TrainingOptions());
+// continues training from a checkpoint written by train() - the network must have the topology it had when checkpointed
+TrainingResult resumeTraining(const std::string& checkpointFile, NNetwork& network, BatchSource& trainingSource, const ActFuncList& actFuncs, LossFunc lossFunc, const LearningRateList& lrList, NetNumT momentum, size_t epochsToRun, size_t batchSz, BatchSource& testSource, NetNumT dropOutRate, const TrainingOptions& options = TrainingOptions());
+// trains epochs [startEpoch, epochsToRun) of a run done in stages - the network is not initialised and the momentum state
+// (zero before the first stage) carries over from the previous stage and is updated for the next
+TrainingResult continueTraining(NNetwork& network, BatchSource& trainingSource, const ActFuncList& actFuncs, LossFunc lossFunc, const LearningRateList& lrList, NetNumT momentum, size_t startEpoch, size_t epochsToRun, size_t batchSz, BatchSource& testSource, NetNumT dropOutRate,
+                                NetworkWeightGradients& prevWeightDelta, NetworkLayerGradients& prevBiasDelta, const TrainingOptions& options = TrainingOptions());
 
 #endif //NNETWORK2_TRAINING_H
\ No newline at end of file
@@ -1,26 +1,52 @@
 #include <fstream>
 #include <iostream>
-#include <omp.h>
+#include <optional>
 
 #include "NNetwork.h"
 #include "Training.h"
+#include "BatchSource.h"
 #include "Data.h"
+#include "DataCache.h"
+#include "ThreadConfig.h"
+#include "ParallelPolicy.h"
 
 
 
 int main()
 {
-    omp_set_num_threads(4);
-    Eigen::setNbThreads(4);
+    // threads and pinning from the machine's cores / NUMA nodes - override with NNETWORK_THREADS, NNETWORK_DATA_THREADS,
+    // NNETWORK_GEMM_THREADS, NNETWORK_PIN_THREADS and NNETWORK_JOBS / NNETWORK_JOB_INDEX when sharing the machine
+    const ThreadConfig threadConfig = ThreadConfig::fromEnvironment();
+    threadConfig.apply();
+    CpuTopology::detect().summarise(std::cout);
+    threadConfig.summarise(std::cout);
+    // NNETWORK_CALIBRATE_PARALLELISM=1 measures where splitting samples / columns over the GEMM threads pays off on this
+    // machine (a few seconds) rather than using the heuristics
+    setParallelismPolicy(ParallelismPolicy::fromEnvironment(threadConfig.gemmThreads));
+    activeParallelismPolicy().summarise(std::cout);
 
     // Data
     std::cout << "Loading and normalising data...\n \n";
 
-    ExampleData trainingData = loadTrainingDataFromFile("../TrainingData/mnist_train_3.csv");
-    normaliseTrainingData(trainingData, DataNormalisationMethod::Z_SCORE);
+    // set NNETWORK_DATA_CACHE to a directory to reuse the parsed and normalised data between runs. the cache files are
+    // then mapped and each batch gathered from them rather than copying every item into memory
+    const DataCacheOptions cacheOptions = DataCacheOptions::fromEnvironment();
+    DataNormaliser normaliser;
+    ExampleData trainingData, testData;
+    std::optional<MappedExampleData> mappedTrainingData, mappedTestData;
+    if(cacheOptions.cacheDir.empty())
+    {
+        trainingData = loadTrainingDataFromFile("../TrainingData/mnist_train_3.csv");
+        normaliser = normaliseTrainingData(trainingData, DataNormalisationMethod::Z_SCORE);
 
-    ExampleData testData = loadTrainingDataFromFile("../TrainingData/mnist_test.csv");
-    normaliseTrainingData(testData, DataNormalisationMethod::Z_SCORE);
+        testData = loadTrainingDataFromFile("../TrainingData/mnist_test.csv");
+        applyNormaliser(testData, normaliser); // test data uses the statistics fitted on the training data
+    }
+    else
+    {
+        mappedTrainingData = loadTrainingDataMapped("../TrainingData/mnist_train_3.csv", cacheOptions, DataNormalisationMethod::Z_SCORE, normaliser);
+        mappedTestData = loadTrainingDataMapped("../TrainingData/mnist_test.csv", cacheOptions); // normalised as batches are gathered
+    }
 
     // Network setup
     ClassList classes = getClasses();
@@ -44,8 +70,19 @@ int main()
     NetNumT dropOutRate = 0;
 
     // Train
-    train(network, trainingData, actFuncs, lossFunc, lRList, momentum, initMethod, epochs, batchSz, testData, dropOutRate);
+    if(mappedTrainingData)
+    {
+        MappedExampleDataSource trainingSource(*mappedTrainingData, DataNormaliser(), true); // already normalised in the cache
+        MappedExampleDataSource testSource(*mappedTestData, normaliser, false);
+        train(network, trainingSource, actFuncs, lossFunc, lRList, momentum, initMethod, epochs, batchSz, testSource, dropOutRate);
+    }
+    else
+    {
+        train(network, trainingData, actFuncs, lossFunc, lRList, momentum, initMethod, epochs, batchSz, testData, dropOutRate);
+    }
 
+    // fold the normaliser into the first layer so the saved model consumes raw inputs
+    //foldNormaliserIntoNetwork(network, normaliser);
     //std::ofstream fOut ("../model.dat");
     //serialise(fOut, network, actFuncs);
 }
\ No newline at end of file